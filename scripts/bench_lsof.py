@@ -0,0 +1,47 @@
+# Times attribute access over a large LSF file, one attr() call per attribute against
+# one attrs() call per node and a native to_tree() of the whole file.
+#
+# usage: python scripts/bench_lsof.py [pak] [lsf path inside the pak]
+import os
+import sys
+import time
+from pathlib import Path
+from pybg3 import pak, lsf
+
+BG3_ROOT = Path(os.environ.get("BG3_DATA", os.path.expanduser("~/l/bg3/Data")))
+PAK_PATH = sys.argv[1] if len(sys.argv) > 1 else BG3_ROOT / "Shared.pak"
+LSF_PATH = (
+    sys.argv[2] if len(sys.argv) > 2 else "Public/Shared/RootTemplates/_merged.lsf"
+)
+
+
+def bench(msg, cb, repeat=3):
+    best = None
+    for _ in range(repeat):
+        t_start = time.perf_counter()
+        rv = cb()
+        elapsed = time.perf_counter() - t_start
+        best = elapsed if best is None else min(best, elapsed)
+    print(f"{msg}: {best * 1000:.1f} ms")
+    return rv
+
+
+def each_attr(file):
+    for i in range(file.num_attrs()):
+        file.attr(i)
+
+
+def each_node(file):
+    for i in range(file.num_nodes()):
+        file.attrs(i)
+
+
+def whole_tree(file):
+    return lsf.Node.parse_file(file)
+
+
+file = lsf.loads(pak.PakFile(PAK_PATH).file_data(LSF_PATH))
+print(f"{LSF_PATH}: {file.num_nodes()} nodes, {file.num_attrs()} attributes")
+bench("attr() per attribute", lambda: each_attr(file))
+bench("attrs() per node", lambda: each_node(file))
+bench("to_tree() per root", lambda: whole_tree(file))
@@ -20,8 +20,23 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
 
 #include <pybind11/pybind11.h>
@@ -30,7 +45,14 @@
 #define LIBBG3_IMPLEMENTATION
 #include "libbg3.h"
 
+#include "pybg3_blob_cache.h"
 #include "pybg3_granny.h"
+#include "pybg3_lspk_index.h"
+#include "pybg3_lspk_stream.h"
+#include "pybg3_lspk_writer.h"
+#include "pybg3_object_index.h"
+#include "pybg3_parallel.h"
+#include "pybg3_prefetch.h"
 #include "rans.h"
 
 namespace py = pybind11;
@@ -69,8 +91,99 @@ int osiris_compile_path(const std::string& src, const std::string& dst) {
   return status;
 }
 
-struct py_lspk_file {
-  py_lspk_file(const std::string& path) {
+py::bytes bitknit2_compress(py::bytes data, int level) {
+  std::string_view view(data);
+  std::string buf(rans::bitknit2_encoder::max_encoded_size(view.size()), 0);
+  size_t len;
+  {
+    py::gil_scoped_release release;
+    rans::bitknit2_encoder encoder(level);
+    len = encoder.encode((uint8_t const*)view.data(), view.size(), (uint8_t*)buf.data(),
+                         buf.size());
+  }
+  return py::bytes(buf.data(), len);
+}
+
+py::bytes bitknit2_decompress(py::bytes data, size_t uncompressed_size) {
+  std::string_view view(data);
+  std::string buf(uncompressed_size, 0);
+  bool ok;
+  {
+    py::gil_scoped_release release;
+    rans::bitknit2_state state((uint8_t*)buf.data(), buf.size());
+    state.decode_incremental((uint8_t const*)view.data(), view.size());
+    ok = state.finish();
+  }
+  if (!ok) {
+    throw std::runtime_error("Failed to decompress bitknit2 data");
+  }
+  return py::bytes(buf);
+}
+
+// A strided buffer over memory that owner keeps alive, so that NumPy can wrap views into
+// file data and arrays decoded natively alike without copying them.
+struct py_buffer {
+  py::buffer_info as_buffer() {
+    return py::buffer_info(data, itemsize, format, shape.size(), shape, strides,
+                           readonly);
+  }
+  std::shared_ptr<void const> owner;
+  void* data;
+  ssize_t itemsize;
+  std::string format;
+  std::vector<ssize_t> shape;
+  std::vector<ssize_t> strides;
+  bool readonly;
+};
+
+// A writable, C-contiguous array of T.
+template <typename T>
+static py_buffer py_buffer_alloc(std::vector<ssize_t> shape) {
+  std::vector<ssize_t> strides(shape.size());
+  ssize_t size = 1;
+  for (size_t i = shape.size(); i--;) {
+    strides[i] = size * sizeof(T);
+    size *= shape[i];
+  }
+  std::shared_ptr<T[]> data(new T[size]);
+  return py_buffer{data, data.get(), sizeof(T), py::format_descriptor<T>::format(),
+                   std::move(shape), std::move(strides), false};
+}
+
+// A writable array of count records of T, described to NumPy by a struct format such
+// as "T{i:a:i:b:}" so that it comes out as a structured array.
+template <typename T>
+static py_buffer py_buffer_alloc_records(ssize_t count, std::string format) {
+  std::shared_ptr<T[]> data(new T[count]);
+  return py_buffer{data, data.get(), sizeof(T), std::move(format), {count}, {sizeof(T)},
+                   false};
+}
+
+struct py_lspk_extract_iter;
+
+static uint64_t py_lspk_entry_offset(bg3_lspk_manifest_entry const* entry) {
+  return entry->offset_lo | uint64_t(entry->offset_hi) << 32;
+}
+
+// Identifies the pak at path as it is on disk now, for checking saved indexes against.
+static std::optional<pybg3_lspk_index::pak_stamp> py_lspk_stamp(std::string const& path,
+                                                                 size_t num_files) {
+  std::error_code size_ec, mtime_ec;
+  pybg3_lspk_index::pak_stamp stamp{
+      std::filesystem::file_size(path, size_ec),
+      std::filesystem::last_write_time(path, mtime_ec).time_since_epoch().count(),
+      num_files};
+  if (size_ec || mtime_ec) {
+    return std::nullopt;
+  }
+  return stamp;
+}
+
+struct py_lspk_file : public std::enable_shared_from_this<py_lspk_file> {
+  // If index_path is given, the name index is loaded from there when it's up to date, and
+  // otherwise built and saved there for next time.
+  py_lspk_file(const std::string& path, std::optional<std::string> index_path)
+      : path(path) {
     bg3_status status = bg3_mapped_file_init_ro(&mapped, path.c_str());
     if (status) {
       throw std::runtime_error("Failed to open lspk file");
@@ -80,15 +193,38 @@ struct py_lspk_file {
       bg3_mapped_file_destroy(&mapped);
       throw std::runtime_error("Failed to parse lspk file");
     }
+    std::vector<std::string_view> names(lspk.num_files);
+    for (size_t i = 0; i < lspk.num_files; ++i) {
+      names[i] = lspk.manifest[i].name;
+    }
+    if (!index_path) {
+      index.emplace(std::move(names));
+      return;
+    }
+    auto stamp = py_lspk_stamp(path, lspk.num_files);
+    if (stamp) {
+      index = pybg3_lspk_index::load(*index_path, names, *stamp);
+    }
+    if (!index) {
+      index.emplace(std::move(names));
+      // The saved index is only a cache, so failing to write it isn't an error.
+      if (stamp) {
+        index->save(*index_path, *stamp);
+      }
+    }
   }
   ~py_lspk_file() {
+    pybg3_blob_cache::shared().drop_source(cache_source);
     bg3_lspk_file_destroy(&lspk);
     bg3_mapped_file_destroy(&mapped);
-    for (bg3_mapped_file& part : part_files) {
+    for (auto& [part_num, part] : part_files) {
       bg3_mapped_file_destroy(&part);
     }
   }
   void attach_part(size_t part_num, const std::string& path) {
+    if (part_files.contains(part_num)) {
+      throw std::runtime_error("Part file already attached");
+    }
     bg3_mapped_file part;
     bg3_status status = bg3_mapped_file_init_ro(&part, path.c_str());
     if (status) {
@@ -99,7 +235,14 @@ struct py_lspk_file {
       bg3_mapped_file_destroy(&part);
       throw std::runtime_error("Failed to attach part file");
     }
-    part_files.push_back(part);
+    part_files[part_num] = part;
+  }
+  // Attaches parts 1 and up from the files next to path named <stem>_<part><ext>, which
+  // is how the game lays them out.
+  void attach_parts(const std::string& path) {
+    for (size_t i = 1; i < num_parts(); ++i) {
+      attach_part(i, pybg3_lspk_part_path(path, i));
+    }
   }
   size_t num_parts() { return lspk.header.num_parts; }
   size_t num_files() { return lspk.num_files; }
@@ -127,22 +270,729 @@ struct py_lspk_file {
     return lspk.manifest[idx].part_num;
   }
   int priority() { return lspk.header.priority; }
+  // This pak as an object index built over it records it.
+  pybg3_object_index_pak object_index_pak() {
+    auto stamp = py_lspk_stamp(path, lspk.num_files);
+    if (!stamp) {
+      throw std::runtime_error("Failed to stat " + path);
+    }
+    return {path, *stamp};
+  }
+  std::optional<size_t> find(std::string_view name) { return index->find(name); }
+  std::vector<uint32_t> glob(const std::string& pattern) { return index->glob(pattern); }
+  std::vector<uint32_t> list_prefix(std::string_view prefix) {
+    return index->with_prefix(prefix);
+  }
+  // All the entry names at once, which is much cheaper than a file_name call per entry.
+  py::list file_names() {
+    py::list names(lspk.num_files);
+    for (size_t i = 0; i < lspk.num_files; ++i) {
+      std::string_view name = index->names[i];
+      PyObject* str = PyUnicode_DecodeUTF8(name.data(), name.size(), nullptr);
+      if (!str) {
+        throw py::error_already_set();
+      }
+      PyList_SET_ITEM(names.ptr(), i, str);
+    }
+    return names;
+  }
+  bool is_compressed(size_t idx) {
+    return LIBBG3_LSPK_ENTRY_COMPRESSION_METHOD(lspk.manifest[idx].compression) !=
+           LIBBG3_LSPK_ENTRY_COMPRESSION_NONE;
+  }
+  // A compressed entry's contents from the shared blob cache, extracting and caching
+  // them on a miss. The cache must be enabled.
+  pybg3_blob cached_blob(size_t idx) {
+    pybg3_blob_cache& cache = pybg3_blob_cache::shared();
+    pybg3_blob_cache::key key{cache_source, idx};
+    if (std::optional<pybg3_blob> hit = cache.get(key)) {
+      return *std::move(hit);
+    }
+    size_t size = file_size(idx);
+    std::shared_ptr<char[]> buf(new char[size]);
+    bg3_status status;
+    {
+      py::gil_scoped_release release;
+      status = bg3_lspk_file_extract(&lspk, &lspk.manifest[idx], buf.get(), &size);
+    }
+    if (status) {
+      throw std::runtime_error("Failed to extract file");
+    }
+    pybg3_blob blob{std::move(buf), size};
+    cache.put(key, blob);
+    return blob;
+  }
+  // Extracts straight into the returned bytes object, so the data is only copied once.
+  // With the blob cache enabled, compressed entries are copied out of the cache instead.
   py::bytes file_data(size_t idx) {
     if (idx >= lspk.num_files) {
       throw std::runtime_error("Index out of bounds");
     }
+    if (is_compressed(idx) && pybg3_blob_cache::shared().enabled()) {
+      pybg3_blob blob = cached_blob(idx);
+      return py::bytes(blob.data.get(), blob.size);
+    }
     size_t size = file_size(idx);
-    std::string buf(size, 0);
-    bg3_status status =
-        bg3_lspk_file_extract(&lspk, &lspk.manifest[idx], buf.data(), &size);
+    PyObject* bytes = PyBytes_FromStringAndSize(nullptr, size);
+    if (!bytes) {
+      throw py::error_already_set();
+    }
+    py::bytes rv = py::reinterpret_steal<py::bytes>(bytes);
+    bg3_status status;
+    {
+      py::gil_scoped_release release;
+      status = bg3_lspk_file_extract(&lspk, &lspk.manifest[idx], PyBytes_AS_STRING(bytes),
+                                     &size);
+    }
     if (status) {
       throw std::runtime_error("Failed to extract file");
     }
-    return py::bytes(buf);
+    return rv;
+  }
+  // The entry's bytes as they're stored in the pak or part file, which must be attached.
+  std::string_view stored_data(size_t idx) {
+    if (idx >= lspk.num_files) {
+      throw std::runtime_error("Index out of bounds");
+    }
+    bg3_lspk_manifest_entry* entry = &lspk.manifest[idx];
+    bg3_mapped_file* file = part_mapping(entry->part_num);
+    if (!file) {
+      throw std::runtime_error("Part file not attached");
+    }
+    uint64_t offset = py_lspk_entry_offset(entry);
+    if (offset > file->data_len || file->data_len - offset < entry->compressed_size) {
+      throw std::runtime_error("File data out of bounds");
+    }
+    return std::string_view(file->data + offset, entry->compressed_size);
+  }
+  // A read-only buffer with the entry's contents. Stored entries are viewed in place in
+  // the mapped pak, which the view keeps open. Compressed ones are extracted into a
+  // buffer of their own, without the GIL, or shared with the blob cache if it's enabled.
+  py_buffer file_view(size_t idx) {
+    if (idx >= lspk.num_files) {
+      throw std::runtime_error("Index out of bounds");
+    }
+    bg3_lspk_manifest_entry* entry = &lspk.manifest[idx];
+    std::shared_ptr<void const> owner;
+    char* data;
+    size_t size;
+    if (!is_compressed(idx)) {
+      std::string_view stored = stored_data(idx);
+      owner = shared_from_this();
+      data = (char*)stored.data();
+      size = stored.size();
+    } else if (pybg3_blob_cache::shared().enabled()) {
+      pybg3_blob blob = cached_blob(idx);
+      data = (char*)blob.data.get();
+      size = blob.size;
+      owner = std::move(blob.data);
+    } else {
+      size = file_size(idx);
+      std::shared_ptr<char[]> buf(new char[size]);
+      bg3_status status;
+      {
+        py::gil_scoped_release release;
+        status = bg3_lspk_file_extract(&lspk, entry, buf.get(), &size);
+      }
+      if (status) {
+        throw std::runtime_error("Failed to extract file");
+      }
+      owner = buf;
+      data = buf.get();
+    }
+    return py_buffer{std::move(owner), data, 1, "B", {ssize_t(size)}, {1}, true};
+  }
+  // The mapping of a part, or null if it isn't attached.
+  bg3_mapped_file* part_mapping(size_t part) {
+    if (!part) {
+      return &mapped;
+    }
+    auto it = part_files.find(part);
+    return it == part_files.end() ? nullptr : &it->second;
+  }
+  // Starts reading entries into memory in the background, so that extracting them later
+  // doesn't stall on a page fault every few KB. Entries close together in the pak are
+  // read as one range. Entries in parts that aren't attached are skipped.
+  void prefetch(std::vector<size_t> const& indices) {
+    std::vector<pybg3_byte_range> ranges;
+    ranges.reserve(indices.size());
+    for (size_t idx : indices) {
+      if (idx >= lspk.num_files) {
+        throw std::runtime_error("Index out of bounds");
+      }
+      bg3_lspk_manifest_entry* entry = &lspk.manifest[idx];
+      ranges.push_back(
+          {entry->part_num, py_lspk_entry_offset(entry), entry->compressed_size});
+    }
+    for (pybg3_byte_range const& r : pybg3_coalesce_ranges(std::move(ranges), 64 << 10)) {
+      if (bg3_mapped_file* file = part_mapping(r.part)) {
+        pybg3_prefetch_range(file->data, file->data_len, r.offset, r.size);
+      }
+    }
+  }
+  // Sequential readahead suits scans of the whole pak in stored order, like unpack.
+  void set_sequential(bool sequential) {
+    pybg3_advise_sequential(mapped.data, mapped.data_len, sequential);
+    for (auto& [part_num, part] : part_files) {
+      pybg3_advise_sequential(part.data, part.data_len, sequential);
+    }
+  }
+  // Decompresses an entry into fd a chunk at a time, so that even huge files need only
+  // a small fixed amount of memory. Returns the number of bytes written.
+  uint64_t stream_to_fd(size_t idx, int fd) {
+    bg3_lspk_manifest_entry* entry = &lspk.manifest[idx];
+    std::string_view stored = stored_data(idx);
+    pybg3_fd_writer writer(fd);
+    unsigned method = LIBBG3_LSPK_ENTRY_COMPRESSION_METHOD(entry->compression);
+    auto sink = [&](std::string_view chunk) { writer.write(chunk); };
+    bool ok = pybg3_lspk_stream_decode(method, stored, file_size(idx), sink);
+    if (!ok && !writer.bytes_written()) {
+      // Methods that can't be streamed are extracted in one go.
+      size_t size = file_size(idx);
+      std::unique_ptr<char[]> buf(new char[size]);
+      ok = !bg3_lspk_file_extract(&lspk, entry, buf.get(), &size);
+      if (ok) {
+        writer.write(std::string_view(buf.get(), size));
+      }
+    }
+    if (!ok) {
+      throw std::runtime_error("Failed to extract file");
+    }
+    if (!writer.flush()) {
+      throw std::runtime_error(std::string("Failed to write file: ") +
+                               strerror(writer.error()));
+    }
+    return writer.bytes_written();
+  }
+  // target is either a file descriptor, which is written from its current position and
+  // left open, or a path, which is created or truncated.
+  uint64_t extract_to(size_t idx, py::object target) {
+    if (idx >= lspk.num_files) {
+      throw std::runtime_error("Index out of bounds");
+    }
+    if (py::isinstance<py::int_>(target)) {
+      int fd = target.cast<int>();
+      py::gil_scoped_release release;
+      return stream_to_fd(idx, fd);
+    }
+    std::string path = py::str(py::module_::import("os").attr("fspath")(target));
+    py::gil_scoped_release release;
+    return stream_to_path(idx, path);
+  }
+  uint64_t stream_to_path(size_t idx, std::string const& path) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to create " + path + ": " + strerror(errno));
+    }
+    try {
+      uint64_t size = stream_to_fd(idx, fd);
+      if (close(fd)) {
+        throw std::runtime_error("Failed to write " + path + ": " + strerror(errno));
+      }
+      return size;
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+  }
+  // Extracts every entry to its path under directory on up to `threads` threads. Each
+  // thread streams whole entries, so one thread's writes overlap the others'
+  // decompression. Entries are handed out in the order they're stored, which keeps
+  // reads from the pak mostly sequential. If several entries have the same name, only
+  // the last one is extracted, as with find, so no two threads write the same file.
+  void unpack(const std::string& directory, int threads) {
+    std::filesystem::path root(directory);
+    std::vector<size_t> order;
+    order.reserve(lspk.num_files);
+    for (size_t i = 0; i < lspk.num_files; ++i) {
+      if (index->find(index->names[i]) == i) {
+        order.push_back(i);
+      }
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      bg3_lspk_manifest_entry* ea = &lspk.manifest[a];
+      bg3_lspk_manifest_entry* eb = &lspk.manifest[b];
+      return std::pair(ea->part_num, py_lspk_entry_offset(ea)) <
+             std::pair(eb->part_num, py_lspk_entry_offset(eb));
+    });
+    std::vector<std::filesystem::path> paths(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      std::filesystem::path name(lspk.manifest[order[i]].name);
+      bool safe = !name.empty() && name.is_relative() && !name.has_root_path();
+      for (auto const& part : name) {
+        safe = safe && part != "..";
+      }
+      if (!safe) {
+        throw std::runtime_error("Unsafe file name " + name.string());
+      }
+      paths[i] = root / name;
+    }
+    py::gil_scoped_release release;
+    pybg3_parallel_for(order.size(), pybg3_thread_count(threads), [&](size_t i) {
+      std::error_code ec;
+      std::filesystem::create_directories(paths[i].parent_path(), ec);
+      if (ec) {
+        throw std::runtime_error("Failed to create " + paths[i].parent_path().string() +
+                                 ": " + ec.message());
+      }
+      stream_to_path(order[i], paths[i].string());
+    });
   }
+  std::unique_ptr<py_lspk_extract_iter> extract_many(std::vector<size_t> indices,
+                                                     int threads,
+                                                     bool ordered);
+  std::string path;
   bg3_mapped_file mapped;
   bg3_lspk_file lspk;
-  std::vector<bg3_mapped_file> part_files;
+  std::map<size_t, bg3_mapped_file> part_files;
+  std::optional<pybg3_lspk_index> index;
+  uint64_t cache_source{pybg3_blob_cache::new_source()};
+};
+
+// Extracts a batch of entries, possibly from several paks, on a pool of worker threads,
+// yielding (key, bytes) pairs either in the order they were requested or as they
+// finish. Each entry is extracted straight into its bytes object, and only a couple of
+// entries per thread are in flight at a time so that memory use stays bounded however
+// big the batch is.
+//
+// The workers never touch Python objects: bytes are allocated and handed out by
+// __next__, which holds the GIL, and workers are only given their buffers.
+struct py_lspk_extract_iter {
+  struct request {
+    py_lspk_file* file;
+    size_t index;
+    py::object key;
+  };
+  struct job {
+    char* dst;
+    size_t size;
+    bool done;
+    bool ok;
+  };
+  // files keeps the paks that requests refer to open.
+  py_lspk_extract_iter(std::vector<std::shared_ptr<py_lspk_file>> files,
+                       std::vector<request> requests,
+                       int num_threads,
+                       bool ordered)
+      : files(std::move(files)),
+        requests(std::move(requests)),
+        ordered(ordered),
+        jobs(this->requests.size()),
+        results(this->requests.size()) {
+    for (request const& r : this->requests) {
+      if (r.index >= r.file->lspk.num_files) {
+        throw std::runtime_error("Index out of bounds");
+      }
+    }
+    num_threads = std::min<size_t>(num_threads, this->requests.size());
+    window = 2 * std::max(num_threads, 1);
+    for (int i = 0; i < num_threads; ++i) {
+      workers.emplace_back([this] { work(); });
+    }
+  }
+  ~py_lspk_extract_iter() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+  static void type_setup(PyHeapTypeObject* ht) {
+    PyTypeObject* type = &ht->ht_type;
+    type->tp_iter = [](PyObject* self) -> PyObject* {
+      Py_INCREF(self);
+      return self;
+    };
+  }
+  py::tuple next() {
+    if (consumed == requests.size()) {
+      throw py::stop_iteration();
+    }
+    schedule();
+    size_t slot;
+    {
+      py::gil_scoped_release release;
+      std::unique_lock<std::mutex> lock(mutex);
+      if (ordered) {
+        slot = consumed;
+        job_done.wait(lock, [&] { return jobs[slot].done; });
+      } else {
+        job_done.wait(lock, [&] { return !finished.empty(); });
+        slot = finished.front();
+        finished.pop_front();
+      }
+    }
+    ++consumed;
+    if (slot < prefetched) {
+      prefetched_bytes -= stored_size(slot);
+    }
+    py::bytes data = std::move(results[slot]);
+    if (!jobs[slot].ok) {
+      throw std::runtime_error("Failed to extract file");
+    }
+    return py::make_tuple(requests[slot].key, std::move(data));
+  }
+  size_t stored_size(size_t slot) {
+    return requests[slot].file->lspk.manifest[requests[slot].index].compressed_size;
+  }
+  // Keeps the next few MB of requested entries being read ahead of the workers. The new
+  // entries are prefetched with one call per pak, so that neighbours can be coalesced.
+  void prefetch_ahead() {
+    std::map<py_lspk_file*, std::vector<size_t>> indices;
+    while (prefetched < requests.size() && prefetched_bytes < (64 << 20)) {
+      request const& r = requests[prefetched];
+      indices[r.file].push_back(r.index);
+      prefetched_bytes += stored_size(prefetched++);
+    }
+    for (auto& [file, file_indices] : indices) {
+      file->prefetch(file_indices);
+    }
+  }
+  // Allocates bytes for the next requested entries, up to the window, and queues them.
+  void schedule() {
+    prefetch_ahead();
+    std::vector<size_t> slots;
+    while (scheduled < requests.size() && scheduled - consumed < window) {
+      request const& r = requests[scheduled];
+      size_t size = r.file->file_size(r.index);
+      PyObject* bytes = PyBytes_FromStringAndSize(nullptr, size);
+      if (!bytes) {
+        throw py::error_already_set();
+      }
+      results[scheduled] = py::reinterpret_steal<py::bytes>(bytes);
+      jobs[scheduled] = {PyBytes_AS_STRING(bytes), size, false, false};
+      slots.push_back(scheduled++);
+    }
+    if (slots.empty()) {
+      return;
+    }
+    if (workers.empty()) {
+      for (size_t slot : slots) {
+        py::gil_scoped_release release;
+        run(slot);
+      }
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queue.insert(queue.end(), slots.begin(), slots.end());
+    }
+    work_ready.notify_all();
+  }
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      work_ready.wait(lock, [&] { return stopping || !queue.empty(); });
+      if (stopping) {
+        return;
+      }
+      size_t slot = queue.front();
+      queue.pop_front();
+      lock.unlock();
+      run(slot);
+      lock.lock();
+    }
+  }
+  void run(size_t slot) {
+    job& j = jobs[slot];
+    request const& r = requests[slot];
+    size_t size = j.size;
+    bg3_lspk_file* lspk = &r.file->lspk;
+    bool ok = !bg3_lspk_file_extract(lspk, &lspk->manifest[r.index], j.dst, &size);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      j.ok = ok && size == j.size;
+      j.done = true;
+      if (!ordered) {
+        finished.push_back(slot);
+      }
+    }
+    job_done.notify_all();
+  }
+  std::vector<std::shared_ptr<py_lspk_file>> files;
+  std::vector<request> requests;
+  bool ordered;
+  size_t window;
+  std::vector<job> jobs;
+  std::vector<py::bytes> results;
+  size_t scheduled{0};
+  size_t consumed{0};
+  size_t prefetched{0};
+  uint64_t prefetched_bytes{0};
+  std::mutex mutex;
+  std::condition_variable work_ready, job_done;
+  std::deque<size_t> queue;
+  std::deque<size_t> finished;
+  bool stopping{false};
+  std::vector<std::thread> workers;
+};
+
+// threads is resolved with pybg3_thread_count. With a single thread the entries are
+// extracted in __next__ (still without the GIL) rather than on a worker.
+std::unique_ptr<py_lspk_extract_iter> py_lspk_file::extract_many(
+    std::vector<size_t> indices,
+    int threads,
+    bool ordered) {
+  std::vector<py_lspk_extract_iter::request> requests;
+  requests.reserve(indices.size());
+  for (size_t index : indices) {
+    requests.push_back({this, index, py::int_(index)});
+  }
+  int num_threads = pybg3_thread_count(threads);
+  return std::make_unique<py_lspk_extract_iter>(
+      std::vector{shared_from_this()}, std::move(requests),
+      num_threads > 1 ? num_threads : 0, ordered);
+}
+
+// Collects files for a new pak and writes it with pybg3_lspk_write.
+struct py_lspk_writer {
+  // The bytes are kept alive until the writer goes away, and aren't copied.
+  void add_data(std::string name, py::bytes data) {
+    char* buf;
+    ssize_t size;
+    PyBytes_AsStringAndSize(data.ptr(), &buf, &size);
+    sources.push_back({std::move(name), std::string_view(buf, size), ""});
+    buffers.push_back(std::move(data));
+  }
+  // The file is only read when the pak is written.
+  void add_file(std::string name, std::string path) {
+    sources.push_back({std::move(name), std::string_view(), std::move(path)});
+  }
+  size_t num_files() { return sources.size(); }
+  // Files with the same name in pak are compared against the new contents when the pak
+  // is written, and copied over without recompressing if they haven't changed. pak can
+  // be the one being overwritten.
+  void reuse_from(std::shared_ptr<py_lspk_file> pak) { previous = std::move(pak); }
+  py::dict write(const std::string& path,
+                 unsigned method,
+                 int level,
+                 int threads,
+                 uint64_t part_size,
+                 uint8_t priority) {
+    for (pybg3_lspk_source& source : sources) {
+      source.previous.reset();
+      std::optional<size_t> idx = previous ? previous->find(source.name) : std::nullopt;
+      if (idx) {
+        bg3_lspk_manifest_entry* entry = &previous->lspk.manifest[*idx];
+        source.previous = {previous->stored_data(*idx), entry->compression,
+                           entry->uncompressed_size};
+      }
+    }
+    pybg3_lspk_write_stats stats;
+    {
+      py::gil_scoped_release release;
+      pybg3_lspk_write_options options{method, level, threads, part_size, priority};
+      stats = pybg3_lspk_write(path, sources, options);
+    }
+    py::dict result;
+    result["compressed"] = stats.compressed;
+    result["reused"] = stats.reused;
+    return result;
+  }
+  std::vector<pybg3_lspk_source> sources;
+  std::vector<py::bytes> buffers;
+  std::shared_ptr<py_lspk_file> previous;
+};
+
+static void blob_cache_configure(size_t max_bytes) {
+  pybg3_blob_cache::shared().set_capacity(max_bytes);
+}
+
+static void blob_cache_clear() {
+  pybg3_blob_cache::shared().clear();
+}
+
+static py::dict blob_cache_stats() {
+  pybg3_blob_cache::stats stats = pybg3_blob_cache::shared().get_stats();
+  py::dict result;
+  result["hits"] = stats.hits;
+  result["misses"] = stats.misses;
+  result["evictions"] = stats.evictions;
+  result["entries"] = stats.entries;
+  result["bytes"] = stats.bytes;
+  result["capacity"] = stats.capacity;
+  return result;
+}
+
+// Several paks mounted into one namespace. Where more than one pak has a file, the pak
+// with the highest priority in its header wins, and among equal priorities the one
+// mounted last. Lookups go through a single hash table over every mounted name, so they
+// don't depend on the number of paks.
+struct py_pak_set {
+  struct entry {
+    uint32_t pak;
+    uint32_t index;
+  };
+  // Opens a pak and its part files and mounts it, returning its position in the set.
+  size_t mount(const std::string& path, std::optional<std::string> index_path) {
+    auto file = std::make_shared<py_lspk_file>(path, std::move(index_path));
+    file->attach_parts(path);
+    return add(std::move(file));
+  }
+  size_t add(std::shared_ptr<py_lspk_file> file) {
+    uint32_t pak = paks.size();
+    int priority = file->priority();
+    // The keys point at names in the manifests, which live as long as the paks do.
+    for (uint32_t i = 0; i < file->lspk.num_files; ++i) {
+      auto [it, inserted] = entries.try_emplace(file->index->names[i], entry{pak, i});
+      if (!inserted && priority >= paks[it->second.pak]->priority()) {
+        it->second = {pak, i};
+      }
+    }
+    paks.push_back(std::move(file));
+    return pak;
+  }
+  std::optional<std::pair<size_t, size_t>> find(std::string_view name) {
+    auto it = entries.find(name);
+    if (it == entries.end()) {
+      return std::nullopt;
+    }
+    return std::pair<size_t, size_t>(it->second.pak, it->second.index);
+  }
+  entry const& resolve(std::string_view name) {
+    auto it = entries.find(name);
+    if (it == entries.end()) {
+      throw py::key_error(std::string(name));
+    }
+    return it->second;
+  }
+  py::bytes file_data(std::string_view name) {
+    entry const& e = resolve(name);
+    return paks[e.pak]->file_data(e.index);
+  }
+  py_buffer file_view(std::string_view name) {
+    entry const& e = resolve(name);
+    return paks[e.pak]->file_view(e.index);
+  }
+  size_t file_size(std::string_view name) {
+    entry const& e = resolve(name);
+    return paks[e.pak]->file_size(e.index);
+  }
+  // Every name in the set once, whichever pak provides it.
+  py::list file_names() {
+    py::list names(entries.size());
+    size_t i = 0;
+    for (auto& [name, e] : entries) {
+      PyObject* str = PyUnicode_DecodeUTF8(name.data(), name.size(), nullptr);
+      if (!str) {
+        throw py::error_already_set();
+      }
+      PyList_SET_ITEM(names.ptr(), i++, str);
+    }
+    return names;
+  }
+  size_t num_paks() { return paks.size(); }
+  std::shared_ptr<py_lspk_file> pak(size_t idx) {
+    if (idx >= paks.size()) {
+      throw std::runtime_error("Index out of bounds");
+    }
+    return paks[idx];
+  }
+  // Like py_lspk_file::extract_many, but the files can come from any of the paks, and
+  // the pairs yielded are (name, bytes).
+  std::unique_ptr<py_lspk_extract_iter> extract_many(std::vector<py::str> names,
+                                                     int threads,
+                                                     bool ordered) {
+    std::vector<py_lspk_extract_iter::request> requests;
+    requests.reserve(names.size());
+    for (py::str& name : names) {
+      entry const& e = resolve(name.cast<std::string_view>());
+      requests.push_back({paks[e.pak].get(), e.index, std::move(name)});
+    }
+    int num_threads = pybg3_thread_count(threads);
+    return std::make_unique<py_lspk_extract_iter>(
+        paks, std::move(requests), num_threads > 1 ? num_threads : 0, ordered);
+  }
+  std::vector<std::shared_ptr<py_lspk_file>> paks;
+  std::unordered_map<std::string_view, entry> entries;
+};
+
+static std::vector<pybg3_object_index_pak> py_object_index_paks(
+    std::vector<std::shared_ptr<py_lspk_file>> const& paks) {
+  std::vector<pybg3_object_index_pak> result;
+  for (auto const& pak : paks) {
+    result.push_back(pak->object_index_pak());
+  }
+  return result;
+}
+
+// Collects the node index dicts from _LsofFile.index_objects into an object index.
+struct py_object_index_builder {
+  // priorities are the header priorities of the paks, which decide which pak's object a
+  // key resolves to when several have it, as in a pak set.
+  explicit py_object_index_builder(std::vector<int> priorities)
+      : builder(std::move(priorities)) {}
+  // Adds every key in objects, mapped to its node in the LSF file at entry of pak. Keys
+  // that aren't strings are indexed by their str().
+  void add(std::string const& table, uint32_t pak, uint32_t entry, py::dict objects) {
+    if (table.find('\0') != std::string::npos) {
+      throw std::runtime_error("Table names can't contain NUL");
+    }
+    PyObject* key;
+    PyObject* value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(objects.ptr(), &pos, &key, &value)) {
+      py::object key_str =
+          py::reinterpret_steal<py::object>(PyUnicode_Check(key) ? Py_NewRef(key)
+                                                                 : PyObject_Str(key));
+      Py_ssize_t key_size;
+      char const* key_data =
+          key_str ? PyUnicode_AsUTF8AndSize(key_str.ptr(), &key_size) : nullptr;
+      long node = PyLong_AsLong(value);
+      if (!key_data || (node == -1 && PyErr_Occurred())) {
+        throw py::error_already_set();
+      }
+      builder.add(table, std::string_view(key_data, key_size),
+                  pybg3_object_location{pak, entry, int32_t(node)});
+    }
+  }
+  size_t size() { return builder.size(); }
+  // paks are the paks that the pak numbers given to add refer to, in order.
+  void write(std::string const& path, std::vector<std::shared_ptr<py_lspk_file>> paks) {
+    std::vector<pybg3_object_index_pak> stamps = py_object_index_paks(paks);
+    py::gil_scoped_release release;
+    if (!builder.save(path, stamps)) {
+      throw std::runtime_error("Failed to write object index to " + path);
+    }
+  }
+  pybg3_object_index_builder builder;
+};
+
+// A saved object index. open returns None if there isn't one at path or it was built
+// for different paks, or different versions of them.
+struct py_object_index {
+  static std::unique_ptr<py_object_index> open(
+      std::string const& path,
+      std::vector<std::shared_ptr<py_lspk_file>> paks) {
+    std::optional<pybg3_object_index> index =
+        pybg3_object_index::open(path, py_object_index_paks(paks));
+    if (!index) {
+      return nullptr;
+    }
+    return std::make_unique<py_object_index>(std::move(*index));
+  }
+  explicit py_object_index(pybg3_object_index index) : index(std::move(index)) {}
+  // Returns (pak, entry, node), or None.
+  std::optional<py::tuple> find(std::string_view table, std::string_view key) {
+    std::optional<pybg3_object_location> location = index.find(table, key);
+    if (!location) {
+      return std::nullopt;
+    }
+    return py::make_tuple(location->pak, location->entry, location->node);
+  }
+  size_t size() { return index.size(); }
+  // The number of keys in each table.
+  py::dict tables() {
+    py::dict result;
+    for (auto const& [table, size] : index.tables()) {
+      result[py::str(table)] = size;
+    }
+    return result;
+  }
+  pybg3_object_index index;
 };
 
 static py::object convert_value(bg3_lsof_dt type, char* value_bytes, size_t length) {
@@ -162,7 +1012,7 @@ static py::object convert_value(bg3_lsof_dt type, char* value_bytes, size_t leng
       }
       memcpy(&id, value_bytes, sizeof(id));
       bg3_buffer tmp = {};
-      bg3_buffer_printf(&tmp, "%08x-%04x-%04x-%04x-%04x%04x%04x\")", id.word, id.half[0],
+      bg3_buffer_printf(&tmp, "%08x-%04x-%04x-%04x-%04x%04x%04x", id.word, id.half[0],
                         id.half[1], id.half[2], id.half[3], id.half[4], id.half[5]);
       py::object result = py::str(tmp.data, tmp.size);
       bg3_buffer_destroy(&tmp);
@@ -249,6 +1099,106 @@ static py::object convert_value(bg3_lsof_dt type, char* value_bytes, size_t leng
   }
 }
 
+// Row layouts of _LsofFile.tables(), which must match the formats given there.
+struct lsof_node_record {
+  int32_t name, parent, next, attrs;
+};
+struct lsof_attr_record {
+  int32_t name, owner, next;
+  uint32_t value_offset, length;
+  uint8_t type;
+  uint8_t padding[3];
+};
+static_assert(sizeof(lsof_node_record) == 16 && sizeof(lsof_attr_record) == 24);
+
+// The classes from lsf.py that to_tree instantiates, in the order lsf.py passes them.
+enum lsof_tree_type {
+  lsof_tree_node,
+  lsof_tree_u8,
+  lsof_tree_i32,
+  lsof_tree_lsstring,
+  lsof_tree_f32,
+  lsof_tree_vec2,
+  lsof_tree_vec3,
+  lsof_tree_vec4,
+  lsof_tree_ivec2,
+  lsof_tree_ivec3,
+  lsof_tree_ivec4,
+  lsof_tree_num_types,
+};
+
+// Builds instances of the plain Python classes in lsf.py without running their
+// __init__, which is the bulk of the cost when a tree is built from Python.
+struct lsof_tree_builder {
+  explicit lsof_tree_builder(py::tuple types) {
+    if (types.size() != lsof_tree_num_types) {
+      throw std::runtime_error("to_tree expects the lsf node and value types");
+    }
+    for (size_t i = 0; i < lsof_tree_num_types; ++i) {
+      PyObject* type = types[i].ptr();
+      if (!PyType_Check(type)) {
+        throw std::runtime_error("to_tree expects the lsf node and value types");
+      }
+      this->types[i] = (PyTypeObject*)type;
+    }
+    static PyObject* keys[] = {
+        PyUnicode_InternFromString("name"),     PyUnicode_InternFromString("attrs"),
+        PyUnicode_InternFromString("children"), PyUnicode_InternFromString("value"),
+        PyUnicode_InternFromString("x"),        PyUnicode_InternFromString("y"),
+        PyUnicode_InternFromString("z"),        PyUnicode_InternFromString("w"),
+    };
+    name_key = keys[0];
+    attrs_key = keys[1];
+    children_key = keys[2];
+    value_key = keys[3];
+    for (size_t i = 0; i < 4; ++i) {
+      component_keys[i] = keys[4 + i];
+    }
+    empty_args = own(PyTuple_New(0));
+  }
+  static py::object own(PyObject* obj) {
+    if (!obj) {
+      throw py::error_already_set();
+    }
+    return py::reinterpret_steal<py::object>(obj);
+  }
+  py::object make(lsof_tree_type type) {
+    PyTypeObject* t = types[type];
+    return own(t->tp_new(t, empty_args.ptr(), nullptr));
+  }
+  void set(py::object const& obj, PyObject* key, py::object const& value) {
+    if (PyObject_SetAttr(obj.ptr(), key, value.ptr())) {
+      throw py::error_already_set();
+    }
+  }
+  py::object wrap(lsof_tree_type type, py::object const& value) {
+    py::object obj = make(type);
+    set(obj, value_key, value);
+    return obj;
+  }
+  template <typename T, size_t N>
+  py::object vec(lsof_tree_type type, char const* value_bytes) {
+    T components[N];
+    memcpy(components, value_bytes, sizeof(components));
+    py::object obj = make(type);
+    for (size_t i = 0; i < N; ++i) {
+      if constexpr (std::is_floating_point_v<T>) {
+        set(obj, component_keys[i], own(PyFloat_FromDouble(components[i])));
+      } else {
+        set(obj, component_keys[i], own(PyLong_FromLong(components[i])));
+      }
+    }
+    return obj;
+  }
+  PyTypeObject* types[lsof_tree_num_types];
+  PyObject* name_key;
+  PyObject* attrs_key;
+  PyObject* children_key;
+  PyObject* value_key;
+  PyObject* component_keys[4];
+  py::object empty_args;
+};
+
 struct py_lsof_file {
   static std::unique_ptr<py_lsof_file> from_path(py::str path) {
     return std::make_unique<py_lsof_file>(path);
@@ -268,6 +1218,7 @@ struct py_lsof_file {
       throw std::runtime_error("Failed to parse lsof file");
     }
     is_mapped_file = true;
+    prepare();
   }
   py_lsof_file(py::bytes data) : data(data) {
     std::string_view view(data);
@@ -277,6 +1228,7 @@ struct py_lsof_file {
     if (status) {
       throw std::runtime_error("Failed to parse lsof file");
     }
+    prepare();
   }
   ~py_lsof_file() {
     if (is_mapped_file) {
@@ -291,9 +1243,15 @@ struct py_lsof_file {
     bg3_buffer_destroy(&tmp_buf);
     return result;  // 3 string allocations, lol
   }
-  bool is_wide() {
-    return LIBBG3_IS_SET(reader.header.flags, LIBBG3_LSOF_FLAG_HAS_SIBLING_POINTERS);
+  // Does the per-file work that node and attribute lookups would otherwise repeat on
+  // every call. Symbol names are interned on first use by intern_name.
+  void prepare() {
+    wide = LIBBG3_IS_SET(reader.header.flags, LIBBG3_LSOF_FLAG_HAS_SIBLING_POINTERS);
+    if (!wide) {
+      bg3_lsof_reader_ensure_value_offsets(&reader);
+    }
   }
+  bool is_wide() { return wide; }
   size_t num_nodes() { return reader.num_nodes; }
   size_t num_attrs() { return reader.num_attrs; }
   py::tuple node(size_t idx) {
@@ -301,9 +1259,7 @@ struct py_lsof_file {
     if (bg3_lsof_reader_get_node(&reader, &n, idx)) {
       throw std::runtime_error("Index out of bounds");
     }
-    bg3_lsof_symtab_entry* sym = bg3_lsof_symtab_get_ref(&reader.symtab, n.name);
-    std::string name(sym->data, sym->length);
-    return py::make_tuple(name, n.parent, n.next, n.attrs);
+    return py::make_tuple(intern_name(n.name), n.parent, n.next, n.attrs);
   }
   py::tuple attr(size_t idx) {
     bg3_lsof_attr_wide a;
@@ -312,20 +1268,268 @@ struct py_lsof_file {
     }
     // TODO: this whole API situation is really bad on the C level. think we need an
     // attribute iterator api or something
-    bg3_lsof_symtab_entry* sym = bg3_lsof_symtab_get_ref(&reader.symtab, a.name);
-    std::string name(sym->data, sym->length);
-    bool wide = is_wide();
-    bg3_lsof_reader_ensure_value_offsets(&reader);
+    return attr_tuple(idx, a);
+  }
+  // All attributes of a node, as attr() returns them one at a time.
+  py::list attrs(size_t node_idx) {
+    bg3_lsof_node_wide n;
+    if (bg3_lsof_reader_get_node(&reader, &n, node_idx)) {
+      throw std::runtime_error("Index out of bounds");
+    }
+    py::list result;
+    for (int32_t attr_idx = n.attrs;
+         attr_idx >= 0 && (size_t)attr_idx < reader.num_attrs;) {
+      bg3_lsof_attr_wide a;
+      if (bg3_lsof_reader_get_attr(&reader, &a, attr_idx)) {
+        throw std::runtime_error("Index out of bounds");
+      }
+      if (!wide && a.owner != (int32_t)node_idx) {
+        break;
+      }
+      result.append(attr_tuple(attr_idx, a));
+      attr_idx = wide ? a.next : attr_idx + 1;
+    }
+    return result;
+  }
+  py::tuple attr_tuple(size_t idx, bg3_lsof_attr_wide const& a) {
     size_t offset = wide ? a.value : reader.value_offsets[idx];
     py::object owner = py::none();
     if (!wide) {
       owner = py::int_(a.owner);
     }
     char* value_bytes = reader.value_table_raw + offset;
-    return py::make_tuple(name, (int)a.type, a.next, owner,
+    return py::make_tuple(intern_name(a.name), (int)a.type, a.next, owner,
                           convert_value((bg3_lsof_dt)a.type, value_bytes, a.length));
   }
-  void ensure_sibling_pointers() { bg3_lsof_reader_ensure_sibling_pointers(&reader); }
+  // Exports the node and attribute tables as record arrays in one call, so analytics
+  // over many files can run vectorised in NumPy instead of going through node() and
+  // attr(). Names are ids into a deduplicated string table, value offsets index a copy
+  // of the value table, and owner/next are filled in for both table layouts.
+  py::dict tables() {
+    size_t num_nodes = reader.num_nodes;
+    size_t num_attrs = reader.num_attrs;
+    py_buffer nodes = py_buffer_alloc_records<lsof_node_record>(
+        num_nodes, "T{i:name:i:parent:i:next:i:attrs:}");
+    py_buffer attrs = py_buffer_alloc_records<lsof_attr_record>(
+        num_attrs, "T{i:name:i:owner:i:next:I:value_offset:I:length:B:type:3x}");
+    size_t values_size = reader.header.value_table.uncompressed_size;
+    py_buffer values = py_buffer_alloc<uint8_t>({ssize_t(values_size)});
+    std::vector<std::string_view> names;
+    {
+      py::gil_scoped_release release;
+      if (values_size) {
+        memcpy(values.data, reader.value_table_raw, values_size);
+      }
+      std::unordered_map<uint32_t, int32_t> ids_by_ref;
+      std::unordered_map<std::string_view, int32_t> ids_by_name;
+      auto name_id = [&](bg3_lsof_sym_ref ref) {
+        auto [it, inserted] =
+            ids_by_ref.try_emplace((uint32_t)ref.bucket << 16 | ref.entry);
+        if (inserted) {
+          bg3_lsof_symtab_entry* sym = bg3_lsof_symtab_get_ref(&reader.symtab, ref);
+          auto [name, added] = ids_by_name.try_emplace(
+              std::string_view(sym->data, sym->length), (int32_t)names.size());
+          if (added) {
+            names.push_back(name->first);
+          }
+          it->second = name->second;
+        }
+        return it->second;
+      };
+      auto* node_records = (lsof_node_record*)nodes.data;
+      auto* attr_records = (lsof_attr_record*)attrs.data;
+      std::vector<int32_t> last_child;
+      if (!wide) {
+        last_child.resize(num_nodes, -1);
+      }
+      for (size_t i = 0; i < num_nodes; ++i) {
+        bg3_lsof_node_wide n;
+        if (bg3_lsof_reader_get_node(&reader, &n, i)) {
+          throw std::runtime_error("Failed to read lsof node table");
+        }
+        node_records[i] = {name_id(n.name), n.parent, wide ? n.next : -1, n.attrs};
+        // Narrow files don't store sibling pointers, so link each node to the
+        // previous child of its parent.
+        if (!wide && n.parent >= 0 && (size_t)n.parent < num_nodes) {
+          if (last_child[n.parent] != -1) {
+            node_records[last_child[n.parent]].next = i;
+          }
+          last_child[n.parent] = i;
+        }
+      }
+      for (size_t i = 0; i < num_attrs; ++i) {
+        bg3_lsof_attr_wide a;
+        if (bg3_lsof_reader_get_attr(&reader, &a, i)) {
+          throw std::runtime_error("Failed to read lsof attribute table");
+        }
+        lsof_attr_record& r = attr_records[i];
+        r = {name_id(a.name), -1, -1, 0, a.length, (uint8_t)a.type, {}};
+        if (wide) {
+          r.next = a.next;
+          r.value_offset = a.value;
+        } else {
+          r.owner = a.owner;
+          r.value_offset = reader.value_offsets[i];
+          if (i && attr_records[i - 1].owner == r.owner) {
+            attr_records[i - 1].next = i;
+          }
+        }
+      }
+      // Wide files only link attributes from their node, so walk each chain once to
+      // recover the owners.
+      for (size_t i = 0; wide && i < num_nodes; ++i) {
+        for (int32_t attr_idx = node_records[i].attrs;
+             attr_idx >= 0 && (size_t)attr_idx < num_attrs;
+             attr_idx = attr_records[attr_idx].next) {
+          if (attr_records[attr_idx].owner != -1) {
+            throw std::runtime_error("Invalid lsof attribute chain");
+          }
+          attr_records[attr_idx].owner = i;
+        }
+      }
+    }
+    py::list py_names(names.size());
+    for (size_t i = 0; i < names.size(); ++i) {
+      PyObject* str = PyUnicode_DecodeUTF8(names[i].data(), names[i].size(), nullptr);
+      if (!str) {
+        throw py::error_already_set();
+      }
+      PyList_SET_ITEM(py_names.ptr(), i, str);
+    }
+    py::dict result;
+    result["nodes"] = std::move(nodes);
+    result["attrs"] = std::move(attrs);
+    result["values"] = std::move(values);
+    result["names"] = py_names;
+    return result;
+  }
+  // Materialises the node at node_idx and everything under it as lsf.Node objects in
+  // one pass, matching lsf.Node.parse_node. Returns the node and the index of the first
+  // node past it. Names and string values are interned per file.
+  py::tuple to_tree(size_t node_idx, py::tuple types) {
+    lsof_tree_builder builder(types);
+    struct open_node {
+      int32_t idx;
+      py::object node;
+      py::object children;
+    };
+    std::vector<open_node> stack;
+    auto append_child = [](open_node& parent, py::object const& child) {
+      if (PyList_Append(parent.children.ptr(), child.ptr())) {
+        throw py::error_already_set();
+      }
+    };
+    for (; node_idx < reader.num_nodes; ++node_idx) {
+      bg3_lsof_node_wide n;
+      if (bg3_lsof_reader_get_node(&reader, &n, node_idx)) {
+        throw std::runtime_error("Index out of bounds");
+      }
+      while (!stack.empty() && n.parent != stack.back().idx) {
+        py::object child = std::move(stack.back().node);
+        stack.pop_back();
+        if (stack.empty()) {
+          return py::make_tuple(child, node_idx);
+        }
+        append_child(stack.back(), child);
+      }
+      py::object node = builder.make(lsof_tree_node);
+      py::object attrs = builder.own(PyDict_New());
+      py::object children = builder.own(PyList_New(0));
+      builder.set(node, builder.name_key, intern_name(n.name));
+      builder.set(node, builder.attrs_key, attrs);
+      builder.set(node, builder.children_key, children);
+      for (int32_t attr_idx = n.attrs;
+           attr_idx >= 0 && (size_t)attr_idx < reader.num_attrs;) {
+        bg3_lsof_attr_wide a;
+        if (bg3_lsof_reader_get_attr(&reader, &a, attr_idx)) {
+          throw std::runtime_error("Index out of bounds");
+        }
+        if (!wide && a.owner != (int32_t)node_idx) {
+          break;
+        }
+        size_t offset = wide ? a.value : reader.value_offsets[attr_idx];
+        py::object value = tree_value(builder, (bg3_lsof_dt)a.type,
+                                      reader.value_table_raw + offset, a.length);
+        if (PyDict_SetItem(attrs.ptr(), intern_name(a.name).ptr(), value.ptr())) {
+          throw py::error_already_set();
+        }
+        attr_idx = wide ? a.next : attr_idx + 1;
+      }
+      stack.push_back({(int32_t)node_idx, std::move(node), std::move(children)});
+    }
+    if (stack.empty()) {
+      throw std::runtime_error("Index out of bounds");
+    }
+    while (stack.size() > 1) {
+      py::object child = std::move(stack.back().node);
+      stack.pop_back();
+      append_child(stack.back(), child);
+    }
+    return py::make_tuple(stack[0].node, node_idx);
+  }
+  py::object const& intern_name(bg3_lsof_sym_ref ref) {
+    py::object& name = interned_names[(uint32_t)ref.bucket << 16 | ref.entry];
+    if (!name) {
+      bg3_lsof_symtab_entry* sym = bg3_lsof_symtab_get_ref(&reader.symtab, ref);
+      name = lsof_tree_builder::own(
+          PyUnicode_DecodeUTF8(sym->data, sym->length, nullptr));
+    }
+    return name;
+  }
+  py::object const& intern_string(char const* data, size_t length) {
+    py::object& str = interned_strings[std::string_view(data, length)];
+    if (!str) {
+      str = lsof_tree_builder::own(PyUnicode_DecodeUTF8(data, length, nullptr));
+    }
+    return str;
+  }
+  // Only the types lsf.Node.parse_node has wrappers for are converted, everything
+  // else is None there too.
+  py::object tree_value(lsof_tree_builder& builder,
+                        bg3_lsof_dt type,
+                        char const* value_bytes,
+                        size_t length) {
+    switch (type) {
+      case bg3_lsof_dt_bool:
+        return py::bool_(*value_bytes != 0);
+      case bg3_lsof_dt_uint8:
+        return builder.wrap(lsof_tree_u8,
+                            builder.own(PyLong_FromLong((uint8_t)*value_bytes)));
+      case bg3_lsof_dt_int32: {
+        int32_t val;
+        memcpy(&val, value_bytes, sizeof(val));
+        return builder.wrap(lsof_tree_i32, builder.own(PyLong_FromLong(val)));
+      }
+      case bg3_lsof_dt_float: {
+        float val;
+        memcpy(&val, value_bytes, sizeof(val));
+        return builder.wrap(lsof_tree_f32, builder.own(PyFloat_FromDouble(val)));
+      }
+      case bg3_lsof_dt_lsstring:
+        return builder.wrap(lsof_tree_lsstring,
+                            intern_string(value_bytes, length ? length - 1 : 0));
+      case bg3_lsof_dt_fixedstring:
+        return intern_string(value_bytes, length ? length - 1 : 0);
+      case bg3_lsof_dt_vec2:
+        return builder.vec<float, 2>(lsof_tree_vec2, value_bytes);
+      case bg3_lsof_dt_vec3:
+        return builder.vec<float, 3>(lsof_tree_vec3, value_bytes);
+      case bg3_lsof_dt_vec4:
+        return builder.vec<float, 4>(lsof_tree_vec4, value_bytes);
+      case bg3_lsof_dt_ivec2:
+        return builder.vec<int32_t, 2>(lsof_tree_ivec2, value_bytes);
+      case bg3_lsof_dt_ivec3:
+        return builder.vec<int32_t, 3>(lsof_tree_ivec3, value_bytes);
+      case bg3_lsof_dt_ivec4:
+        return builder.vec<int32_t, 4>(lsof_tree_ivec4, value_bytes);
+      default:
+        return py::none();
+    }
+  }
+  void ensure_sibling_pointers() {
+    bg3_lsof_reader_ensure_sibling_pointers(&reader);
+    prepare();
+  }
   void scan_unique_objects(py::function callback,
                            std::string name_key,
                            std::string uuid_key,
@@ -387,6 +1591,69 @@ struct py_lsof_file {
       }
     }
   }
+  // Indexes the objects in the sibling chain starting at node_idx by each attribute
+  // named in keys, stopping at end if it isn't negative. Returns one dict per key that
+  // maps attribute values to node indices. Objects without a key are left out of that
+  // key's dict, and later duplicates win.
+  py::list index_objects(std::vector<std::string> keys, int32_t node_idx, int32_t end) {
+    ensure_sibling_pointers();
+    bg3_lsof_node_wide* nodes = (bg3_lsof_node_wide*)reader.node_table_raw;
+    bg3_lsof_attr_wide* attrs = (bg3_lsof_attr_wide*)reader.attr_table_raw;
+    std::unordered_map<uint32_t, int32_t> slots_by_ref;
+    auto slot_of = [&](bg3_lsof_sym_ref ref) {
+      auto [it, inserted] =
+          slots_by_ref.try_emplace((uint32_t)ref.bucket << 16 | ref.entry, -1);
+      if (inserted) {
+        bg3_lsof_symtab_entry* sym = bg3_lsof_symtab_get_ref(&reader.symtab, ref);
+        std::string_view name(sym->data, sym->length);
+        for (size_t i = 0; i < keys.size(); ++i) {
+          if (keys[i] == name) {
+            it->second = i;
+            break;
+          }
+        }
+      }
+      return it->second;
+    };
+    std::vector<py::dict> maps(keys.size());
+    std::vector<int32_t> found(keys.size());
+    int32_t num_nodes = reader.num_nodes;
+    if (end < 0 || end > num_nodes) {
+      end = num_nodes;
+    }
+    for (; node_idx >= 0 && node_idx < end; node_idx = nodes[node_idx].next) {
+      std::fill(found.begin(), found.end(), -1);
+      size_t num_found = 0;
+      for (int32_t attr_idx = nodes[node_idx].attrs;
+           num_found < keys.size() && attr_idx != -1; attr_idx = attrs[attr_idx].next) {
+        int32_t slot = slot_of(attrs[attr_idx].name);
+        if (slot != -1 && found[slot] == -1) {
+          found[slot] = attr_idx;
+          ++num_found;
+        }
+      }
+      if (!num_found) {
+        continue;
+      }
+      py::int_ py_node_idx(node_idx);
+      for (size_t i = 0; i < keys.size(); ++i) {
+        if (found[i] == -1) {
+          continue;
+        }
+        bg3_lsof_attr_wide* a = attrs + found[i];
+        py::object key = convert_value((bg3_lsof_dt)a->type,
+                                       reader.value_table_raw + a->value, a->length);
+        if (PyDict_SetItem(maps[i].ptr(), key.ptr(), py_node_idx.ptr())) {
+          throw py::error_already_set();
+        }
+      }
+    }
+    py::list result;
+    for (py::dict& map : maps) {
+      result.append(std::move(map));
+    }
+    return result;
+  }
   py::tuple stats() {
     return py::make_tuple(reader.header.string_table.uncompressed_size,
                           reader.header.node_table.uncompressed_size,
@@ -394,9 +1661,12 @@ struct py_lsof_file {
                           reader.header.value_table.uncompressed_size);
   }
   bool is_mapped_file{false};
+  bool wide{false};
   py::bytes data;
   bg3_mapped_file mapped;
   bg3_lsof_reader reader;
+  std::unordered_map<uint32_t, py::object> interned_names;
+  std::unordered_map<std::string_view, py::object> interned_strings;
 };
 
 struct py_loca_file {
@@ -490,6 +1760,44 @@ struct py_index_reader {
 
 struct py_granny_reader;
 
+struct granny_compiled_type;
+
+// A field of a granny_compiled_type. offset is from the start of the object, and
+// element_size is the size of one element when the field is an array.
+struct granny_compiled_field {
+  bg3_granny_type_info* type_info;
+  size_t offset;
+  size_t element_size;
+  // The compiled reference_type. Inline types are compiled along with their parent, the
+  // rest the first time the field is dereferenced.
+  granny_compiled_type* reference;
+};
+
+// A bg3_granny_type_info flattened into a table of field offsets with a name index, so
+// that attribute lookups don't have to walk the type info and size every preceding
+// field. Compiled once per type per reader.
+struct granny_compiled_type {
+  bg3_granny_type_info* type_info;
+  size_t size;
+  std::vector<granny_compiled_field> fields;
+  // Keys point at the field names in the granny data, which outlives the reader's cache.
+  std::unordered_map<std::string_view, size_t> fields_by_name;
+  // The Python struct format of the type, computed on first use. Empty if the type
+  // can't be expressed as one.
+  std::optional<std::string> buffer_format;
+};
+
+// Returns type_info's compiled layout, compiling it the first time the reader sees it.
+static granny_compiled_type* granny_compile_type(py_granny_reader& reader,
+                                                 bg3_granny_type_info* type_info);
+static granny_compiled_type* granny_field_reference(py_granny_reader& reader,
+                                                    granny_compiled_field& field);
+
+// Lazy readers only load a section when something first points into it. Everything that
+// follows a pointer out of granny data goes through this (or granny_compile_type, for
+// type infos); it does nothing otherwise.
+static void granny_ensure_loaded(py_granny_reader& reader, void const* ptr);
+
 static size_t granny_data_type_size(bg3_granny_data_type dt) {
   switch (dt) {
     case bg3_granny_dt_inline:
@@ -619,30 +1927,6 @@ static bool granny_python_struct_push_object(std::string& format,
   return true;
 }
 
-static size_t granny_field_size(bg3_granny_type_info* ti);
-
-static size_t granny_object_size(bg3_granny_type_info* ti) {
-  size_t object_size = 0;
-  for (bg3_granny_type_info* rti = ti; rti->type != bg3_granny_dt_end; ++rti) {
-    object_size += granny_field_size(rti);
-  }
-  return object_size;
-}
-
-static size_t granny_field_size(bg3_granny_type_info* ti) {
-  size_t field_size = granny_data_type_size(ti->type);
-  if (ti->type == bg3_granny_dt_inline) {
-    for (bg3_granny_type_info* rti = ti->reference_type; rti->type != bg3_granny_dt_end;
-         ++rti) {
-      field_size += granny_field_size(rti);
-    }
-  }
-  if (ti->num_elements) {
-    field_size *= ti->num_elements;
-  }
-  return field_size;
-}
-
 template <typename T>
 struct py_granny_span_iter {
   py_granny_span_iter(T span) : span(span), index(0) {}
@@ -654,13 +1938,12 @@ struct py_granny_span_iter {
 template <typename T>
 struct py_granny_span {
   py_granny_span(std::shared_ptr<py_granny_reader> reader,
-                 bg3_granny_type_info* type_info,
+                 granny_compiled_type* type,
                  void* data,
                  size_t num_elements)
-      : reader(std::move(reader)),
-        type_info(type_info),
-        data(data),
-        num_elements(num_elements) {}
+      : reader(std::move(reader)), type(type), data(data), num_elements(num_elements) {
+    granny_ensure_loaded(*this->reader, data);
+  }
   static void type_setup(PyHeapTypeObject* ht) {
     PyTypeObject* type = &ht->ht_type;
     type->tp_iter = [](PyObject* self) -> PyObject* {
@@ -671,36 +1954,43 @@ struct py_granny_span {
   }
   size_t len() { return num_elements; }
   std::shared_ptr<py_granny_reader> reader;
-  bg3_granny_type_info* type_info;
+  granny_compiled_type* type;
   void* data;
   size_t num_elements;
 };
 
 struct py_granny_direct_span : public py_granny_span<py_granny_direct_span> {
   py_granny_direct_span(std::shared_ptr<py_granny_reader> reader,
-                        bg3_granny_type_info* type_info,
+                        granny_compiled_type* type,
                         void* data,
                         size_t num_elements)
-      : py_granny_span(reader, type_info, data, num_elements),
-        element_size(granny_object_size(type_info)) {}
+      : py_granny_span(reader, type, data, num_elements), element_size(type->size) {}
   py::buffer_info as_buffer() {
-    std::string format;
-    if (!granny_python_struct_push_object(format, type_info)) {
+    if (!type->buffer_format) {
+      std::string format;
+      if (!granny_python_struct_push_object(format, type->type_info)) {
+        format.clear();
+      }
+      type->buffer_format = std::move(format);
+    }
+    if (type->buffer_format->empty()) {
       throw std::runtime_error("Unsupported data type");
     }
-    return py::buffer_info(data, element_size, std::move(format), 1, {num_elements},
+    return py::buffer_info(data, element_size, *type->buffer_format, 1, {num_elements},
                            {element_size}, true);
   }
   py::object get_item(size_t index);
+  py_buffer view(std::string const& name);
+  py::dict decode(std::optional<std::vector<std::string>> names);
   size_t element_size;
 };
 
 struct py_granny_ptr_span : public py_granny_span<py_granny_ptr_span> {
   py_granny_ptr_span(std::shared_ptr<py_granny_reader> reader,
-                     bg3_granny_type_info* type_info,
+                     granny_compiled_type* type,
                      void* data,
                      size_t num_elements)
-      : py_granny_span(reader, type_info, data, num_elements) {}
+      : py_granny_span(reader, type, data, num_elements) {}
   py::object get_item(size_t index);
 };
 
@@ -712,56 +2002,56 @@ static py::tuple convert_vec4(float vec[4]) {
 }
 
 static py::object convert_scalar(std::shared_ptr<py_granny_reader>& reader,
-                                 bg3_granny_type_info* ti,
+                                 granny_compiled_field& field,
                                  char* ptr,
                                  size_t offset);
 
 struct py_granny_ptr {
   py_granny_ptr(std::shared_ptr<py_granny_reader> reader,
-                bg3_granny_type_info* type_info,
+                granny_compiled_type* type,
                 void* data)
-      : reader(std::move(reader)), type_info(type_info), data(data) {}
+      : reader(std::move(reader)), type(type), data(data) {
+    granny_ensure_loaded(*this->reader, data);
+  }
   py::object getattr(std::string const& name) {
-    size_t offset = 0;
+    auto it = type->fields_by_name.find(name);
+    if (it == type->fields_by_name.end()) {
+      return py::none();
+    }
+    granny_compiled_field& field = type->fields[it->second];
     char* ptr = (char*)data;
-    for (bg3_granny_type_info* ti = type_info; ti->type != bg3_granny_dt_end; ++ti) {
-      if (!strcmp(name.c_str(), ti->name)) {
-        if (ti->num_elements) {
-          py::list rv;
-          size_t element_size = granny_field_size(ti) / ti->num_elements;
-          for (size_t i = 0; i < ti->num_elements; ++i) {
-            rv.append(convert_scalar(reader, ti, ptr, offset));
-            offset += element_size;
-          }
-          return rv;
-        } else {
-          return convert_scalar(reader, ti, ptr, offset);
-        }
+    if (field.type_info->num_elements) {
+      py::list rv;
+      size_t offset = field.offset;
+      for (size_t i = 0; i < field.type_info->num_elements; ++i) {
+        rv.append(convert_scalar(reader, field, ptr, offset));
+        offset += field.element_size;
       }
-      offset += granny_field_size(ti);
+      return rv;
     }
-    return py::none();
+    return convert_scalar(reader, field, ptr, field.offset);
   }
   std::vector<std::string> dir() {
     std::vector<std::string> output;
-    for (bg3_granny_type_info* ti = type_info; ti->type != bg3_granny_dt_end; ++ti) {
-      output.push_back(ti->name);
+    for (auto const& field : type->fields) {
+      output.push_back(field.type_info->name);
     }
     return output;
   }
   std::shared_ptr<py_granny_reader> reader;
-  bg3_granny_type_info* type_info;
+  granny_compiled_type* type;
   void* data;
 };
 
 static py::object convert_scalar(std::shared_ptr<py_granny_reader>& reader,
-                                 bg3_granny_type_info* ti,
+                                 granny_compiled_field& field,
                                  char* ptr,
                                  size_t offset) {
+  bg3_granny_type_info* ti = field.type_info;
   switch (ti->type) {
     case bg3_granny_dt_inline: {
       return py::cast(
-          std::make_unique<py_granny_ptr>(reader, ti->reference_type, ptr + offset));
+          std::make_unique<py_granny_ptr>(reader, field.reference, ptr + offset));
     }
     case bg3_granny_dt_reference: {
       void* ref;
@@ -769,7 +2059,8 @@ static py::object convert_scalar(std::shared_ptr<py_granny_reader>& reader,
       if (!ref) {
         return py::none();
       }
-      return py::cast(std::make_unique<py_granny_ptr>(reader, ti->reference_type, ref));
+      return py::cast(std::make_unique<py_granny_ptr>(
+          reader, granny_field_reference(*reader, field), ref));
     }
     case bg3_granny_dt_reference_to_array: {
       struct LIBBG3_PACK {
@@ -778,7 +2069,7 @@ static py::object convert_scalar(std::shared_ptr<py_granny_reader>& reader,
       } pack;
       memcpy(&pack, ptr + offset, sizeof(pack));
       return py::cast(std::make_unique<py_granny_direct_span>(
-          reader, ti->reference_type, pack.ref, pack.num_elements));
+          reader, granny_field_reference(*reader, field), pack.ref, pack.num_elements));
     }
     case bg3_granny_dt_array_of_references: {
       struct LIBBG3_PACK {
@@ -786,8 +2077,8 @@ static py::object convert_scalar(std::shared_ptr<py_granny_reader>& reader,
         void* ref;
       } pack;
       memcpy(&pack, ptr + offset, sizeof(pack));
-      return py::cast(std::make_unique<py_granny_ptr_span>(reader, ti->reference_type,
-                                                           pack.ref, pack.num_elements));
+      return py::cast(std::make_unique<py_granny_ptr_span>(
+          reader, granny_field_reference(*reader, field), pack.ref, pack.num_elements));
     }
     case bg3_granny_dt_variant_reference: {
       bg3_granny_variant variant;
@@ -795,17 +2086,20 @@ static py::object convert_scalar(std::shared_ptr<py_granny_reader>& reader,
       if (!variant.obj) {
         return py::none();
       }
-      return py::cast(std::make_unique<py_granny_ptr>(reader, variant.type, variant.obj));
+      return py::cast(std::make_unique<py_granny_ptr>(
+          reader, granny_compile_type(*reader, variant.type), variant.obj));
     }
     case bg3_granny_dt_reference_to_variant_array: {
       bg3_granny_variant_array variant_array;
       memcpy(&variant_array, ptr + offset, sizeof(bg3_granny_variant_array));
       return py::cast(std::make_unique<py_granny_direct_span>(
-          reader, variant_array.type, variant_array.items, variant_array.num_items));
+          reader, granny_compile_type(*reader, variant_array.type), variant_array.items,
+          variant_array.num_items));
     }
     case bg3_granny_dt_string: {
       char* str;
       memcpy(&str, ptr + offset, sizeof(char*));
+      granny_ensure_loaded(*reader, str);
       return py::str(str);
     }
     case bg3_granny_dt_transform: {
@@ -873,67 +2167,490 @@ py::object py_granny_direct_span::get_item(size_t index) {
   if (index >= num_elements) {
     throw py::index_error();
   }
-  return py::cast(std::make_unique<py_granny_ptr>(reader, type_info,
-                                                  (char*)data + index * element_size));
+  return py::cast(
+      std::make_unique<py_granny_ptr>(reader, type, (char*)data + index * element_size));
+}
+
+static bool granny_is_numeric(bg3_granny_data_type dt) {
+  switch (dt) {
+    case bg3_granny_dt_float:
+    case bg3_granny_dt_int8:
+    case bg3_granny_dt_uint8:
+    case bg3_granny_dt_binormal_int8:
+    case bg3_granny_dt_normal_uint8:
+    case bg3_granny_dt_int16:
+    case bg3_granny_dt_uint16:
+    case bg3_granny_dt_binormal_int16:
+    case bg3_granny_dt_normal_uint16:
+    case bg3_granny_dt_int32:
+    case bg3_granny_dt_uint32:
+    case bg3_granny_dt_half:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static granny_compiled_field& granny_numeric_field(granny_compiled_type* type,
+                                                   std::string const& name) {
+  auto it = type->fields_by_name.find(name);
+  if (it == type->fields_by_name.end()) {
+    throw std::runtime_error("No such field: " + name);
+  }
+  granny_compiled_field& field = type->fields[it->second];
+  if (!granny_is_numeric(field.type_info->type)) {
+    throw std::runtime_error("Not a numeric field: " + name);
+  }
+  return field;
+}
+
+// Views one field of every element in place, e.g. the positions of a vertex array. The
+// view is shaped (n, k) for array fields and (n,) otherwise, and has the field's own
+// type, so quantized fields come out as their raw integers.
+py_buffer py_granny_direct_span::view(std::string const& name) {
+  granny_compiled_field& field = granny_numeric_field(type, name);
+  std::string format;
+  granny_python_struct_push_dt(format, field.type_info->type);
+  py_buffer rv{reader,
+               (char*)data + field.offset,
+               ssize_t(field.element_size),
+               std::move(format),
+               {ssize_t(num_elements)},
+               {ssize_t(element_size)},
+               true};
+  if (field.type_info->num_elements) {
+    rv.shape.push_back(field.type_info->num_elements);
+    rv.strides.push_back(field.element_size);
+  }
+  return rv;
+}
+
+// Decodes the named fields (every numeric field by default) into separate contiguous
+// float32 arrays shaped (n, k), with quantized values normalized. The GIL is released
+// while decoding.
+py::dict py_granny_direct_span::decode(std::optional<std::vector<std::string>> names) {
+  if (!names) {
+    names.emplace();
+    for (auto const& field : type->fields) {
+      if (granny_is_numeric(field.type_info->type)) {
+        names->push_back(field.type_info->name);
+      }
+    }
+  }
+  std::vector<granny_compiled_field*> fields;
+  std::vector<py_buffer> buffers;
+  for (auto const& name : *names) {
+    fields.push_back(&granny_numeric_field(type, name));
+    buffers.push_back(py_buffer_alloc<float>(
+        {ssize_t(num_elements), LIBBG3_MAX(1, fields.back()->type_info->num_elements)}));
+  }
+  {
+    py::gil_scoped_release release;
+    for (size_t i = 0; i < fields.size(); ++i) {
+      pybg3_granny_decode_floats(fields[i]->type_info->type,
+                                 (char*)data + fields[i]->offset, element_size,
+                                 buffers[i].shape[1], num_elements,
+                                 (float*)buffers[i].data);
+    }
+  }
+  py::dict rv;
+  for (size_t i = 0; i < fields.size(); ++i) {
+    rv[py::str((*names)[i])] = py::cast(std::move(buffers[i]));
+  }
+  return rv;
 }
 
 py::object py_granny_ptr_span::get_item(size_t index) {
   if (index >= num_elements) {
     throw py::index_error();
   }
-  return py::cast(
-      std::make_unique<py_granny_ptr>(reader, type_info, ((void**)data)[index]));
+  return py::cast(std::make_unique<py_granny_ptr>(reader, type, ((void**)data)[index]));
 }
 
 struct py_granny_reader : public std::enable_shared_from_this<py_granny_reader> {
-  static std::shared_ptr<py_granny_reader> from_path(py::str path) {
-    return std::make_shared<py_granny_reader>(path);
+  static std::shared_ptr<py_granny_reader> from_path(py::str path,
+                                                     int threads,
+                                                     bool lazy) {
+    return std::make_shared<py_granny_reader>(path, threads, lazy);
   }
-  static std::shared_ptr<py_granny_reader> from_data(py::bytes data) {
-    return std::make_shared<py_granny_reader>(data);
+  static std::shared_ptr<py_granny_reader> from_data(py::bytes data,
+                                                     int threads,
+                                                     bool lazy) {
+    return std::make_shared<py_granny_reader>(data, threads, lazy);
   }
-  py_granny_reader(py::str py_path) {
+  py_granny_reader(py::str py_path, int threads, bool lazy) {
     std::string path(py_path);
     bg3_status status = bg3_mapped_file_init_ro(&mapped, path.c_str());
     if (status) {
       throw std::runtime_error("Failed to open gr2 file");
     }
-    status =
-        bg3_granny_reader_init(&reader, mapped.data, mapped.data_len, &pybg3_granny_ops);
+    is_mapped_file = true;
+    if (lazy) {
+      init_arena(mapped.data, mapped.data_len, true, threads);
+      return;
+    }
+    {
+      py::gil_scoped_release release;
+      status = pybg3_granny_reader_init(&reader, mapped.data, mapped.data_len,
+                                        pybg3_thread_count(threads));
+    }
     if (status) {
       bg3_mapped_file_destroy(&mapped);
       throw std::runtime_error("Failed to parse gr2 file");
     }
-    is_mapped_file = true;
   }
-  py_granny_reader(py::bytes data) : data(data) {
+  // bg3_granny_reader would apply its pointer fixups to data in place, so bytes are
+  // loaded into an arena instead, which leaves them immutable and safe to share. The
+  // arena only understands 64-bit little-endian files, so anything else is handed to
+  // bg3_granny_reader on a private copy, unless lazy loading was asked for.
+  py_granny_reader(py::bytes data, int threads, bool lazy) : data(data) {
     std::string_view view(data);
-    // TODO: reader isn't const correct. This one is actually quite bad because the granny
-    // reader will actually modify data to apply its pointer fixups. We need to make it
-    // always copy on write.
-    bg3_status status = bg3_granny_reader_init(&reader, const_cast<char*>(view.data()),
-                                               view.size(), &pybg3_granny_ops);
+    if (lazy || pybg3_granny_is_le64(view.data(), view.size())) {
+      init_arena(view.data(), view.size(), lazy, threads);
+      return;
+    }
+    copy.reset(new char[view.size()]);
+    memcpy(copy.get(), view.data(), view.size());
+    bg3_status status;
+    {
+      py::gil_scoped_release release;
+      status = pybg3_granny_reader_init(&reader, copy.get(), view.size(),
+                                        pybg3_thread_count(threads));
+    }
     if (status) {
       throw std::runtime_error("Failed to parse gr2 file");
     }
   }
   ~py_granny_reader() {
-    bg3_granny_reader_destroy(&reader);
+    if (!arena) {
+      bg3_granny_reader_destroy(&reader);
+    }
     if (is_mapped_file) {
       bg3_mapped_file_destroy(&mapped);
     }
   }
+  void init_arena(char const* file_data, size_t file_len, bool lazy, int threads) {
+    try {
+      arena = std::make_unique<pybg3_granny_arena_reader>(file_data, file_len, lazy);
+      if (!lazy) {
+        py::gil_scoped_release release;
+        arena->load_all(pybg3_thread_count(threads));
+      }
+    } catch (...) {
+      if (is_mapped_file) {
+        bg3_mapped_file_destroy(&mapped);
+      }
+      throw;
+    }
+    is_lazy = lazy;
+  }
+  std::pair<char*, granny_compiled_type*> root_object() {
+    void* root;
+    bg3_granny_type_info* root_type;
+    if (arena) {
+      root = arena->root();
+      root_type = arena->root_type();
+    } else {
+      root = bg3_granny_reader_get_root(&reader);
+      root_type = bg3_granny_reader_get_root_type(&reader);
+    }
+    return {(char*)root, granny_compile_type(*this, root_type)};
+  }
   std::unique_ptr<py_granny_ptr> root() {
-    void* root = bg3_granny_reader_get_root(&reader);
-    bg3_granny_type_info* root_type = bg3_granny_reader_get_root_type(&reader);
+    auto [root, root_type] = root_object();
     return std::make_unique<py_granny_ptr>(shared_from_this(), root_type, root);
   }
+  py::list extract_meshes(int threads);
+  size_t num_loaded_sections() {
+    if (!arena) {
+      throw std::runtime_error("Only arena readers track loaded sections");
+    }
+    return std::count_if(arena->sections.begin(), arena->sections.end(),
+                         [](auto const& section) { return section.loaded; });
+  }
   bool is_mapped_file{false};
   py::bytes data;
+  // The copy of data that reader fixes up, for bytes the arena can't load.
+  std::unique_ptr<char[]> copy;
   bg3_mapped_file mapped;
   bg3_granny_reader reader;
+  std::unique_ptr<pybg3_granny_arena_reader> arena;
+  bool is_lazy{false};
+  std::unordered_map<bg3_granny_type_info*, std::unique_ptr<granny_compiled_type>>
+      compiled_types;
 };
 
+static void granny_ensure_loaded(py_granny_reader& reader, void const* ptr) {
+  if (reader.is_lazy) {
+    reader.arena->ensure_loaded(ptr);
+  }
+}
+
+static granny_compiled_type* granny_compile_type(py_granny_reader& reader,
+                                                 bg3_granny_type_info* type_info) {
+  if (!type_info) {
+    throw std::runtime_error("Missing granny type info");
+  }
+  auto& compiled = reader.compiled_types[type_info];
+  if (compiled) {
+    return compiled.get();
+  }
+  granny_ensure_loaded(reader, type_info);
+  auto type = std::make_unique<granny_compiled_type>();
+  type->type_info = type_info;
+  size_t offset = 0;
+  for (bg3_granny_type_info* ti = type_info; ti->type != bg3_granny_dt_end; ++ti) {
+    granny_ensure_loaded(reader, ti->name);
+    granny_compiled_field field{ti, offset, granny_data_type_size(ti->type), nullptr};
+    if (ti->type == bg3_granny_dt_inline) {
+      field.reference = granny_compile_type(reader, ti->reference_type);
+      field.element_size += field.reference->size;
+    }
+    offset += field.element_size * LIBBG3_MAX(1, ti->num_elements);
+    type->fields_by_name.emplace(ti->name, type->fields.size());
+    type->fields.push_back(field);
+  }
+  type->size = offset;
+  compiled = std::move(type);
+  return compiled.get();
+}
+
+static granny_compiled_type* granny_field_reference(py_granny_reader& reader,
+                                                    granny_compiled_field& field) {
+  if (!field.reference) {
+    field.reference = granny_compile_type(reader, field.type_info->reference_type);
+  }
+  return field.reference;
+}
+
+template <typename T>
+static T granny_read(char const* ptr) {
+  T val;
+  memcpy(&val, ptr, sizeof(T));
+  return val;
+}
+
+static granny_compiled_field* granny_find_field(granny_compiled_type* type,
+                                                char const* name,
+                                                bg3_granny_data_type dt) {
+  auto it = type->fields_by_name.find(name);
+  if (it == type->fields_by_name.end()) {
+    return nullptr;
+  }
+  granny_compiled_field* field = &type->fields[it->second];
+  return field->type_info->type == dt ? field : nullptr;
+}
+
+// The object a reference field of obj points to, or null if there's no such field.
+static std::pair<char*, granny_compiled_type*> granny_follow(py_granny_reader& reader,
+                                                             granny_compiled_type* type,
+                                                             char* obj,
+                                                             char const* name) {
+  granny_compiled_field* field = granny_find_field(type, name, bg3_granny_dt_reference);
+  if (!field) {
+    return {nullptr, nullptr};
+  }
+  char* ref = granny_read<char*>(obj + field->offset);
+  if (!ref) {
+    return {nullptr, nullptr};
+  }
+  granny_ensure_loaded(reader, ref);
+  return {ref, granny_field_reference(reader, *field)};
+}
+
+// The elements of a reference_to_array field of obj, or nothing if there's no such field.
+static std::pair<char*, size_t> granny_array(py_granny_reader& reader,
+                                             granny_compiled_type* type,
+                                             char* obj,
+                                             char const* name) {
+  granny_compiled_field* field =
+      granny_find_field(type, name, bg3_granny_dt_reference_to_array);
+  if (!field) {
+    return {nullptr, 0};
+  }
+  struct LIBBG3_PACK {
+    int32_t num_elements;
+    char* ref;
+  } pack;
+  memcpy(&pack, obj + field->offset, sizeof(pack));
+  char* ref = pack.ref;
+  if (!ref || pack.num_elements <= 0) {
+    return {nullptr, 0};
+  }
+  granny_ensure_loaded(reader, ref);
+  return {ref, size_t(pack.num_elements)};
+}
+
+// A mesh found by extract_meshes, along with the buffers it's decoded into.
+struct granny_mesh_job {
+  char* vertices;
+  size_t num_vertices;
+  size_t vertex_size;
+  granny_compiled_field* position;
+  granny_compiled_field* normal;
+  granny_compiled_field* qtangent;
+  granny_compiled_field* uv;
+  char* indices;
+  size_t num_indices;
+  bool indices16;
+  bool indices_ok;
+  py_buffer positions, normals, uvs, face_vertex_indices, face_vertex_counts;
+};
+
+static void granny_decode_mesh(granny_mesh_job& job) {
+  pybg3_granny_decode_floats(job.position->type_info->type,
+                             job.vertices + job.position->offset, job.vertex_size, 3,
+                             job.num_vertices, (float*)job.positions.data);
+  if (job.normal) {
+    pybg3_granny_decode_floats(job.normal->type_info->type,
+                               job.vertices + job.normal->offset, job.vertex_size, 3,
+                               job.num_vertices, (float*)job.normals.data);
+  } else if (job.qtangent) {
+    // The normal is the tangent frame's X axis, as LSLib decodes QTangents.
+    std::unique_ptr<float[]> q(new float[job.num_vertices * 4]);
+    pybg3_granny_decode_floats(job.qtangent->type_info->type,
+                               job.vertices + job.qtangent->offset, job.vertex_size, 4,
+                               job.num_vertices, q.get());
+    float* normals = (float*)job.normals.data;
+    for (size_t i = 0; i < job.num_vertices; ++i) {
+      float x = q[i * 4], y = q[i * 4 + 1], z = q[i * 4 + 2], w = q[i * 4 + 3];
+      normals[i * 3] = 1.0f - 2.0f * (y * y + z * z);
+      normals[i * 3 + 1] = 2.0f * (x * y + w * z);
+      normals[i * 3 + 2] = 2.0f * (x * z - w * y);
+    }
+  }
+  if (job.uv) {
+    pybg3_granny_decode_floats(job.uv->type_info->type, job.vertices + job.uv->offset,
+                               job.vertex_size, 2, job.num_vertices,
+                               (float*)job.uvs.data);
+  }
+  int32_t* indices = (int32_t*)job.face_vertex_indices.data;
+  uint32_t max_index = 0;
+  for (size_t i = 0; i < job.num_indices; ++i) {
+    uint32_t index = job.indices16 ? granny_read<uint16_t>(job.indices + i * 2)
+                                   : granny_read<uint32_t>(job.indices + i * 4);
+    max_index = std::max(max_index, index);
+    indices[i] = index;
+  }
+  job.indices_ok = !job.num_indices || max_index < job.num_vertices;
+  std::fill_n((int32_t*)job.face_vertex_counts.data, job.num_indices / 3, 3);
+}
+
+// Decodes the geometry of every mesh in the file into the flat arrays UsdGeomMesh takes:
+// float32 positions, normals and UVs, int32 face vertex indices, and face vertex counts
+// (always 3, since granny meshes are triangulated). The structure is walked with the GIL
+// held, then the meshes are decoded on up to `threads` threads without it. Normals and
+// UVs are None for meshes that don't have them. Meshes whose vertices have no positions
+// are skipped rather than failing the whole file: their entries have only a name, with
+// every array None.
+py::list py_granny_reader::extract_meshes(int threads) {
+  auto [root, root_type] = root_object();
+  granny_compiled_field* meshes_field =
+      granny_find_field(root_type, "Meshes", bg3_granny_dt_array_of_references);
+  if (!meshes_field) {
+    throw std::runtime_error("gr2 file has no meshes");
+  }
+  granny_compiled_type* mesh_type = granny_field_reference(*this, *meshes_field);
+  int32_t num_meshes = granny_read<int32_t>(root + meshes_field->offset);
+  char** meshes = granny_read<char**>(root + meshes_field->offset + sizeof(int32_t));
+  granny_ensure_loaded(*this, meshes);
+  std::vector<granny_mesh_job> jobs;
+  py::list rv;
+  for (int32_t i = 0; i < num_meshes; ++i) {
+    char* mesh = meshes[i];
+    granny_ensure_loaded(*this, mesh);
+    granny_compiled_field* name_field =
+        granny_find_field(mesh_type, "Name", bg3_granny_dt_string);
+    char* name = name_field ? granny_read<char*>(mesh + name_field->offset) : nullptr;
+    granny_ensure_loaded(*this, name);
+    auto [vertex_data, vertex_data_type] =
+        granny_follow(*this, mesh_type, mesh, "PrimaryVertexData");
+    auto [topology, topology_type] =
+        granny_follow(*this, mesh_type, mesh, "PrimaryTopology");
+    granny_compiled_field* vertices_field =
+        vertex_data ? granny_find_field(vertex_data_type, "Vertices",
+                                        bg3_granny_dt_reference_to_variant_array)
+                    : nullptr;
+    if (!vertices_field || !topology) {
+      throw std::runtime_error("Mesh has no vertices or topology");
+    }
+    granny_mesh_job job{};
+    auto vertices = granny_read<bg3_granny_variant_array>(vertex_data +
+                                                          vertices_field->offset);
+    if (vertices.num_items > 0) {
+      granny_compiled_type* vertex_type = granny_compile_type(*this, vertices.type);
+      granny_ensure_loaded(*this, vertices.items);
+      job.vertices = (char*)vertices.items;
+      job.num_vertices = vertices.num_items;
+      job.vertex_size = vertex_type->size;
+      auto find_vector = [&](char const* name, int32_t min_elements) {
+        auto it = vertex_type->fields_by_name.find(name);
+        if (it == vertex_type->fields_by_name.end()) {
+          return (granny_compiled_field*)nullptr;
+        }
+        granny_compiled_field* field = &vertex_type->fields[it->second];
+        bool ok = granny_is_numeric(field->type_info->type) &&
+                  field->type_info->num_elements >= min_elements;
+        return ok ? field : nullptr;
+      };
+      job.position = find_vector("Position", 3);
+      job.normal = find_vector("Normal", 3);
+      job.qtangent = job.normal ? nullptr : find_vector("QTangent", 4);
+      job.uv = find_vector("TextureCoordinates0", 2);
+    }
+    py::dict entry;
+    entry["name"] = name ? py::object(py::str(name)) : py::none();
+    if (!job.position) {
+      for (char const* key :
+           {"positions", "normals", "uvs", "face_vertex_indices", "face_vertex_counts"}) {
+        entry[key] = py::none();
+      }
+      rv.append(entry);
+      continue;
+    }
+    std::tie(job.indices, job.num_indices) =
+        granny_array(*this, topology_type, topology, "Indices16");
+    job.indices16 = job.num_indices;
+    if (!job.indices16) {
+      std::tie(job.indices, job.num_indices) =
+          granny_array(*this, topology_type, topology, "Indices");
+    }
+    ssize_t num_vertices = job.num_vertices;
+    job.positions = py_buffer_alloc<float>({num_vertices, 3});
+    job.face_vertex_indices = py_buffer_alloc<int32_t>({ssize_t(job.num_indices)});
+    job.face_vertex_counts = py_buffer_alloc<int32_t>({ssize_t(job.num_indices / 3)});
+    entry["positions"] = py::cast(job.positions);
+    entry["normals"] = py::none();
+    if (job.normal || job.qtangent) {
+      job.normals = py_buffer_alloc<float>({num_vertices, 3});
+      entry["normals"] = py::cast(job.normals);
+    }
+    entry["uvs"] = py::none();
+    if (job.uv) {
+      job.uvs = py_buffer_alloc<float>({num_vertices, 2});
+      entry["uvs"] = py::cast(job.uvs);
+    }
+    entry["face_vertex_indices"] = py::cast(job.face_vertex_indices);
+    entry["face_vertex_counts"] = py::cast(job.face_vertex_counts);
+    rv.append(entry);
+    jobs.push_back(std::move(job));
+  }
+  {
+    py::gil_scoped_release release;
+    pybg3_parallel_for(jobs.size(), pybg3_thread_count(threads),
+                       [&](size_t i) { granny_decode_mesh(jobs[i]); });
+  }
+  for (auto const& job : jobs) {
+    if (!job.indices_ok) {
+      throw std::runtime_error("Mesh has out of range vertex indices");
+    }
+    if (job.num_indices % 3) {
+      throw std::runtime_error("Mesh index count isn't a whole number of triangles");
+    }
+  }
+  return rv;
+}
+
 struct py_patch_file;
 
 struct py_patch_layer {
@@ -1077,16 +2794,77 @@ PYBIND11_MODULE(_pybg3, m) {
   m.def("osiris_compile_path", &osiris_compile_path, "Compile an osiris save");
   m.def("osiris_decompile_path", &osiris_decompile_path, "Decompile an osiris save");
   m.def("log", &pybg3_log, "Log a message");
-  py::class_<py_lspk_file>(m, "_LspkFile")
-      .def(py::init<const std::string&>())
+  m.def("bitknit2_compress", &bitknit2_compress, "Compress data with BitKnit2",
+        py::arg("data"), py::arg("level") = rans::bitknit2_encoder::default_level);
+  m.def("bitknit2_decompress", &bitknit2_decompress, "Decompress BitKnit2 data",
+        py::arg("data"), py::arg("uncompressed_size"));
+  m.def("blob_cache_configure", &blob_cache_configure,
+        "Set the size of the shared cache of extracted pak files, 0 to disable it",
+        py::arg("max_bytes"));
+  m.def("blob_cache_clear", &blob_cache_clear, "Empty the shared pak file cache");
+  m.def("blob_cache_stats", &blob_cache_stats, "Get the shared pak file cache counters");
+  py::class_<py_buffer>(m, "_Buffer", py::buffer_protocol())
+      .def_buffer(&py_buffer::as_buffer);
+  py::class_<py_lspk_file, std::shared_ptr<py_lspk_file>>(m, "_LspkFile")
+      .def(py::init<const std::string&, std::optional<std::string>>(), py::arg("path"),
+           py::arg("index_path") = py::none())
       .def("attach_part", &py_lspk_file::attach_part)
+      .def("attach_parts", &py_lspk_file::attach_parts)
       .def("file_name", &py_lspk_file::file_name)
       .def("file_size", &py_lspk_file::file_size)
       .def("file_data", &py_lspk_file::file_data)
+      .def("file_view", &py_lspk_file::file_view)
+      .def("prefetch", &py_lspk_file::prefetch, py::arg("indices"))
+      .def("set_sequential", &py_lspk_file::set_sequential, py::arg("sequential"))
+      .def("extract_to", &py_lspk_file::extract_to, py::arg("index"), py::arg("target"))
+      .def("unpack", &py_lspk_file::unpack, py::arg("directory"), py::arg("threads") = 0)
       .def("file_part", &py_lspk_file::file_part)
       .def("num_parts", &py_lspk_file::num_parts)
       .def("num_files", &py_lspk_file::num_files)
-      .def("priority", &py_lspk_file::priority);
+      .def("priority", &py_lspk_file::priority)
+      .def("find", &py_lspk_file::find)
+      .def("glob", &py_lspk_file::glob)
+      .def("list_prefix", &py_lspk_file::list_prefix)
+      .def("file_names", &py_lspk_file::file_names)
+      .def("extract_many", &py_lspk_file::extract_many, py::arg("indices"),
+           py::arg("threads") = 1, py::arg("ordered") = true);
+  py::class_<py_lspk_writer>(m, "_LspkWriter")
+      .def(py::init<>())
+      .def("add_data", &py_lspk_writer::add_data, py::arg("name"), py::arg("data"))
+      .def("add_file", &py_lspk_writer::add_file, py::arg("name"), py::arg("path"))
+      .def("num_files", &py_lspk_writer::num_files)
+      .def("reuse_from", &py_lspk_writer::reuse_from, py::arg("pak"))
+      .def("write", &py_lspk_writer::write, py::arg("path"),
+           py::arg("method") = LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4, py::arg("level") = 0,
+           py::arg("threads") = 0, py::arg("part_size") = 0, py::arg("priority") = 0);
+  py::class_<py_pak_set>(m, "_PakSet")
+      .def(py::init<>())
+      .def("mount", &py_pak_set::mount, py::arg("path"),
+           py::arg("index_path") = py::none())
+      .def("add", &py_pak_set::add)
+      .def("find", &py_pak_set::find)
+      .def("file_data", &py_pak_set::file_data)
+      .def("file_view", &py_pak_set::file_view)
+      .def("file_size", &py_pak_set::file_size)
+      .def("file_names", &py_pak_set::file_names)
+      .def("num_paks", &py_pak_set::num_paks)
+      .def("pak", &py_pak_set::pak)
+      .def("extract_many", &py_pak_set::extract_many, py::arg("names"),
+           py::arg("threads") = 1, py::arg("ordered") = true);
+  py::class_<py_object_index_builder>(m, "_ObjectIndexBuilder")
+      .def(py::init<std::vector<int>>(), py::arg("priorities"))
+      .def("add", &py_object_index_builder::add, py::arg("table"), py::arg("pak"),
+           py::arg("entry"), py::arg("objects"))
+      .def("__len__", &py_object_index_builder::size)
+      .def("write", &py_object_index_builder::write, py::arg("path"), py::arg("paks"));
+  py::class_<py_object_index>(m, "_ObjectIndex")
+      .def_static("open", &py_object_index::open, py::arg("path"), py::arg("paks"))
+      .def("find", &py_object_index::find, py::arg("table"), py::arg("key"))
+      .def("__len__", &py_object_index::size)
+      .def("tables", &py_object_index::tables);
+  py::class_<py_lspk_extract_iter>(
+      m, "_LspkExtractIter", py::custom_type_setup(&py_lspk_extract_iter::type_setup))
+      .def("__next__", &py_lspk_extract_iter::next);
   py::class_<py_lsof_file>(m, "_LsofFile")
       .def_static("from_path", &py_lsof_file::from_path)
       .def_static("from_data", &py_lsof_file::from_data)
@@ -1096,8 +2874,13 @@ PYBIND11_MODULE(_pybg3, m) {
       .def("num_attrs", &py_lsof_file::num_attrs)
       .def("node", &py_lsof_file::node)
       .def("attr", &py_lsof_file::attr)
+      .def("attrs", &py_lsof_file::attrs)
+      .def("to_tree", &py_lsof_file::to_tree)
+      .def("tables", &py_lsof_file::tables)
       .def("stats", &py_lsof_file::stats)
       .def("scan_unique_objects", &py_lsof_file::scan_unique_objects)
+      .def("index_objects", &py_lsof_file::index_objects, py::arg("keys"),
+           py::arg("node_idx") = 0, py::arg("end") = -1)
       .def("to_sexp", &py_lsof_file::to_sexp);
   py::class_<py_loca_file>(m, "_LocaFile")
       .def_static("from_path", &py_loca_file::from_path)
@@ -1108,9 +2891,14 @@ PYBIND11_MODULE(_pybg3, m) {
       .def(py::init<const std::string&>())
       .def("query", &py_index_reader::query);
   py::class_<py_granny_reader, std::shared_ptr<py_granny_reader>>(m, "_GrannyReader")
-      .def_static("from_path", &py_granny_reader::from_path)
-      .def_static("from_data", &py_granny_reader::from_data)
-      .def_property_readonly("root", &py_granny_reader::root);
+      .def_static("from_path", &py_granny_reader::from_path, py::arg("path"),
+                  py::arg("threads") = 1, py::arg("lazy") = false)
+      .def_static("from_data", &py_granny_reader::from_data, py::arg("data"),
+                  py::arg("threads") = 1, py::arg("lazy") = false)
+      .def_property_readonly("root", &py_granny_reader::root)
+      .def("extract_meshes", &py_granny_reader::extract_meshes, py::arg("threads") = 1)
+      .def_property_readonly("num_loaded_sections",
+                             &py_granny_reader::num_loaded_sections);
   py::class_<py_granny_ptr>(m, "_GrannyPtr")
       .def("__getattr__", &py_granny_ptr::getattr, py::is_operator())
       .def("__dir__", &py_granny_ptr::dir, py::is_operator());
@@ -1119,7 +2907,9 @@ PYBIND11_MODULE(_pybg3, m) {
       py::buffer_protocol())
       .def_buffer(&py_granny_direct_span::as_buffer)
       .def("__getitem__", &py_granny_direct_span::get_item)
-      .def("__len__", &py_granny_direct_span::len);
+      .def("__len__", &py_granny_direct_span::len)
+      .def("view", &py_granny_direct_span::view, py::arg("name"))
+      .def("decode", &py_granny_direct_span::decode, py::arg("names") = py::none());
   py::class_<py_granny_ptr_span>(m, "_GrannyPtrSpan",
                                  py::custom_type_setup(&py_granny_ptr_span::type_setup))
       .def("__getitem__", &py_granny_ptr_span::get_item)
@@ -116,65 +116,7 @@ class Node:
 
     @staticmethod
     def parse_node(file, node_idx):
-        wide = file.is_wide()
-        num_nodes = file.num_nodes()
-        num_attrs = file.num_attrs()
-        idx_stack = []
-        node_stack = []
-        is_root = True
-        while node_idx < num_nodes:
-            name, parent, next, attr_index = file.node(node_idx)
-            while not is_root and parent != idx_stack[-1]:
-                idx_stack.pop()
-                child = node_stack.pop()
-                if len(node_stack) == 0:
-                    return (child, node_idx)
-                node_stack[-1].children.append(child)
-            idx_stack.append(node_idx)
-            node = Node(name, {}, [])
-            node_stack.append(node)
-            is_root = False
-            while attr_index != -1 and attr_index < num_attrs:
-                a_name, a_type, a_next, a_owner, a_value = file.attr(attr_index)
-                val = None
-                if not wide and a_owner != node_idx:
-                    break
-                match a_type:
-                    case DataType.BOOL:
-                        val = a_value
-                    case DataType.UINT8:
-                        val = U8(a_value)
-                    case DataType.INT32:
-                        val = I32(a_value)
-                    case DataType.LSSTRING:
-                        val = LSString(a_value)
-                    case DataType.FIXEDSTRING:
-                        val = a_value
-                    case DataType.FLOAT:
-                        val = F32(a_value)
-                    case DataType.VEC2:
-                        val = Vec2(*a_value)
-                    case DataType.VEC3:
-                        val = Vec3(*a_value)
-                    case DataType.VEC4:
-                        val = Vec4(*a_value)
-                    case DataType.IVEC2:
-                        val = IVec2(*a_value)
-                    case DataType.IVEC3:
-                        val = IVec3(*a_value)
-                    case DataType.IVEC4:
-                        val = IVec4(*a_value)
-                node.attrs[a_name] = val
-                if wide:
-                    attr_index = a_next
-                else:
-                    attr_index += 1
-            node_idx += 1
-        while len(node_stack) > 1:
-            idx_stack.pop()
-            child = node_stack.pop()
-            node_stack[-1].children.append(child)
-        return (node_stack[0], node_idx)
+        return file.to_tree(node_idx, _TREE_TYPES)
 
     @staticmethod
     def parse_file(file):
@@ -203,6 +145,10 @@ class Node:
         return f"Node({self.name}, {self.attrs}, {self.children})"
 
 
+# The classes _LsofFile.to_tree builds trees out of, in the order it expects them.
+_TREE_TYPES = (Node, U8, I32, LSString, F32, Vec2, Vec3, Vec4, IVec2, IVec3, IVec4)
+
+
 class NodeFactory:
     def __getattr__(self, name):
         def wrapper(**kwargs):
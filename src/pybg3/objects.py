@@ -0,0 +1,127 @@
+# pybg3
+#
+# Copyright (C) 2024 Mackenzie Straight.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the “Software”), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+
+import re
+from pathlib import Path
+from typing import Iterable
+from . import _pybg3, lsf
+from .pak import PakFile, PakSet
+
+_ROOT_TEMPLATES_RE = re.compile(r"Public/[^/]+/RootTemplates/_merged\.lsf")
+
+
+def _is_asset_banks(name: str) -> bool:
+    return "[PAK]" in name and name.endswith(".lsf")
+
+
+# Adds the objects of each bank in an asset banks file, such as a VisualBank node, by
+# "<type>/ID" and "<type>/Name", where type is the bank's name without "Bank".
+def _add_asset_banks(builder, pak_idx, entry, file):
+    file.ensure_sibling_pointers()
+    num_nodes = file.num_nodes()
+    node_idx = 0 if num_nodes else -1
+    while node_idx != -1:
+        name, _, next, _ = file.node(node_idx)
+        if node_idx + 1 < num_nodes and file.node(node_idx + 1)[1] == node_idx:
+            asset_type = name.replace("Bank", "")
+            by_uuid, by_name = file.index_objects(["ID", "Name"], node_idx + 1)
+            builder.add(f"{asset_type}/ID", pak_idx, entry, by_uuid)
+            builder.add(f"{asset_type}/Name", pak_idx, entry, by_name)
+        node_idx = next
+
+
+def _add_root_templates(builder, pak_idx, entry, file):
+    by_uuid, by_name = file.index_objects(["MapKey", "Name"], 1)
+    builder.add("RootTemplate/MapKey", pak_idx, entry, by_uuid)
+    builder.add("RootTemplate/Name", pak_idx, entry, by_name)
+
+
+# An index of the root templates and asset bank objects in a list of paks, by uuid and
+# by name. It's saved at `path` the first time and mapped from there for as long as the
+# paks have the same paths, sizes and modification times, so the LSF files are only
+# scanned again when a pak changes. Where paks have the same key, the one with the
+# highest header priority wins, and among equal priorities the later one, as in a
+# PakSet.
+#
+# Tables are named "<type>/<key>": "RootTemplate/MapKey" and "RootTemplate/Name" for
+# root templates, and e.g. "Visual/ID" and "Visual/Name" for the objects in VisualBanks.
+class ObjectIndex:
+    def __init__(self, path: Path, paks: Iterable[PakFile] | PakSet):
+        self._paks = paks.paks() if isinstance(paks, PakSet) else list(paks)
+        self._files = {}
+        lspks = [pak._lspk for pak in self._paks]
+        self._index = _pybg3._ObjectIndex.open(str(path), lspks)
+        if self._index is None:
+            self._build(path, lspks)
+            self._index = _pybg3._ObjectIndex.open(str(path), lspks)
+            if self._index is None:
+                raise RuntimeError(f"paks changed while indexing them into {path}")
+
+    @staticmethod
+    def _build(path: Path, lspks: list[_pybg3._LspkFile]):
+        builder = _pybg3._ObjectIndexBuilder([lspk.priority() for lspk in lspks])
+        for pak_idx, lspk in enumerate(lspks):
+            adders = {}
+            for entry, name in enumerate(lspk.file_names()):
+                if _is_asset_banks(name):
+                    adders[entry] = _add_asset_banks
+                elif _ROOT_TEMPLATES_RE.fullmatch(name):
+                    adders[entry] = _add_root_templates
+            for entry, data in lspk.extract_many(list(adders), threads=0):
+                adders[entry](builder, pak_idx, entry, lsf.loads(data))
+        builder.write(str(path), lspks)
+
+    # Returns the pak, the name of the LSF file in it and the node index, or None.
+    def find(self, table: str, key: str) -> tuple[PakFile, str, int] | None:
+        found = self._index.find(table, key)
+        if found is None:
+            return None
+        pak_idx, entry, node_idx = found
+        pak = self._paks[pak_idx]
+        return pak, pak._lspk.file_name(entry), node_idx
+
+    # Like find, but returns the LSF file itself. Each file is only loaded once.
+    def lookup(self, table: str, key: str) -> tuple[_pybg3._LsofFile, int] | None:
+        found = self._index.find(table, key)
+        if found is None:
+            return None
+        pak_idx, entry, node_idx = found
+        file = self._files.get((pak_idx, entry))
+        if file is None:
+            file = lsf.loads(self._paks[pak_idx]._lspk.file_data(entry))
+            self._files[(pak_idx, entry)] = file
+        return file, node_idx
+
+    def node(self, table: str, key: str) -> lsf.Node | None:
+        found = self.lookup(table, key)
+        if found is None:
+            return None
+        node, _ = lsf.Node.parse_node(*found)
+        return node
+
+    # The number of keys in each table.
+    def tables(self) -> dict[str, int]:
+        return self._index.tables()
+
+    def __len__(self) -> int:
+        return len(self._index)
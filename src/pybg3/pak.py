@@ -20,34 +20,194 @@
 # OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 # SOFTWARE.
 
-from typing import Iterable
+import os
+from typing import Iterable, Iterator
 from pathlib import Path
 from . import _pybg3
 
 
+# Compression methods for pak entries.
+COMPRESSION_NONE = 0
+COMPRESSION_ZLIB = 1
+COMPRESSION_LZ4 = 2
+
+
+# Extracted files can be kept in a cache shared by every open pak, bounded to
+# `max_bytes` and evicting the least recently used first. 0 turns it off, which is
+# the default. Views of cached files share the cached copy.
+def configure_cache(max_bytes: int):
+    _pybg3.blob_cache_configure(max_bytes)
+
+
+def clear_cache():
+    _pybg3.blob_cache_clear()
+
+
+# hits, misses, evictions, entries, bytes and capacity.
+def cache_stats() -> dict[str, int]:
+    return _pybg3.blob_cache_stats()
+
+
 class PakFile:
     _lspk: _pybg3._LspkFile
-    _index: dict[str, int]
-
-    def __init__(self, path: Path):
-        self._lspk = _pybg3._LspkFile(str(path))
-        self._index = {}
-        for i in range(self._lspk.num_files()):
-            self._index[self._lspk.file_name(i)] = i
-        num_parts = self._lspk.num_parts()
-        if num_parts > 1:
-            for i in range(1, num_parts):
-                part_path = path.with_name(f"{path.stem}_{i}{path.suffix}")
-                self._lspk.attach_part(i, str(part_path))
+
+    # If `index_path` is given, the name index is cached there so that reopening an
+    # unchanged pak doesn't have to rebuild it.
+    def __init__(self, path: Path, index_path: Path | None = None):
+        self._lspk = _pybg3._LspkFile(
+            str(path), str(index_path) if index_path is not None else None
+        )
+        self._lspk.attach_parts(str(path))
+
+    # Wraps a pak that's already open natively, such as one mounted in a PakSet.
+    @classmethod
+    def _from_lspk(cls, lspk: _pybg3._LspkFile) -> "PakFile":
+        pak = cls.__new__(cls)
+        pak._lspk = lspk
+        return pak
+
+    def _index(self, name: str) -> int:
+        index = self._lspk.find(name)
+        if index is None:
+            raise KeyError(name)
+        return index
 
     def files(self) -> Iterable[str]:
-        return self._index.keys()
+        return self._lspk.file_names()
+
+    def __contains__(self, name: str) -> bool:
+        return self._lspk.find(name) is not None
+
+    # Names matching a shell-style pattern, in sorted order. As with fnmatch, "*"
+    # matches across directories.
+    def glob(self, pattern: str) -> list[str]:
+        return [self._lspk.file_name(i) for i in self._lspk.glob(pattern)]
+
+    # Names starting with `prefix`, in sorted order.
+    def list_prefix(self, prefix: str) -> list[str]:
+        return [self._lspk.file_name(i) for i in self._lspk.list_prefix(prefix)]
 
     def file_data(self, name: str) -> bytes:
-        return self._lspk.file_data(self._index[name])
+        return self._lspk.file_data(self._index(name))
+
+    # A read-only buffer with the file's contents. Uncompressed files are viewed in
+    # place in the mapped pak rather than copied.
+    def file_view(self, name: str) -> memoryview:
+        return memoryview(self._lspk.file_view(self._index(name)))
 
     def file_part(self, name: str) -> int:
-        return self._lspk.file_part(self._index[name])
+        return self._lspk.file_part(self._index(name))
+
+    def file_size(self, name: str) -> int:
+        return self._lspk.file_size(self._index(name))
+
+    # Starts reading the files in the background ahead of extracting them, which avoids
+    # stalling on page faults when the pak isn't cached. extract_many does this itself.
+    def prefetch(self, names: Iterable[str]):
+        self._lspk.prefetch([self._index(name) for name in names])
+
+    # Tunes readahead for reading the whole pak in order, as unpack does.
+    def set_sequential(self, sequential: bool):
+        self._lspk.set_sequential(sequential)
+
+    # Streams the file to `target`, a path or an open file descriptor, without holding
+    # it all in memory. Returns the number of bytes written.
+    def extract_to(self, name: str, target: int | str | os.PathLike[str]) -> int:
+        return self._lspk.extract_to(self._index(name), target)
+
+    # Extracts every file in the pak under `directory` on up to `threads` threads (0 for
+    # one per CPU).
+    def unpack(self, directory: Path, threads: int = 0):
+        self._lspk.unpack(str(directory), threads)
+
+    # Extracts files on up to `threads` threads (0 for one per CPU), yielding (name,
+    # data) pairs in the order given or, if not `ordered`, as they finish.
+    def extract_many(
+        self, names: Iterable[str], threads: int = 1, ordered: bool = True
+    ) -> Iterator[tuple[str, bytes]]:
+        names_by_index = {self._index(name): name for name in names}
+        for index, data in self._lspk.extract_many(
+            list(names_by_index.keys()), threads, ordered
+        ):
+            yield names_by_index[index], data
+
+
+# Several paks seen as one tree of files. When more than one pak has a file, the one
+# with the highest header priority wins, and among equal priorities the one mounted
+# last.
+class PakSet:
+    _set: _pybg3._PakSet
+
+    def __init__(self, paths: Iterable[Path] = ()):
+        self._set = _pybg3._PakSet()
+        for path in paths:
+            self.mount(path)
+
+    # Opens the pak at `path`, along with its part files, and mounts it.
+    def mount(self, path: Path, index_path: Path | None = None):
+        self._set.mount(str(path), str(index_path) if index_path is not None else None)
+
+    # Mounts an already open pak.
+    def add(self, pak: PakFile):
+        self._set.add(pak._lspk)
+
+    # The mounted paks, in the order they were mounted.
+    def paks(self) -> list[PakFile]:
+        return [PakFile._from_lspk(self._set.pak(i)) for i in range(self._set.num_paks())]
+
+    def files(self) -> Iterable[str]:
+        return self._set.file_names()
+
+    def __contains__(self, name: str) -> bool:
+        return self._set.find(name) is not None
+
+    def file_data(self, name: str) -> bytes:
+        return self._set.file_data(name)
+
+    def file_view(self, name: str) -> memoryview:
+        return memoryview(self._set.file_view(name))
 
     def file_size(self, name: str) -> int:
-        return self._lspk.file_size(self._index[name])
+        return self._set.file_size(name)
+
+    def extract_many(
+        self, names: Iterable[str], threads: int = 1, ordered: bool = True
+    ) -> Iterator[tuple[str, bytes]]:
+        return self._set.extract_many(list(names), threads, ordered)
+
+
+# Builds a new pak from data in memory and files on disk. Nothing is compressed or read
+# until `write`, which compresses on up to `threads` threads (0 for one per CPU) and
+# streams the result to disk.
+class PakWriter:
+    _writer: _pybg3._LspkWriter
+
+    def __init__(self):
+        self._writer = _pybg3._LspkWriter()
+
+    def add(self, name: str, data: bytes):
+        self._writer.add_data(name, data)
+
+    def add_file(self, name: str, path: Path):
+        self._writer.add_file(name, str(path))
+
+    # Files that are unchanged from their version in `pak` are copied from it as they
+    # are rather than compressed again. `pak` may be the pak being rewritten.
+    def reuse_from(self, pak: PakFile):
+        self._writer.reuse_from(pak._lspk)
+
+    # `level` is 1-9 for zlib, and for LZ4, 0 for the fast compressor or 1-12 for LZ4HC.
+    # With a `part_size`, data past that many bytes goes to <stem>_<n> part files.
+    # Returns how many files were compressed and how many reused.
+    def write(
+        self,
+        path: Path,
+        compression: int = COMPRESSION_LZ4,
+        level: int = 0,
+        threads: int = 0,
+        part_size: int = 0,
+        priority: int = 0,
+    ) -> dict[str, int]:
+        return self._writer.write(
+            str(path), compression, level, threads, part_size, priority
+        )
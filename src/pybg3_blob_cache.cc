@@ -0,0 +1,86 @@
+#include "pybg3_blob_cache.h"
+
+pybg3_blob_cache& pybg3_blob_cache::shared() {
+  static pybg3_blob_cache cache;
+  return cache;
+}
+
+uint64_t pybg3_blob_cache::new_source() {
+  static std::atomic<uint64_t> next_source{1};
+  return next_source.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool pybg3_blob_cache::enabled() const {
+  return capacity.load(std::memory_order_relaxed) != 0;
+}
+
+std::optional<pybg3_blob> pybg3_blob_cache::get(key k) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = nodes.find(k);
+  if (it == nodes.end()) {
+    misses++;
+    return std::nullopt;
+  }
+  hits++;
+  lru.splice(lru.begin(), lru, it->second);
+  return it->second->blob;
+}
+
+void pybg3_blob_cache::put(key k, pybg3_blob blob) {
+  std::lock_guard<std::mutex> lock(mutex);
+  size_t limit = capacity.load(std::memory_order_relaxed);
+  if (blob.size > limit) {
+    return;
+  }
+  auto it = nodes.find(k);
+  if (it != nodes.end()) {
+    // Another thread got here first with the same contents.
+    lru.splice(lru.begin(), lru, it->second);
+    return;
+  }
+  evict_to(limit - blob.size);
+  total_bytes += blob.size;
+  lru.push_front({k, std::move(blob)});
+  nodes.emplace(k, lru.begin());
+}
+
+void pybg3_blob_cache::drop_source(uint64_t source) {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto it = lru.begin(); it != lru.end();) {
+    if (it->k.source == source) {
+      total_bytes -= it->blob.size;
+      nodes.erase(it->k);
+      it = lru.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void pybg3_blob_cache::set_capacity(size_t limit) {
+  std::lock_guard<std::mutex> lock(mutex);
+  capacity.store(limit, std::memory_order_relaxed);
+  evict_to(limit);
+}
+
+void pybg3_blob_cache::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  lru.clear();
+  nodes.clear();
+  total_bytes = 0;
+}
+
+pybg3_blob_cache::stats pybg3_blob_cache::get_stats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return {hits, misses, evictions, nodes.size(), total_bytes, capacity.load()};
+}
+
+void pybg3_blob_cache::evict_to(size_t bytes) {
+  while (total_bytes > bytes) {
+    node& victim = lru.back();
+    total_bytes -= victim.blob.size;
+    nodes.erase(victim.k);
+    lru.pop_back();
+    evictions++;
+  }
+}
@@ -0,0 +1,93 @@
+// pybg3
+//
+// Copyright (C) 2024 Mackenzie Straight.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+// Decompressed contents held by the cache. Blobs are immutable once they're cached, and
+// stay valid for as long as someone holds them, even after they've been evicted.
+struct pybg3_blob {
+  std::shared_ptr<char const[]> data;
+  size_t size;
+};
+
+// A thread-safe LRU cache of decompressed pak entries, bounded by the total size of the
+// blobs it holds. Entries are keyed by a source, which identifies an open pak, and the
+// entry's index in that pak. A cache with a capacity of 0 holds nothing.
+struct pybg3_blob_cache {
+  struct key {
+    uint64_t source;
+    uint64_t entry;
+    bool operator==(key const&) const = default;
+  };
+  struct stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t entries;
+    size_t bytes;
+    size_t capacity;
+  };
+  explicit pybg3_blob_cache(size_t limit = 0) : capacity(limit) {}
+  // The cache shared by every pak in the process. It starts out disabled.
+  static pybg3_blob_cache& shared();
+  // A new source id, which is never reused.
+  static uint64_t new_source();
+  bool enabled() const;
+  std::optional<pybg3_blob> get(key k);
+  // Blobs bigger than the whole cache aren't cached.
+  void put(key k, pybg3_blob blob);
+  // Drops everything cached for a source, such as a pak that's being closed.
+  void drop_source(uint64_t source);
+  // Evicts down to the new capacity if it's smaller.
+  void set_capacity(size_t limit);
+  void clear();
+  stats get_stats();
+
+ private:
+  struct key_hash {
+    size_t operator()(key const& k) const {
+      return std::hash<uint64_t>()(k.source * 0x9e3779b97f4a7c15ull ^ k.entry);
+    }
+  };
+  struct node {
+    key k;
+    pybg3_blob blob;
+  };
+  void evict_to(size_t bytes);
+  std::mutex mutex;
+  // Most recently used first.
+  std::list<node> lru;
+  std::unordered_map<key, std::list<node>::iterator, key_hash> nodes;
+  // Also read without the lock, by enabled().
+  std::atomic<size_t> capacity;
+  size_t total_bytes{0};
+  uint64_t hits{0}, misses{0}, evictions{0};
+};
@@ -0,0 +1,136 @@
+// pybg3
+//
+// Copyright (C) 2024 Mackenzie Straight.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "pybg3_blob_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+static pybg3_blob make_blob(size_t size, char fill) {
+  std::shared_ptr<char[]> data(new char[size]);
+  memset(data.get(), fill, size);
+  return {std::move(data), size};
+}
+
+TEST(PyBg3BlobCache, Disabled) {
+  pybg3_blob_cache cache;
+  EXPECT_FALSE(cache.enabled());
+  cache.put({1, 0}, make_blob(16, 'a'));
+  EXPECT_FALSE(cache.get({1, 0}));
+  EXPECT_EQ(cache.get_stats().entries, 0u);
+}
+
+TEST(PyBg3BlobCache, HitsAndMisses) {
+  pybg3_blob_cache cache(1024);
+  EXPECT_TRUE(cache.enabled());
+  EXPECT_FALSE(cache.get({1, 0}));
+  pybg3_blob blob = make_blob(100, 'a');
+  cache.put({1, 0}, blob);
+  std::optional<pybg3_blob> hit = cache.get({1, 0});
+  ASSERT_TRUE(hit);
+  EXPECT_EQ(hit->data, blob.data);
+  EXPECT_EQ(hit->size, 100u);
+  EXPECT_FALSE(cache.get({2, 0}));
+  EXPECT_FALSE(cache.get({1, 1}));
+  pybg3_blob_cache::stats stats = cache.get_stats();
+  EXPECT_EQ(stats.hits, 1u);
+  EXPECT_EQ(stats.misses, 3u);
+  EXPECT_EQ(stats.evictions, 0u);
+  EXPECT_EQ(stats.entries, 1u);
+  EXPECT_EQ(stats.bytes, 100u);
+  EXPECT_EQ(stats.capacity, 1024u);
+}
+
+TEST(PyBg3BlobCache, EvictsLeastRecentlyUsed) {
+  pybg3_blob_cache cache(300);
+  cache.put({1, 0}, make_blob(100, 'a'));
+  cache.put({1, 1}, make_blob(100, 'b'));
+  cache.put({1, 2}, make_blob(100, 'c'));
+  EXPECT_TRUE(cache.get({1, 0}));
+  cache.put({1, 3}, make_blob(150, 'd'));
+  EXPECT_TRUE(cache.get({1, 0}));
+  EXPECT_FALSE(cache.get({1, 1}));
+  EXPECT_FALSE(cache.get({1, 2}));
+  EXPECT_TRUE(cache.get({1, 3}));
+  pybg3_blob_cache::stats stats = cache.get_stats();
+  EXPECT_EQ(stats.evictions, 2u);
+  EXPECT_EQ(stats.bytes, 250u);
+  cache.put({1, 4}, make_blob(301, 'e'));
+  EXPECT_FALSE(cache.get({1, 4}));
+  EXPECT_EQ(cache.get_stats().bytes, 250u);
+  cache.set_capacity(200);
+  EXPECT_EQ(cache.get_stats().entries, 1u);
+  EXPECT_TRUE(cache.get({1, 3}));
+}
+
+TEST(PyBg3BlobCache, EvictedBlobsStayValid) {
+  pybg3_blob_cache cache(100);
+  cache.put({1, 0}, make_blob(100, 'a'));
+  std::optional<pybg3_blob> held = cache.get({1, 0});
+  cache.put({1, 1}, make_blob(100, 'b'));
+  EXPECT_FALSE(cache.get({1, 0}));
+  ASSERT_TRUE(held);
+  EXPECT_EQ(held->data[99], 'a');
+}
+
+TEST(PyBg3BlobCache, DropSourceAndClear) {
+  pybg3_blob_cache cache(1000);
+  cache.put({1, 0}, make_blob(10, 'a'));
+  cache.put({2, 0}, make_blob(20, 'b'));
+  cache.put({1, 1}, make_blob(30, 'c'));
+  cache.drop_source(1);
+  EXPECT_FALSE(cache.get({1, 0}));
+  EXPECT_FALSE(cache.get({1, 1}));
+  EXPECT_TRUE(cache.get({2, 0}));
+  EXPECT_EQ(cache.get_stats().bytes, 20u);
+  cache.clear();
+  EXPECT_FALSE(cache.get({2, 0}));
+  EXPECT_EQ(cache.get_stats().bytes, 0u);
+  EXPECT_NE(pybg3_blob_cache::new_source(), pybg3_blob_cache::new_source());
+}
+
+TEST(PyBg3BlobCache, Threads) {
+  pybg3_blob_cache cache(64 * 100);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&cache, t] {
+      for (int i = 0; i < 10000; ++i) {
+        pybg3_blob_cache::key k{1, uint64_t((i * 7 + t) % 200)};
+        if (std::optional<pybg3_blob> hit = cache.get(k)) {
+          ASSERT_EQ(hit->data[0], char(k.entry));
+        } else {
+          cache.put(k, make_blob(64, char(k.entry)));
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  pybg3_blob_cache::stats stats = cache.get_stats();
+  EXPECT_EQ(stats.hits + stats.misses, 80000u);
+  EXPECT_LE(stats.bytes, 64u * 100);
+  EXPECT_EQ(stats.bytes, stats.entries * 64);
+}
@@ -1,10 +1,60 @@
 #include "pybg3_granny.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "pybg3_parallel.h"
 #include "rans.h"
 
-// TODO: the current rANS decoder does not support an incremental API, but neither does
-// libbg3 actually use the incremental api incrementally, we just want ABI compatibility
-// with the real granny functions. For now we just blind assume the entire data is in
-// one decompress call.
+// The decoder accepts compressed data in arbitrary chunks, which is how the granny ops
+// hand them over. Each decompress call decodes as far as its input allows, and the last
+// few words of the section, which can only be decoded once no more input is coming, are
+// left for end_file_decompression to finish on the same state.
+struct pybg3_granny_decompressor {
+  pybg3_granny_decompressor(uint8_t* dst, size_t dst_len)
+      : dst(dst), dst_len(dst_len), state(dst, dst_len) {}
+  uint8_t* dst;
+  size_t dst_len;
+  bool prefetched{false};
+  rans::bitknit2_state state;
+};
+
+static thread_local std::vector<pybg3_granny_prefetched_section> const*
+    pybg3_granny_active_prefetch;
+
+pybg3_granny_prefetch_scope::pybg3_granny_prefetch_scope(
+    std::vector<pybg3_granny_prefetched_section> const& sections)
+    : previous(pybg3_granny_active_prefetch) {
+  pybg3_granny_active_prefetch = &sections;
+}
+
+pybg3_granny_prefetch_scope::~pybg3_granny_prefetch_scope() {
+  pybg3_granny_active_prefetch = previous;
+}
+
+static pybg3_granny_prefetched_section const* pybg3_granny_find_prefetched(
+    void const* compressed_data,
+    uint32_t compressed_size,
+    size_t uncompressed_size) {
+  if (!pybg3_granny_active_prefetch) {
+    return nullptr;
+  }
+  for (auto const& section : *pybg3_granny_active_prefetch) {
+    if (section.compressed_data == compressed_data &&
+        section.compressed_size == compressed_size &&
+        section.uncompressed_size == uncompressed_size && section.ok) {
+      return &section;
+    }
+  }
+  return nullptr;
+}
+
 void* pybg3_granny_begin_file_decompression(int type,
                                             bool endian_swapped,
                                             uint32_t uncompressed_size,
@@ -14,16 +64,25 @@ void* pybg3_granny_begin_file_decompression(int type,
   if (type != bg3_granny_compression_bitknit2 || endian_swapped) {
     return nullptr;
   }
-  return new rans::bitknit2_state((uint8_t*)uncompressed_data, uncompressed_size);
+  return new pybg3_granny_decompressor((uint8_t*)uncompressed_data, uncompressed_size);
 }
 
 bool pybg3_granny_decompress_incremental(void* context,
                                          uint32_t compressed_size,
                                          void* compressed_data) {
-  rans::bitknit2_state* ctx = (rans::bitknit2_state*)context;
+  pybg3_granny_decompressor* ctx = (pybg3_granny_decompressor*)context;
+  if (!ctx->prefetched && ctx->state.output_cursor() == ctx->dst) {
+    auto section =
+        pybg3_granny_find_prefetched(compressed_data, compressed_size, ctx->dst_len);
+    if (section) {
+      memcpy(ctx->dst, section->data.get(), ctx->dst_len);
+      ctx->prefetched = true;
+      return true;
+    }
+  }
   try {
-    bool result = ctx->decode((uint16_t*)compressed_data, compressed_size);
-    return result;
+    ctx->state.decode_incremental((uint8_t*)compressed_data, compressed_size);
+    return true;
   } catch (std::exception& e) {
     bg3_error("Decompression error: %s\n", e.what());
     return false;
@@ -31,8 +90,15 @@ bool pybg3_granny_decompress_incremental(void* context,
 }
 
 bool pybg3_granny_end_file_decompression(void* context) {
-  delete (rans::bitknit2_state*)context;
-  return true;
+  pybg3_granny_decompressor* ctx = (pybg3_granny_decompressor*)context;
+  bool result = false;
+  try {
+    result = ctx->prefetched || ctx->state.finished() || ctx->state.finish();
+  } catch (std::exception& e) {
+    bg3_error("Decompression error: %s\n", e.what());
+  }
+  delete ctx;
+  return result;
 }
 
 const bg3_granny_compressor_ops pybg3_granny_ops = {
@@ -40,3 +106,575 @@ const bg3_granny_compressor_ops pybg3_granny_ops = {
     .end_file_decompression = pybg3_granny_end_file_decompression,
     .decompress_incremental = pybg3_granny_decompress_incremental,
 };
+
+// Just enough of the GR2 layout to find and relocate the sections: a 32 byte magic block,
+// then the header, whose section table offset is relative to the end of the magic block.
+static const size_t granny_magic_size = 32;
+static const size_t granny_header_size = 40;
+static const size_t granny_section_header_size = 44;
+static const size_t granny_relocation_size = 12;
+
+// The signatures that start the magic block of 64-bit little-endian files. Granny has a
+// different one for each pointer size and byte order.
+static const uint8_t granny_le64_magics[][16] = {
+    {0xe5, 0x9b, 0x49, 0x5e, 0x6f, 0x63, 0x1f, 0x14, 0x1e, 0x13, 0xeb, 0xa9, 0x90, 0xbe,
+     0xed, 0xc4},
+    {0xe5, 0x2f, 0x4a, 0xe1, 0x6f, 0xc2, 0x8a, 0xee, 0x1e, 0xd2, 0xb4, 0x4c, 0x90, 0xd7,
+     0x55, 0xaf},
+};
+
+static uint32_t pybg3_granny_read_u32(char const* data, size_t offset) {
+  uint32_t value;
+  memcpy(&value, data + offset, sizeof(value));
+  return value;
+}
+
+bool pybg3_granny_is_le64(char const* data, size_t data_len) {
+  if (data_len < granny_magic_size) {
+    return false;
+  }
+  return std::any_of(std::begin(granny_le64_magics), std::end(granny_le64_magics),
+                     [&](uint8_t const* magic) { return !memcmp(data, magic, 16); });
+}
+
+// Reads the section table, checking that every section's stored data is within the file.
+// Only 64-bit little-endian files are accepted, since the sections are used as is.
+static bool pybg3_granny_read_sections(
+    char const* data,
+    size_t data_len,
+    std::vector<pybg3_granny_arena_reader::section>& sections) {
+  if (data_len < granny_magic_size + granny_header_size ||
+      !pybg3_granny_is_le64(data, data_len)) {
+    return false;
+  }
+  uint32_t version = pybg3_granny_read_u32(data, granny_magic_size);
+  uint32_t sections_offset = pybg3_granny_read_u32(data, granny_magic_size + 12);
+  uint32_t num_sections = pybg3_granny_read_u32(data, granny_magic_size + 16);
+  size_t table_offset = granny_magic_size + (size_t)sections_offset;
+  if ((version != 6 && version != 7) || table_offset > data_len ||
+      num_sections > (data_len - table_offset) / granny_section_header_size) {
+    return false;
+  }
+  for (size_t i = 0; i < num_sections; ++i) {
+    char const* header = data + table_offset + i * granny_section_header_size;
+    pybg3_granny_arena_reader::section section{};
+    section.compression = pybg3_granny_read_u32(header, 0);
+    section.offset = pybg3_granny_read_u32(header, 4);
+    section.compressed_size = pybg3_granny_read_u32(header, 8);
+    section.uncompressed_size = pybg3_granny_read_u32(header, 12);
+    section.alignment = pybg3_granny_read_u32(header, 16);
+    section.relocations_offset = pybg3_granny_read_u32(header, 28);
+    section.num_relocations = pybg3_granny_read_u32(header, 32);
+    if (section.offset > data_len ||
+        section.compressed_size > data_len - section.offset ||
+        section.relocations_offset > data_len) {
+      return false;
+    }
+    sections.push_back(section);
+  }
+  return true;
+}
+
+static bool pybg3_granny_bitknit2_decompress(char const* src,
+                                             size_t src_len,
+                                             void* dst,
+                                             size_t dst_len) {
+  try {
+    rans::bitknit2_state state((uint8_t*)dst, dst_len);
+    state.decode_incremental((uint8_t const*)src, src_len);
+    return state.finish();
+  } catch (std::exception const&) {
+    return false;
+  }
+}
+
+std::vector<pybg3_granny_prefetched_section> pybg3_granny_prefetch_sections(
+    char const* data,
+    size_t data_len,
+    int num_threads) {
+  std::vector<pybg3_granny_prefetched_section> sections;
+  std::vector<pybg3_granny_arena_reader::section> table;
+  if (!pybg3_granny_read_sections(data, data_len, table)) {
+    return sections;
+  }
+  for (auto const& section : table) {
+    if (section.compression == bg3_granny_compression_bitknit2 &&
+        section.uncompressed_size) {
+      sections.push_back({data + section.offset, section.compressed_size,
+                          section.uncompressed_size, false, {}});
+    }
+  }
+  std::sort(sections.begin(), sections.end(), [](auto const& a, auto const& b) {
+    return a.uncompressed_size > b.uncompressed_size;
+  });
+  pybg3_parallel_for(sections.size(), num_threads, [&](size_t i) {
+    auto& section = sections[i];
+    section.data.reset(new uint8_t[section.uncompressed_size]);
+    section.ok =
+        pybg3_granny_bitknit2_decompress(section.compressed_data, section.compressed_size,
+                                         section.data.get(), section.uncompressed_size);
+    if (!section.ok) {
+      section.data.reset();
+    }
+  });
+  return sections;
+}
+
+bg3_status pybg3_granny_reader_init(bg3_granny_reader* reader,
+                                    char* data,
+                                    size_t data_len,
+                                    int num_threads) {
+  std::vector<pybg3_granny_prefetched_section> sections;
+  if (num_threads > 1) {
+    sections = pybg3_granny_prefetch_sections(data, data_len, num_threads);
+  }
+  pybg3_granny_prefetch_scope scope(sections);
+  return bg3_granny_reader_init(reader, data, data_len, &pybg3_granny_ops);
+}
+
+static const size_t granny_huge_page_size = 2 << 20;
+static const size_t granny_min_section_alignment = 64;
+
+pybg3_granny_arena_reader::pybg3_granny_arena_reader(char const* data,
+                                                     size_t data_len,
+                                                     bool lazy)
+    : data(data), data_len(data_len) {
+  if (!pybg3_granny_is_le64(data, data_len)) {
+    throw std::runtime_error("Unsupported gr2 layout");
+  }
+  if (!pybg3_granny_read_sections(data, data_len, sections) || sections.empty()) {
+    throw std::runtime_error("Invalid gr2 header");
+  }
+  root_type_ref = {pybg3_granny_read_u32(data, granny_magic_size + 20),
+                   pybg3_granny_read_u32(data, granny_magic_size + 24)};
+  root_ref = {pybg3_granny_read_u32(data, granny_magic_size + 28),
+              pybg3_granny_read_u32(data, granny_magic_size + 32)};
+  // Lazy sections are page aligned, so that loading one never faults in its neighbours.
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  for (auto& section : sections) {
+    size_t alignment = lazy ? page_size : granny_min_section_alignment;
+    if (std::has_single_bit(section.alignment)) {
+      alignment = std::max<size_t>(alignment, section.alignment);
+    }
+    section.arena_offset = (arena_size + alignment - 1) & ~(alignment - 1);
+    arena_size = section.arena_offset + section.uncompressed_size;
+  }
+  arena_size = std::max((arena_size + page_size - 1) & ~(page_size - 1), page_size);
+  bool huge = !lazy && arena_size >= granny_huge_page_size;
+  mapping_size = huge ? arena_size + granny_huge_page_size : arena_size;
+  mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    throw std::bad_alloc();
+  }
+  arena = (char*)mapping;
+  if (huge) {
+    uintptr_t start = ((uintptr_t)mapping + granny_huge_page_size - 1) &
+                      ~(uintptr_t)(granny_huge_page_size - 1);
+    arena = (char*)start;
+#ifdef MADV_HUGEPAGE
+    madvise(arena, arena_size, MADV_HUGEPAGE);
+#endif
+  }
+}
+
+pybg3_granny_arena_reader::~pybg3_granny_arena_reader() {
+  munmap(mapping, mapping_size);
+}
+
+size_t pybg3_granny_arena_reader::section_index(void const* ptr) const {
+  size_t offset = (char const*)ptr - arena;
+  auto it = std::upper_bound(sections.begin(), sections.end(), offset,
+                             [](size_t offset, section const& section) {
+                               return offset < section.arena_offset;
+                             });
+  return it - sections.begin() - 1;
+}
+
+void* pybg3_granny_arena_reader::resolve(section_ref ref) {
+  if (ref.section >= sections.size() ||
+      ref.offset >= sections[ref.section].uncompressed_size) {
+    throw std::runtime_error("Invalid gr2 section reference");
+  }
+  return arena + sections[ref.section].arena_offset + ref.offset;
+}
+
+void* pybg3_granny_arena_reader::root() {
+  void* ptr = resolve(root_ref);
+  ensure_loaded(ptr);
+  return ptr;
+}
+
+bg3_granny_type_info* pybg3_granny_arena_reader::root_type() {
+  void* ptr = resolve(root_type_ref);
+  ensure_loaded(ptr);
+  return (bg3_granny_type_info*)ptr;
+}
+
+void pybg3_granny_arena_reader::load_section(size_t index) {
+  section& section = sections[index];
+  if (section.loaded) {
+    return;
+  }
+  char* dst = arena + section.arena_offset;
+  char const* src = data + section.offset;
+  if (section.compression == bg3_granny_compression_none) {
+    memcpy(dst, src, std::min(section.compressed_size, section.uncompressed_size));
+  } else if (section.compression != bg3_granny_compression_bitknit2) {
+    throw std::runtime_error("Unsupported gr2 section compression");
+  } else if (!pybg3_granny_bitknit2_decompress(src, section.compressed_size, dst,
+                                               section.uncompressed_size)) {
+    throw std::runtime_error("Failed to decompress gr2 section");
+  }
+  // The relocations of compressed sections are compressed the same way, prefixed by
+  // their compressed size.
+  size_t relocations_size = (size_t)section.num_relocations * granny_relocation_size;
+  std::vector<char> relocations;
+  char const* relocation_data = data + section.relocations_offset;
+  if (section.num_relocations && section.compression == bg3_granny_compression_bitknit2) {
+    if (data_len - section.relocations_offset < 4) {
+      throw std::runtime_error("Truncated gr2 relocations");
+    }
+    uint32_t compressed_size = pybg3_granny_read_u32(relocation_data, 0);
+    if (compressed_size > data_len - section.relocations_offset - 4) {
+      throw std::runtime_error("Truncated gr2 relocations");
+    }
+    relocations.resize(relocations_size);
+    if (!pybg3_granny_bitknit2_decompress(relocation_data + 4, compressed_size,
+                                          relocations.data(), relocations.size())) {
+      throw std::runtime_error("Failed to decompress gr2 relocations");
+    }
+    relocation_data = relocations.data();
+  } else if (relocations_size > data_len - section.relocations_offset) {
+    throw std::runtime_error("Truncated gr2 relocations");
+  }
+  for (size_t i = 0; i < section.num_relocations; ++i) {
+    char const* relocation = relocation_data + i * granny_relocation_size;
+    uint32_t offset = pybg3_granny_read_u32(relocation, 0);
+    section_ref target = {pybg3_granny_read_u32(relocation, 4),
+                          pybg3_granny_read_u32(relocation, 8)};
+    if (offset > section.uncompressed_size ||
+        section.uncompressed_size - offset < sizeof(void*) ||
+        target.section >= sections.size() ||
+        target.offset > sections[target.section].uncompressed_size) {
+      throw std::runtime_error("Invalid gr2 relocation");
+    }
+    void* ptr = arena + sections[target.section].arena_offset + target.offset;
+    memcpy(dst + offset, &ptr, sizeof(ptr));
+  }
+  section.loaded = true;
+}
+
+void pybg3_granny_arena_reader::load_all(int num_threads) {
+  std::vector<size_t> order;
+  for (size_t i = 0; i < sections.size(); ++i) {
+    if (!sections[i].loaded) {
+      order.push_back(i);
+    }
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return sections[a].uncompressed_size > sections[b].uncompressed_size;
+  });
+  // Each section only writes to its own part of the arena and its own entry in sections.
+  pybg3_parallel_for(order.size(), num_threads,
+                     [&](size_t i) { load_section(order[i]); });
+}
+
+static float pybg3_granny_half_to_float(uint16_t half) {
+  uint32_t sign = uint32_t(half & 0x8000) << 16;
+  uint32_t exponent = (half >> 10) & 0x1F;
+  uint32_t mantissa = half & 0x3FF;
+  uint32_t bits;
+  if (exponent == 0x1F) {
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  } else if (exponent) {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else if (mantissa) {
+    // Subnormal halves are normal floats.
+    int shift = std::countl_zero(mantissa) - 21;
+    bits = sign | ((113 - shift) << 23) | (((mantissa << shift) & 0x3FF) << 13);
+  } else {
+    bits = sign;
+  }
+  return std::bit_cast<float>(bits);
+}
+
+template <typename T>
+static float pybg3_granny_normal_to_float(T val) {
+  return val * (1.0f / std::numeric_limits<T>::max());
+}
+
+// The most negative value is clamped, so that -max and min both decode to -1.
+template <typename T>
+static float pybg3_granny_binormal_to_float(T val) {
+  return std::max(val * (1.0f / std::numeric_limits<T>::max()), -1.0f);
+}
+
+enum class pybg3_granny_conversion { cast, normal, binormal, half };
+
+template <typename T, pybg3_granny_conversion Conversion>
+static float pybg3_granny_convert(T val) {
+  if constexpr (Conversion == pybg3_granny_conversion::normal) {
+    return pybg3_granny_normal_to_float(val);
+  } else if constexpr (Conversion == pybg3_granny_conversion::binormal) {
+    return pybg3_granny_binormal_to_float(val);
+  } else if constexpr (Conversion == pybg3_granny_conversion::half) {
+    return pybg3_granny_half_to_float(val);
+  } else {
+    return float(val);
+  }
+}
+
+// Decodes values [begin, end) of the row-major output one at a time.
+template <typename T, pybg3_granny_conversion Conversion>
+static void pybg3_granny_decode_scalar(char const* src,
+                                       size_t src_stride,
+                                       size_t components,
+                                       size_t begin,
+                                       size_t end,
+                                       float* dst) {
+  char const* row = src + begin / components * src_stride;
+  size_t component = begin % components;
+  for (size_t i = begin; i < end; ++i) {
+    T val;
+    memcpy(&val, row + component * sizeof(T), sizeof(T));
+    dst[i] = pybg3_granny_convert<T, Conversion>(val);
+    if (++component == components) {
+      component = 0;
+      row += src_stride;
+    }
+  }
+}
+
+// Converts the W values at src and stores them to dst.
+template <int W, typename T, pybg3_granny_conversion Conversion>
+[[gnu::always_inline]] static inline void pybg3_granny_convert_vector(char const* src,
+                                                                      float* dst) {
+  typedef T raw_vec __attribute__((vector_size(W * sizeof(T))));
+  typedef int32_t int_vec __attribute__((vector_size(W * 4)));
+  typedef float float_vec __attribute__((vector_size(W * 4)));
+  raw_vec raw;
+  memcpy(&raw, src, sizeof(raw));
+  float_vec out;
+  if constexpr (Conversion == pybg3_granny_conversion::half) {
+    // The float exponent is rebiased with integer adds. Inf and NaN need a second
+    // rebias, and subnormals are made normal by subtracting the implicit leading 1.
+    int_vec half = __builtin_convertvector(raw, int_vec);
+    int_vec bits = (half & 0x7FFF) << 13;
+    int_vec exponent = bits & 0x0F800000;
+    bits += 0x38000000;
+    bits += (exponent == 0x0F800000) & 0x38000000;
+    int_vec subnormal = exponent == 0;
+    bits += subnormal & 0x00800000;
+    float_vec adjusted = (float_vec)bits - 0x1p-14f;
+    bits = (bits & ~subnormal) | ((int_vec)adjusted & subnormal);
+    out = (float_vec)(bits | ((half & 0x8000) << 16));
+  } else {
+    out = __builtin_convertvector(raw, float_vec);
+    if constexpr (Conversion != pybg3_granny_conversion::cast) {
+      out *= 1.0f / std::numeric_limits<T>::max();
+    }
+    if constexpr (Conversion == pybg3_granny_conversion::binormal) {
+      float_vec minus_one = float_vec{} - 1.0f;
+      int_vec clamped = out < minus_one;
+      out = (float_vec)(((int_vec)out & ~clamped) | ((int_vec)minus_one & clamped));
+    }
+  }
+  memcpy(dst, &out, sizeof(out));
+}
+
+// Decodes contiguous input W values at a time. Interleaved input is decoded a row at a
+// time with 4-value vectors instead, loading and storing whole vectors even when a row
+// is shorter and letting the next row overwrite the excess, so rows near the end of
+// either buffer are left to the scalar loop. This is always inlined into the
+// per-instruction-set entry points below, so that each copy gets compiled for its own
+// target.
+template <int W, typename T, pybg3_granny_conversion Conversion>
+[[gnu::always_inline]] static inline void pybg3_granny_decode_vector(char const* src,
+                                                                     size_t src_stride,
+                                                                     size_t components,
+                                                                     size_t count,
+                                                                     float* dst) {
+  size_t total = count * components;
+  size_t scalar_begin;
+  if (src_stride == components * sizeof(T)) {
+    scalar_begin = total - total % W;
+    for (size_t i = 0; i < scalar_begin; i += W) {
+      pybg3_granny_convert_vector<W, T, Conversion>(src + i * sizeof(T), dst + i);
+    }
+  } else {
+    size_t padded = (components + 3) & ~size_t(3);
+    size_t src_len = count ? (count - 1) * src_stride + components * sizeof(T) : 0;
+    size_t row = 0;
+    for (; row < count; ++row) {
+      if (row * src_stride + padded * sizeof(T) > src_len ||
+          row * components + padded > total) {
+        break;
+      }
+      char const* row_src = src + row * src_stride;
+      for (size_t i = 0; i < components; i += 4) {
+        pybg3_granny_convert_vector<4, T, Conversion>(row_src + i * sizeof(T),
+                                                      dst + row * components + i);
+      }
+    }
+    scalar_begin = row * components;
+  }
+  pybg3_granny_decode_scalar<T, Conversion>(src, src_stride, components, scalar_begin,
+                                            total, dst);
+}
+
+// Dispatches on dt to Decode<T, Conversion>::run, which is either the scalar or a
+// vector kernel.
+template <template <typename, pybg3_granny_conversion> typename Decode>
+[[gnu::always_inline]] static inline bool pybg3_granny_decode_dispatch(
+    bg3_granny_data_type dt,
+    char const* src,
+    size_t src_stride,
+    size_t components,
+    size_t count,
+    float* dst) {
+  using enum pybg3_granny_conversion;
+  switch (dt) {
+    case bg3_granny_dt_float:
+      Decode<float, cast>::run(src, src_stride, components, count, dst);
+      return true;
+    case bg3_granny_dt_half:
+      Decode<uint16_t, half>::run(src, src_stride, components, count, dst);
+      return true;
+    case bg3_granny_dt_normal_uint8:
+      Decode<uint8_t, normal>::run(src, src_stride, components, count, dst);
+      return true;
+    case bg3_granny_dt_normal_uint16:
+      Decode<uint16_t, normal>::run(src, src_stride, components, count, dst);
+      return true;
+    case bg3_granny_dt_binormal_int8:
+      Decode<int8_t, binormal>::run(src, src_stride, components, count, dst);
+      return true;
+    case bg3_granny_dt_binormal_int16:
+      Decode<int16_t, binormal>::run(src, src_stride, components, count, dst);
+      return true;
+    case bg3_granny_dt_int8:
+      Decode<int8_t, cast>::run(src, src_stride, components, count, dst);
+      return true;
+    case bg3_granny_dt_uint8:
+      Decode<uint8_t, cast>::run(src, src_stride, components, count, dst);
+      return true;
+    case bg3_granny_dt_int16:
+      Decode<int16_t, cast>::run(src, src_stride, components, count, dst);
+      return true;
+    case bg3_granny_dt_uint16:
+      Decode<uint16_t, cast>::run(src, src_stride, components, count, dst);
+      return true;
+    case bg3_granny_dt_int32:
+      Decode<int32_t, cast>::run(src, src_stride, components, count, dst);
+      return true;
+    case bg3_granny_dt_uint32:
+      Decode<uint32_t, cast>::run(src, src_stride, components, count, dst);
+      return true;
+    default:
+      return false;
+  }
+}
+
+template <typename T, pybg3_granny_conversion Conversion>
+struct pybg3_granny_scalar_decoder {
+  static void run(char const* src,
+                  size_t src_stride,
+                  size_t components,
+                  size_t count,
+                  float* dst) {
+    pybg3_granny_decode_scalar<T, Conversion>(src, src_stride, components, 0,
+                                              count * components, dst);
+  }
+};
+
+template <int W>
+struct pybg3_granny_vector_decoder {
+  template <typename T, pybg3_granny_conversion Conversion>
+  struct type {
+    [[gnu::always_inline]] static inline void run(char const* src,
+                                                  size_t src_stride,
+                                                  size_t components,
+                                                  size_t count,
+                                                  float* dst) {
+      pybg3_granny_decode_vector<W, T, Conversion>(src, src_stride, components, count,
+                                                   dst);
+    }
+  };
+};
+
+#if defined(__x86_64__)
+__attribute__((target("avx2"))) static bool pybg3_granny_decode_avx2(
+    bg3_granny_data_type dt,
+    char const* src,
+    size_t src_stride,
+    size_t components,
+    size_t count,
+    float* dst) {
+  return pybg3_granny_decode_dispatch<pybg3_granny_vector_decoder<8>::type>(
+      dt, src, src_stride, components, count, dst);
+}
+
+__attribute__((target("sse4.1"))) static bool pybg3_granny_decode_sse41(
+    bg3_granny_data_type dt,
+    char const* src,
+    size_t src_stride,
+    size_t components,
+    size_t count,
+    float* dst) {
+  return pybg3_granny_decode_dispatch<pybg3_granny_vector_decoder<4>::type>(
+      dt, src, src_stride, components, count, dst);
+}
+#elif defined(__aarch64__)
+static bool pybg3_granny_decode_neon(bg3_granny_data_type dt,
+                                     char const* src,
+                                     size_t src_stride,
+                                     size_t components,
+                                     size_t count,
+                                     float* dst) {
+  return pybg3_granny_decode_dispatch<pybg3_granny_vector_decoder<4>::type>(
+      dt, src, src_stride, components, count, dst);
+}
+#endif
+
+pybg3_granny_simd pybg3_granny_best_simd() {
+  static pybg3_granny_simd best = [] {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return pybg3_granny_simd::avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+      return pybg3_granny_simd::sse41;
+    }
+#elif defined(__aarch64__)
+    return pybg3_granny_simd::neon;
+#endif
+    return pybg3_granny_simd::scalar;
+  }();
+  return best;
+}
+
+bool pybg3_granny_decode_floats(bg3_granny_data_type dt,
+                                void const* src_data,
+                                size_t src_stride,
+                                size_t components,
+                                size_t count,
+                                float* dst,
+                                pybg3_granny_simd simd) {
+  char const* src = (char const*)src_data;
+  switch (simd) {
+#if defined(__x86_64__)
+    case pybg3_granny_simd::avx2:
+      return pybg3_granny_decode_avx2(dt, src, src_stride, components, count, dst);
+    case pybg3_granny_simd::sse41:
+      return pybg3_granny_decode_sse41(dt, src, src_stride, components, count, dst);
+#elif defined(__aarch64__)
+    case pybg3_granny_simd::neon:
+      return pybg3_granny_decode_neon(dt, src, src_stride, components, count, dst);
+#endif
+    default:
+      return pybg3_granny_decode_dispatch<pybg3_granny_scalar_decoder>(
+          dt, src, src_stride, components, count, dst);
+  }
+}
@@ -22,6 +22,131 @@
 
 #pragma once
 
+#include <memory>
+#include <vector>
+
 #include "libbg3.h"
 
 extern const bg3_granny_compressor_ops pybg3_granny_ops;
+
+// A BitKnit2 section decompressed ahead of bg3_granny_reader_init. compressed_data points
+// into the file data, which is how pybg3_granny_ops recognizes the section later.
+struct pybg3_granny_prefetched_section {
+  char const* compressed_data;
+  uint32_t compressed_size;
+  uint32_t uncompressed_size;
+  bool ok;
+  std::unique_ptr<uint8_t[]> data;
+};
+
+// Decompresses every BitKnit2 section of a GR2 file on up to num_threads threads, largest
+// first. Returns nothing if the file header isn't one we understand. Sections that fail
+// to decompress are kept with ok == false so that the error is reported by the reader.
+std::vector<pybg3_granny_prefetched_section> pybg3_granny_prefetch_sections(
+    char const* data,
+    size_t data_len,
+    int num_threads);
+
+// While alive, pybg3_granny_ops calls on this thread copy out matching sections from
+// `sections` instead of decompressing them.
+struct pybg3_granny_prefetch_scope {
+  explicit pybg3_granny_prefetch_scope(
+      std::vector<pybg3_granny_prefetched_section> const& sections);
+  ~pybg3_granny_prefetch_scope();
+  pybg3_granny_prefetch_scope(pybg3_granny_prefetch_scope const&) = delete;
+  pybg3_granny_prefetch_scope& operator=(pybg3_granny_prefetch_scope const&) = delete;
+  std::vector<pybg3_granny_prefetched_section> const* previous;
+};
+
+// Whether data starts with the magic block of a 64-bit little-endian GR2 file, the only
+// layout pybg3_granny_prefetch_sections and pybg3_granny_arena_reader understand.
+bool pybg3_granny_is_le64(char const* data, size_t data_len);
+
+// bg3_granny_reader_init with pybg3_granny_ops, but with the sections decompressed on up
+// to num_threads threads first. The peak memory use is higher by the size of the
+// decompressed sections, since they're copied into the reader's own buffers.
+bg3_status pybg3_granny_reader_init(bg3_granny_reader* reader,
+                                    char* data,
+                                    size_t data_len,
+                                    int num_threads);
+
+// Loads a GR2 file into a single reader-owned arena. Room for every section is reserved
+// up front, so pointers can be relocated before their targets are loaded and each
+// section can be decompressed and relocated on its own. The file data is only ever read,
+// so it can be shared between readers and threads, and must outlive the reader.
+//
+// In lazy mode each section gets its own pages and is only loaded when load_section (or
+// ensure_loaded with a pointer into it) is first called for it, so sections nobody looks
+// at cost neither time nor memory. Otherwise the sections are packed together in a
+// 2MiB-aligned mapping that's eligible for transparent huge pages, and load_all loads
+// them in parallel.
+//
+// Only 64-bit little-endian files are supported, which is everything BG3 ships. Apart
+// from load_all, not thread safe.
+struct pybg3_granny_arena_reader {
+  struct section {
+    uint32_t compression;
+    uint32_t offset;
+    uint32_t compressed_size;
+    uint32_t uncompressed_size;
+    uint32_t alignment;
+    uint32_t relocations_offset;
+    uint32_t num_relocations;
+    size_t arena_offset;
+    bool loaded;
+  };
+  struct section_ref {
+    uint32_t section;
+    uint32_t offset;
+  };
+  // Throws std::runtime_error if the file isn't 64-bit little-endian or the header or
+  // section table is malformed.
+  pybg3_granny_arena_reader(char const* data, size_t data_len, bool lazy);
+  ~pybg3_granny_arena_reader();
+  pybg3_granny_arena_reader(pybg3_granny_arena_reader const&) = delete;
+  pybg3_granny_arena_reader& operator=(pybg3_granny_arena_reader const&) = delete;
+  void* root();
+  bg3_granny_type_info* root_type();
+  // Loads the section ptr points into. Pointers outside the arena (including null) are
+  // ignored. Throws std::runtime_error if the section can't be decompressed.
+  void ensure_loaded(void const* ptr) {
+    if (ptr >= arena && ptr < arena + arena_size) {
+      load_section(section_index(ptr));
+    }
+  }
+  void load_section(size_t index);
+  // Loads every section on up to num_threads threads, largest first.
+  void load_all(int num_threads);
+  size_t section_index(void const* ptr) const;
+  void* resolve(section_ref ref);
+  char const* data;
+  size_t data_len;
+  std::vector<section> sections;
+  section_ref root_type_ref, root_ref;
+  char* arena{nullptr};
+  size_t arena_size{0};
+  void* mapping{nullptr};
+  size_t mapping_size{0};
+};
+
+// The instruction sets pybg3_granny_decode_floats has kernels for.
+enum class pybg3_granny_simd { scalar, sse41, avx2, neon };
+
+// The best of those the CPU supports.
+pybg3_granny_simd pybg3_granny_best_simd();
+
+// Converts count elements of `components` values of type dt to float32, written to dst
+// as count contiguous rows. Elements are src_stride bytes apart, so this can read one
+// field straight out of an interleaved vertex array. The normalized types are mapped to
+// [0, 1] (normal_uint*) or [-1, 1] (binormal_int*) and other integers are converted
+// as-is. Returns false if dt isn't a numeric type.
+//
+// simd picks the kernel, falling back to the scalar one if it isn't available in this
+// build. All of them produce the same results.
+bool pybg3_granny_decode_floats(bg3_granny_data_type dt,
+                                void const* src,
+                                size_t src_stride,
+                                size_t components,
+                                size_t count,
+                                float* dst,
+                                pybg3_granny_simd simd = pybg3_granny_best_simd());
@@ -23,8 +23,16 @@
 #define LIBBG3_IMPLEMENTATION
 #include "pybg3_granny.h"
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <random>
 #include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "libbg3.h"
 #include "rans.h"
@@ -131,3 +139,408 @@ TEST(PyBg3GrannyTest, Zen) {
   delete[] bitbuf;
   bg3_mapped_file_destroy(&mapped);
 }
+
+// Lays out a GR2 file with just enough of a header for pybg3_granny_prefetch_sections and
+// pybg3_granny_arena_reader: the 64-bit little-endian magic block, a version 7 header
+// with the root references and the section table, followed by section data and
+// relocations.
+struct fake_granny_section {
+  uint32_t compression;
+  std::vector<uint8_t> contents;
+  std::vector<uint8_t> stored;
+  uint32_t offset;
+  // (offset in this section, target section, offset in target section)
+  std::vector<std::array<uint32_t, 3>> relocations;
+};
+
+static std::vector<uint8_t> bitknit2_compress(std::vector<uint8_t> const& data) {
+  rans::bitknit2_encoder encoder;
+  std::vector<uint8_t> stored(rans::bitknit2_encoder::max_encoded_size(data.size()));
+  stored.resize(encoder.encode(data.data(), data.size(), stored.data(), stored.size()));
+  return stored;
+}
+
+static std::vector<char> fake_granny_file(std::vector<fake_granny_section>& sections,
+                                          std::array<uint32_t, 4> roots = {}) {
+  size_t table_offset = 32 + 72;
+  std::vector<char> file(table_offset + sections.size() * 44);
+  auto put_u32 = [&](size_t offset, uint32_t value) {
+    memcpy(file.data() + offset, &value, sizeof(value));
+  };
+  static const uint8_t le64_magic[16] = {0xe5, 0x9b, 0x49, 0x5e, 0x6f, 0x63, 0x1f, 0x14,
+                                         0x1e, 0x13, 0xeb, 0xa9, 0x90, 0xbe, 0xed, 0xc4};
+  memcpy(file.data(), le64_magic, sizeof(le64_magic));
+  put_u32(32, 7);
+  put_u32(44, table_offset - 32);
+  put_u32(48, sections.size());
+  for (size_t i = 0; i < roots.size(); ++i) {
+    put_u32(52 + i * 4, roots[i]);
+  }
+  for (size_t i = 0; i < sections.size(); ++i) {
+    auto& section = sections[i];
+    section.offset = file.size();
+    file.insert(file.end(), section.stored.begin(), section.stored.end());
+    put_u32(table_offset + i * 44, section.compression);
+    put_u32(table_offset + i * 44 + 4, section.offset);
+    put_u32(table_offset + i * 44 + 8, section.stored.size());
+    put_u32(table_offset + i * 44 + 12, section.contents.size());
+    put_u32(table_offset + i * 44 + 28, file.size());
+    put_u32(table_offset + i * 44 + 32, section.relocations.size());
+    std::vector<uint8_t> relocations(section.relocations.size() * 12);
+    memcpy(relocations.data(), section.relocations.data(), relocations.size());
+    if (!relocations.empty() && section.compression == bg3_granny_compression_bitknit2) {
+      relocations = bitknit2_compress(relocations);
+      uint32_t size = relocations.size();
+      file.insert(file.end(), (char*)&size, (char*)&size + sizeof(size));
+    }
+    file.insert(file.end(), relocations.begin(), relocations.end());
+  }
+  return file;
+}
+
+static fake_granny_section fake_bitknit2_section(size_t len, uint32_t seed) {
+  fake_granny_section section{bg3_granny_compression_bitknit2};
+  for (size_t i = 0; i < len; ++i) {
+    section.contents.push_back((i * seed) >> 7 ^ (i % 251 == 0 ? seed : 0));
+  }
+  section.stored = bitknit2_compress(section.contents);
+  return section;
+}
+
+// Feeds a section through pybg3_granny_ops the way bg3_granny_reader_init does.
+static bool decompress_with_ops(std::vector<char> const& file,
+                                fake_granny_section const& section,
+                                std::vector<uint8_t>& output) {
+  output.assign(section.contents.size(), 0);
+  void* ctx = pybg3_granny_ops.begin_file_decompression(
+      bg3_granny_compression_bitknit2, false, output.size(), output.data(), 0, nullptr);
+  bool ok = pybg3_granny_ops.decompress_incremental(
+      ctx, section.stored.size(), (void*)(file.data() + section.offset));
+  return pybg3_granny_ops.end_file_decompression(ctx) && ok;
+}
+
+TEST(PyBg3GrannyTest, PrefetchSections) {
+  std::vector<fake_granny_section> sections = {
+      fake_bitknit2_section(1000, 3),
+      fake_bitknit2_section(300000, 5),
+      {0, {1, 2, 3, 4}, {1, 2, 3, 4}},
+      fake_bitknit2_section(70000, 7),
+      fake_bitknit2_section(1, 11),
+  };
+  std::vector<char> file = fake_granny_file(sections);
+  auto prefetched = pybg3_granny_prefetch_sections(file.data(), file.size(), 4);
+  ASSERT_EQ(4, prefetched.size());
+  for (size_t i = 1; i < prefetched.size(); ++i) {
+    EXPECT_GE(prefetched[i - 1].uncompressed_size, prefetched[i].uncompressed_size);
+  }
+  for (auto const& entry : prefetched) {
+    ASSERT_TRUE(entry.ok);
+    auto section = std::find_if(sections.begin(), sections.end(), [&](auto const& s) {
+      return file.data() + s.offset == entry.compressed_data;
+    });
+    ASSERT_NE(section, sections.end());
+    EXPECT_TRUE(std::equal(section->contents.begin(), section->contents.end(),
+                           entry.data.get()));
+  }
+  pybg3_granny_prefetch_scope scope(prefetched);
+  for (auto const& section : sections) {
+    if (section.compression != bg3_granny_compression_bitknit2) {
+      continue;
+    }
+    std::vector<uint8_t> output;
+    EXPECT_TRUE(decompress_with_ops(file, section, output));
+    EXPECT_EQ(section.contents, output);
+  }
+}
+
+TEST(PyBg3GrannyTest, PrefetchSectionsFailure) {
+  std::vector<fake_granny_section> sections = {fake_bitknit2_section(200000, 13)};
+  sections[0].stored.resize(sections[0].stored.size() / 2);
+  std::vector<char> file = fake_granny_file(sections);
+  auto prefetched = pybg3_granny_prefetch_sections(file.data(), file.size(), 2);
+  ASSERT_EQ(1, prefetched.size());
+  EXPECT_FALSE(prefetched[0].ok);
+  // The failed section isn't used, so the inline decoder reports the error.
+  pybg3_granny_prefetch_scope scope(prefetched);
+  std::vector<uint8_t> output;
+  EXPECT_FALSE(decompress_with_ops(file, sections[0], output));
+  file.resize(40);
+  EXPECT_TRUE(pybg3_granny_prefetch_sections(file.data(), file.size(), 2).empty());
+}
+
+static uint64_t read_u64(void const* ptr) {
+  uint64_t value;
+  memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+TEST(PyBg3GrannyTest, LazyReader) {
+  // The root lives in an uncompressed section and points at a compressed one, which
+  // points at a third section that nothing ever dereferences.
+  std::vector<fake_granny_section> sections(3);
+  sections[0].compression = bg3_granny_compression_none;
+  sections[0].contents.assign(64, 0);
+  sections[0].stored = sections[0].contents;
+  sections[0].relocations = {{8, 1, 100}};
+  sections[1] = fake_bitknit2_section(100000, 17);
+  sections[1].relocations = {{104, 2, 24}, {200, 0, 0}};
+  sections[2] = fake_bitknit2_section(200000, 19);
+  std::vector<char> file = fake_granny_file(sections, {0, 32, 0, 0});
+  std::vector<char> original = file;
+  pybg3_granny_arena_reader reader(file.data(), file.size(), true);
+  char* root = (char*)reader.root();
+  EXPECT_TRUE(reader.sections[0].loaded);
+  EXPECT_FALSE(reader.sections[1].loaded);
+  EXPECT_EQ((void*)reader.root_type(), root + 32);
+  char* child = (char*)read_u64(root + 8);
+  reader.ensure_loaded(child);
+  EXPECT_TRUE(reader.sections[1].loaded);
+  EXPECT_FALSE(reader.sections[2].loaded);
+  EXPECT_EQ(0, memcmp(child - 100, sections[1].contents.data(), 100));
+  EXPECT_EQ((uint64_t)root, read_u64(child - 100 + 200));
+  char* grandchild = (char*)read_u64(child + 4);
+  EXPECT_EQ(2, reader.section_index(grandchild));
+  EXPECT_FALSE(reader.sections[2].loaded);
+  reader.ensure_loaded(grandchild);
+  EXPECT_EQ(0, memcmp(grandchild - 24, sections[2].contents.data(),
+                      sections[2].contents.size()));
+  reader.ensure_loaded(nullptr);
+  EXPECT_EQ(original, file);
+}
+
+TEST(PyBg3GrannyTest, LazyReaderErrors) {
+  std::vector<fake_granny_section> sections = {fake_bitknit2_section(5000, 23)};
+  sections[0].relocations = {{4999, 0, 0}};
+  std::vector<char> file = fake_granny_file(sections);
+  pybg3_granny_arena_reader reader(file.data(), file.size(), true);
+  EXPECT_THROW(reader.root(), std::runtime_error);
+  EXPECT_FALSE(reader.sections[0].loaded);
+  file.resize(50);
+  EXPECT_THROW(pybg3_granny_arena_reader(file.data(), file.size(), true),
+               std::runtime_error);
+}
+
+TEST(PyBg3GrannyTest, ArenaReaderRejectsOtherLayouts) {
+  std::vector<fake_granny_section> sections = {fake_bitknit2_section(5000, 29)};
+  std::vector<char> file = fake_granny_file(sections);
+  EXPECT_TRUE(pybg3_granny_is_le64(file.data(), file.size()));
+  // The 32-bit little-endian signature.
+  static const uint8_t le32_magic[16] = {0x29, 0xde, 0x6c, 0xc0, 0xba, 0xa4, 0x53, 0x2b,
+                                         0x25, 0xf5, 0xb7, 0xa5, 0xf6, 0x66, 0xe2, 0xee};
+  memcpy(file.data(), le32_magic, sizeof(le32_magic));
+  EXPECT_FALSE(pybg3_granny_is_le64(file.data(), file.size()));
+  EXPECT_THROW(pybg3_granny_arena_reader(file.data(), file.size(), false),
+               std::runtime_error);
+  EXPECT_TRUE(pybg3_granny_prefetch_sections(file.data(), file.size(), 2).empty());
+}
+
+TEST(PyBg3GrannyTest, ArenaReader) {
+  std::vector<fake_granny_section> sections = {
+      fake_bitknit2_section(3000, 29),
+      fake_bitknit2_section(3 << 20, 31),
+      fake_bitknit2_section(100, 37),
+  };
+  sections[0].relocations = {{0, 1, 8}, {8, 2, 0}};
+  sections[1].relocations = {{16, 0, 2999}};
+  std::vector<char> file = fake_granny_file(sections);
+  std::vector<char> original = file;
+  pybg3_granny_arena_reader reader(file.data(), file.size(), false);
+  EXPECT_EQ(0, (uintptr_t)reader.arena % (2 << 20));
+  reader.load_all(4);
+  for (size_t i = 0; i < sections.size(); ++i) {
+    ASSERT_TRUE(reader.sections[i].loaded);
+    EXPECT_EQ(0, reader.sections[i].arena_offset % 64);
+  }
+  char* base[3];
+  for (size_t i = 0; i < 3; ++i) {
+    base[i] = reader.arena + reader.sections[i].arena_offset;
+  }
+  EXPECT_EQ((uint64_t)(base[1] + 8), read_u64(base[0]));
+  EXPECT_EQ((uint64_t)base[2], read_u64(base[0] + 8));
+  EXPECT_EQ((uint64_t)(base[0] + 2999), read_u64(base[1] + 16));
+  EXPECT_EQ(0, memcmp(base[0] + 16, sections[0].contents.data() + 16, 3000 - 16));
+  EXPECT_EQ(0, memcmp(base[1] + 24, sections[1].contents.data() + 24, (3 << 20) - 24));
+  EXPECT_EQ(0, memcmp(base[2], sections[2].contents.data(), 100));
+  EXPECT_EQ(original, file);
+}
+
+TEST(PyBg3GrannyTest, DecodeFloats) {
+  struct LIBBG3_PACK vertex {
+    float position[3];
+    uint16_t uv[2];
+    uint8_t weights[4];
+    int16_t normal[3];
+  };
+  vertex vertices[2] = {
+      {{1.0f, -2.0f, 0.5f}, {0x3C00, 0xC100}, {255, 0, 51, 1}, {32767, -32768, 0}},
+      {{0.0f, 3.0f, 4.0f}, {0x0001, 0x7BFF}, {0, 128, 0, 127}, {-32767, 16384, 1}},
+  };
+  float out[8];
+  ASSERT_TRUE(pybg3_granny_decode_floats(bg3_granny_dt_float, vertices, sizeof(vertex),
+                                         3, 2, out));
+  EXPECT_EQ(std::vector<float>(out, out + 6),
+            std::vector<float>({1.0f, -2.0f, 0.5f, 0.0f, 3.0f, 4.0f}));
+  ASSERT_TRUE(pybg3_granny_decode_floats(bg3_granny_dt_half, &vertices[0].uv,
+                                         sizeof(vertex), 2, 2, out));
+  EXPECT_EQ(std::vector<float>(out, out + 4),
+            std::vector<float>({1.0f, -2.5f, 0x1p-24f, 65504.0f}));
+  ASSERT_TRUE(pybg3_granny_decode_floats(bg3_granny_dt_normal_uint8,
+                                         &vertices[0].weights, sizeof(vertex), 4, 2,
+                                         out));
+  EXPECT_FLOAT_EQ(1.0f, out[0]);
+  EXPECT_FLOAT_EQ(0.2f, out[2]);
+  EXPECT_FLOAT_EQ(128 / 255.0f, out[5]);
+  ASSERT_TRUE(pybg3_granny_decode_floats(bg3_granny_dt_binormal_int16,
+                                         &vertices[0].normal, sizeof(vertex), 3, 2,
+                                         out));
+  EXPECT_EQ(std::vector<float>(out, out + 4),
+            std::vector<float>({1.0f, -1.0f, 0.0f, -1.0f}));
+  EXPECT_FLOAT_EQ(16384 / 32767.0f, out[4]);
+  ASSERT_TRUE(pybg3_granny_decode_floats(bg3_granny_dt_uint8, &vertices[0].weights,
+                                         sizeof(vertex), 4, 1, out));
+  EXPECT_EQ(std::vector<float>(out, out + 4),
+            std::vector<float>({255.0f, 0.0f, 51.0f, 1.0f}));
+  EXPECT_FALSE(pybg3_granny_decode_floats(bg3_granny_dt_string, vertices, sizeof(vertex),
+                                          1, 2, out));
+  uint16_t halves[] = {0x8000, 0x7C00, 0xFC00, 0x0200, 0x3555};
+  ASSERT_TRUE(pybg3_granny_decode_floats(bg3_granny_dt_half, halves, 2, 1, 5, out));
+  EXPECT_TRUE(std::signbit(out[0]) && out[0] == 0.0f);
+  EXPECT_EQ(INFINITY, out[1]);
+  EXPECT_EQ(-INFINITY, out[2]);
+  EXPECT_EQ(0x1p-15f, out[3]);
+  EXPECT_FLOAT_EQ(0.33325195f, out[4]);
+}
+
+static std::vector<pybg3_granny_simd> supported_simd_levels() {
+  std::vector<pybg3_granny_simd> levels = {pybg3_granny_simd::scalar};
+  switch (pybg3_granny_best_simd()) {
+    case pybg3_granny_simd::avx2:
+      levels.push_back(pybg3_granny_simd::avx2);
+      [[fallthrough]];
+    case pybg3_granny_simd::sse41:
+      levels.push_back(pybg3_granny_simd::sse41);
+      break;
+    case pybg3_granny_simd::neon:
+      levels.push_back(pybg3_granny_simd::neon);
+      break;
+    default:
+      break;
+  }
+  return levels;
+}
+
+TEST(PyBg3GrannyTest, DecodeFloatsSimd) {
+  std::pair<bg3_granny_data_type, size_t> types[] = {
+      {bg3_granny_dt_float, 4},          {bg3_granny_dt_half, 2},
+      {bg3_granny_dt_int8, 1},           {bg3_granny_dt_uint8, 1},
+      {bg3_granny_dt_binormal_int8, 1},  {bg3_granny_dt_normal_uint8, 1},
+      {bg3_granny_dt_int16, 2},          {bg3_granny_dt_uint16, 2},
+      {bg3_granny_dt_binormal_int16, 2}, {bg3_granny_dt_normal_uint16, 2},
+      {bg3_granny_dt_int32, 4},          {bg3_granny_dt_uint32, 4},
+  };
+  std::mt19937 rng(1234);
+  std::vector<uint8_t> src(64 * 41);
+  for (auto& byte : src) {
+    byte = rng();
+  }
+  // Keep the floats finite, so that the outputs can be compared with ==.
+  for (size_t i = 0; i < src.size(); i += 4) {
+    src[i + 3] &= 0x3F;
+  }
+  std::vector<float> expected(5 * 41), actual(5 * 41);
+  for (auto [dt, value_size] : types) {
+    for (size_t components = 1; components <= 5; ++components) {
+      for (size_t stride : {size_t(0), size_t(23), size_t(64)}) {
+        if (!stride) {
+          stride = components * value_size;
+        } else if (stride < components * value_size) {
+          continue;
+        }
+        for (size_t count : {0, 1, 3, 8, 41}) {
+          ASSERT_TRUE(pybg3_granny_decode_floats(dt, src.data(), stride, components,
+                                                 count, expected.data(),
+                                                 pybg3_granny_simd::scalar));
+          for (auto simd : supported_simd_levels()) {
+            std::fill(actual.begin(), actual.end(), -42.0f);
+            ASSERT_TRUE(pybg3_granny_decode_floats(dt, src.data(), stride, components,
+                                                   count, actual.data(), simd));
+            for (size_t i = 0; i < expected.size(); ++i) {
+              float want = i < count * components ? expected[i] : -42.0f;
+              ASSERT_TRUE(want == actual[i] ||
+                          (std::isnan(want) && std::isnan(actual[i])))
+                  << "dt " << dt << " simd " << int(simd) << " components "
+                  << components << " stride " << stride << " count " << count
+                  << " index " << i << ": " << want << " != " << actual[i];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+// Not really a test, just prints decode MB/s of a BG3-style vertex layout for each
+// supported instruction set. The mesh has as many vertices as 16-bit indices allow.
+TEST(PyBg3GrannyTest, DecodeFloatsBenchmark) {
+  struct vertex {
+    float position[3];
+    int16_t qtangent[4];
+    uint8_t bone_weights[4];
+    uint8_t bone_indices[4];
+    uint16_t uv[2];
+  };
+  struct field {
+    char const* name;
+    bg3_granny_data_type dt;
+    size_t offset;
+    size_t components;
+  } fields[] = {
+      {"position", bg3_granny_dt_float, offsetof(vertex, position), 3},
+      {"qtangent", bg3_granny_dt_binormal_int16, offsetof(vertex, qtangent), 4},
+      {"weights", bg3_granny_dt_normal_uint8, offsetof(vertex, bone_weights), 4},
+      {"uv", bg3_granny_dt_half, offsetof(vertex, uv), 2},
+  };
+  size_t count = 1 << 16;
+  std::vector<vertex> vertices(count);
+  std::mt19937 rng(5678);
+  for (auto& v : vertices) {
+    for (auto& x : v.position) {
+      x = float(rng() % 1000) / 10.0f;
+    }
+    for (auto& x : v.qtangent) {
+      x = rng();
+    }
+    for (auto& x : v.bone_weights) {
+      x = rng();
+    }
+    for (auto& x : v.uv) {
+      x = 0x3000 + rng() % 0x1000;
+    }
+  }
+  std::vector<float> out(count * 4);
+  char const* simd_names[] = {"scalar", "sse41", "avx2", "neon"};
+  printf("%10s", "field");
+  for (auto simd : supported_simd_levels()) {
+    printf(" %10s", simd_names[int(simd)]);
+  }
+  printf("\n");
+  for (auto const& f : fields) {
+    printf("%10s", f.name);
+    for (auto simd : supported_simd_levels()) {
+      double shortest = 1e9;
+      for (int rep = 0; rep < 50; ++rep) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pybg3_granny_decode_floats(f.dt, (char*)vertices.data() + f.offset,
+                                   sizeof(vertex), f.components, count, out.data(),
+                                   simd);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double elapsed =
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        shortest = std::min(shortest, elapsed);
+      }
+      printf(" %10.1f", count * f.components * sizeof(float) / shortest / 1e6);
+    }
+    printf("\n");
+  }
+}
@@ -0,0 +1,197 @@
+#include "pybg3_lspk_index.h"
+
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include "xxhash.h"
+
+static const char pybg3_lspk_index_magic[8] = {'P', 'B', 'G', '3', 'L', 'I', 'X', '1'};
+
+static uint64_t pybg3_lspk_index_hash(std::string_view name) {
+  return XXH3_64bits(name.data(), name.size());
+}
+
+pybg3_lspk_index::pybg3_lspk_index(std::vector<std::string_view> names)
+    : names(std::move(names)) {
+  // At most half full, so probe sequences stay short.
+  slots.resize(std::bit_ceil(std::max<size_t>(this->names.size() * 2, 16)));
+  size_t mask = slots.size() - 1;
+  for (uint32_t i = 0; i < this->names.size(); ++i) {
+    uint64_t hash = pybg3_lspk_index_hash(this->names[i]);
+    uint32_t tag = hash >> 32;
+    for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+      slot& s = slots[pos];
+      if (!s.entry) {
+        s = {tag, i + 1};
+        break;
+      }
+      if (s.tag == tag && this->names[s.entry - 1] == this->names[i]) {
+        s.entry = i + 1;
+        break;
+      }
+    }
+  }
+  sorted.resize(this->names.size());
+  for (uint32_t i = 0; i < sorted.size(); ++i) {
+    sorted[i] = i;
+  }
+  std::stable_sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b) {
+    return this->names[a] < this->names[b];
+  });
+}
+
+std::optional<uint32_t> pybg3_lspk_index::find(std::string_view name) const {
+  size_t mask = slots.size() - 1;
+  uint64_t hash = pybg3_lspk_index_hash(name);
+  uint32_t tag = hash >> 32;
+  for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+    slot const& s = slots[pos];
+    if (!s.entry) {
+      return std::nullopt;
+    }
+    if (s.tag == tag && names[s.entry - 1] == name) {
+      return s.entry - 1;
+    }
+  }
+}
+
+std::vector<uint32_t> pybg3_lspk_index::with_prefix(std::string_view prefix) const {
+  auto begin = std::lower_bound(sorted.begin(), sorted.end(), prefix,
+                                [&](uint32_t entry, std::string_view prefix) {
+                                  return names[entry] < prefix;
+                                });
+  auto end = std::find_if(begin, sorted.end(), [&](uint32_t entry) {
+    return !names[entry].starts_with(prefix);
+  });
+  return std::vector<uint32_t>(begin, end);
+}
+
+std::vector<uint32_t> pybg3_lspk_index::glob(std::string const& pattern) const {
+  // Only names starting with the pattern's literal prefix can match.
+  size_t literal_len = pattern.find_first_of("*?[\\");
+  std::vector<uint32_t> candidates =
+      with_prefix(std::string_view(pattern).substr(0, literal_len));
+  std::vector<uint32_t> matches;
+  std::string name;
+  for (uint32_t entry : candidates) {
+    name.assign(names[entry]);
+    if (!fnmatch(pattern.c_str(), name.c_str(), 0)) {
+      matches.push_back(entry);
+    }
+  }
+  return matches;
+}
+
+// The saved layout is the magic, the stamp, the slot count, then the slots and the
+// sorted entries, all in native byte order. It's only ever read back on the machine that
+// wrote it.
+struct pybg3_lspk_index_header {
+  char magic[8];
+  pybg3_lspk_index::pak_stamp stamp;
+  uint64_t num_slots;
+};
+
+bool pybg3_lspk_index::save(std::string const& path, pak_stamp stamp) const {
+  // Written under a temporary name and renamed into place, so that readers never see a
+  // partial index.
+  std::string tmp_path = path + ".tmp";
+  FILE* fp = fopen(tmp_path.c_str(), "wb");
+  if (!fp) {
+    return false;
+  }
+  pybg3_lspk_index_header header{};
+  memcpy(header.magic, pybg3_lspk_index_magic, sizeof(header.magic));
+  header.stamp = stamp;
+  header.num_slots = slots.size();
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+            fwrite(slots.data(), sizeof(slot), slots.size(), fp) == slots.size() &&
+            fwrite(sorted.data(), sizeof(uint32_t), sorted.size(), fp) == sorted.size();
+  ok = !fclose(fp) && ok;
+  if (!ok || rename(tmp_path.c_str(), path.c_str())) {
+    remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::optional<pybg3_lspk_index> pybg3_lspk_index::load(
+    std::string const& path,
+    std::vector<std::string_view> names,
+    pak_stamp stamp) {
+  std::unique_ptr<FILE, int (*)(FILE*)> fp(fopen(path.c_str(), "rb"), fclose);
+  if (!fp) {
+    return std::nullopt;
+  }
+  pybg3_lspk_index_header header;
+  if (fread(&header, sizeof(header), 1, fp.get()) != 1 ||
+      memcmp(header.magic, pybg3_lspk_index_magic, sizeof(header.magic)) ||
+      !(header.stamp == stamp) || stamp.num_entries != names.size() ||
+      !std::has_single_bit(header.num_slots) || header.num_slots < names.size() + 1) {
+    return std::nullopt;
+  }
+  // The tables must fill the rest of the file exactly. That's checked before anything
+  // is allocated, so that a corrupt slot count can't ask for more than the file holds.
+  struct stat st;
+  uint64_t sorted_size = names.size() * sizeof(uint32_t);
+  if (fstat(fileno(fp.get()), &st) ||
+      uint64_t(st.st_size) < sizeof(header) + sorted_size) {
+    return std::nullopt;
+  }
+  uint64_t slots_size = st.st_size - sizeof(header) - sorted_size;
+  if (slots_size % sizeof(slot) || slots_size / sizeof(slot) != header.num_slots) {
+    return std::nullopt;
+  }
+  pybg3_lspk_index index;
+  index.names = std::move(names);
+  index.slots.resize(header.num_slots);
+  index.sorted.resize(index.names.size());
+  if (fread(index.slots.data(), sizeof(slot), index.slots.size(), fp.get()) !=
+          index.slots.size() ||
+      fread(index.sorted.data(), sizeof(uint32_t), index.sorted.size(), fp.get()) !=
+          index.sorted.size()) {
+    return std::nullopt;
+  }
+  // The table is trusted from here on, so make sure it can't index out of bounds and
+  // that every probe ends: there's an empty slot, each entry sits in one slot, and each
+  // slot is reachable from its hash without crossing an empty slot. Walking the table
+  // from an empty slot, that means an entry's home is within the current run.
+  size_t mask = index.slots.size() - 1;
+  size_t start = 0;
+  while (start < index.slots.size() && index.slots[start].entry) {
+    ++start;
+  }
+  if (start == index.slots.size()) {
+    return std::nullopt;
+  }
+  std::vector<bool> seen(index.names.size());
+  size_t run_start = (start + 1) & mask;
+  for (size_t i = 1; i <= mask; ++i) {
+    size_t pos = (start + i) & mask;
+    slot const& s = index.slots[pos];
+    if (!s.entry) {
+      run_start = (pos + 1) & mask;
+      continue;
+    }
+    if (s.entry > index.names.size() || seen[s.entry - 1]) {
+      return std::nullopt;
+    }
+    seen[s.entry - 1] = true;
+    uint64_t hash = pybg3_lspk_index_hash(index.names[s.entry - 1]);
+    if (s.tag != uint32_t(hash >> 32) ||
+        ((pos - hash) & mask) > ((pos - run_start) & mask)) {
+      return std::nullopt;
+    }
+  }
+  for (uint32_t entry : index.sorted) {
+    if (entry >= index.names.size()) {
+      return std::nullopt;
+    }
+  }
+  return index;
+}
@@ -0,0 +1,73 @@
+// pybg3
+//
+// Copyright (C) 2024 Mackenzie Straight.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A name lookup index over the entries of an LSPK manifest: an open-addressing hash
+// table for exact lookups, and the entries in name order for prefix and glob queries.
+// names[i] is entry i's name; the index refers to them but doesn't own them.
+//
+// The index can be saved next to the pak and loaded again later, which skips sorting
+// the names. Loading still hashes every name, to check that the saved table is sound.
+// A saved index is only used if it was built for a pak of the same size, modification
+// time and number of entries.
+struct pybg3_lspk_index {
+  struct slot {
+    // The upper half of the name's hash, so that most mismatches skip the name compare.
+    uint32_t tag;
+    // The entry index plus one, or 0 for an empty slot.
+    uint32_t entry;
+  };
+  // Identifies the pak file a saved index belongs to.
+  struct pak_stamp {
+    uint64_t size;
+    int64_t mtime;
+    uint64_t num_entries;
+    bool operator==(pak_stamp const&) const = default;
+  };
+  explicit pybg3_lspk_index(std::vector<std::string_view> names);
+  // Returns nothing if there's no usable index at path.
+  static std::optional<pybg3_lspk_index> load(std::string const& path,
+                                              std::vector<std::string_view> names,
+                                              pak_stamp stamp);
+  // Returns false if the index couldn't be written.
+  bool save(std::string const& path, pak_stamp stamp) const;
+  // If several entries have the same name, the last one wins.
+  std::optional<uint32_t> find(std::string_view name) const;
+  // Entries whose names start with prefix, in name order.
+  std::vector<uint32_t> with_prefix(std::string_view prefix) const;
+  // Entries whose names match an fnmatch(3) pattern, in name order. '*' matches across
+  // '/', as in Python's fnmatch.
+  std::vector<uint32_t> glob(std::string const& pattern) const;
+  std::vector<std::string_view> names;
+  std::vector<slot> slots;
+  std::vector<uint32_t> sorted;
+
+ private:
+  pybg3_lspk_index() = default;
+};
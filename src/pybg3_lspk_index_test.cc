@@ -0,0 +1,218 @@
+// pybg3
+//
+// Copyright (C) 2024 Mackenzie Straight.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "pybg3_lspk_index.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+static std::vector<std::string_view> views(std::vector<std::string> const& names) {
+  return std::vector<std::string_view>(names.begin(), names.end());
+}
+
+static std::vector<std::string> names_of(std::vector<std::string> const& names,
+                                         std::vector<uint32_t> const& entries) {
+  std::vector<std::string> result;
+  for (uint32_t entry : entries) {
+    result.push_back(names[entry]);
+  }
+  return result;
+}
+
+static std::vector<std::string> make_names() {
+  return {
+      "Public/Shared/Assets/Characters/Humans/HUM_M.GR2",
+      "Public/Shared/Assets/Characters/Humans/HUM_F.GR2",
+      "Public/Shared/Content/Assets/Characters/[PAK]_Humans/_merged.lsf",
+      "Mods/Shared/meta.lsx",
+      "Public/Shared/Assets/Characters/Elves/ELF_M.GR2",
+      "Localization/English/english.loca",
+  };
+}
+
+TEST(PyBg3LspkIndex, Find) {
+  std::vector<std::string> names = make_names();
+  pybg3_lspk_index index(views(names));
+  for (uint32_t i = 0; i < names.size(); ++i) {
+    EXPECT_EQ(index.find(names[i]), i);
+  }
+  EXPECT_EQ(index.find("Mods/Shared/meta.ls"), std::nullopt);
+  EXPECT_EQ(index.find(""), std::nullopt);
+  pybg3_lspk_index empty(std::vector<std::string_view>{});
+  EXPECT_EQ(empty.find("Mods/Shared/meta.lsx"), std::nullopt);
+  EXPECT_TRUE(empty.glob("*").empty());
+}
+
+TEST(PyBg3LspkIndex, FindMany) {
+  std::vector<std::string> names;
+  for (int i = 0; i < 100000; ++i) {
+    names.push_back("Generated/" + std::to_string(i) + ".lsf");
+  }
+  pybg3_lspk_index index(views(names));
+  for (uint32_t i = 0; i < names.size(); ++i) {
+    ASSERT_EQ(index.find(names[i]), i);
+  }
+  EXPECT_EQ(index.find("Generated/100000.lsf"), std::nullopt);
+}
+
+TEST(PyBg3LspkIndex, DuplicateNames) {
+  std::vector<std::string> names = {"a.lsx", "b.lsx", "a.lsx"};
+  pybg3_lspk_index index(views(names));
+  EXPECT_EQ(index.find("a.lsx"), 2u);
+  EXPECT_EQ(index.find("b.lsx"), 1u);
+}
+
+TEST(PyBg3LspkIndex, Prefix) {
+  std::vector<std::string> names = make_names();
+  pybg3_lspk_index index(views(names));
+  EXPECT_EQ(names_of(names, index.with_prefix("Public/Shared/Assets/Characters/")),
+            (std::vector<std::string>{
+                "Public/Shared/Assets/Characters/Elves/ELF_M.GR2",
+                "Public/Shared/Assets/Characters/Humans/HUM_F.GR2",
+                "Public/Shared/Assets/Characters/Humans/HUM_M.GR2",
+            }));
+  EXPECT_EQ(index.with_prefix("").size(), names.size());
+  EXPECT_TRUE(index.with_prefix("Public/Shared/Assets/Characters/Dwarves").empty());
+  EXPECT_TRUE(index.with_prefix("ZZZ").empty());
+}
+
+TEST(PyBg3LspkIndex, Glob) {
+  std::vector<std::string> names = make_names();
+  pybg3_lspk_index index(views(names));
+  EXPECT_EQ(names_of(names, index.glob("*.GR2")),
+            (std::vector<std::string>{
+                "Public/Shared/Assets/Characters/Elves/ELF_M.GR2",
+                "Public/Shared/Assets/Characters/Humans/HUM_F.GR2",
+                "Public/Shared/Assets/Characters/Humans/HUM_M.GR2",
+            }));
+  EXPECT_EQ(names_of(names, index.glob("Public/Shared/Assets/Characters/*/HUM_?.GR2")),
+            (std::vector<std::string>{
+                "Public/Shared/Assets/Characters/Humans/HUM_F.GR2",
+                "Public/Shared/Assets/Characters/Humans/HUM_M.GR2",
+            }));
+  EXPECT_EQ(names_of(names, index.glob("Public/Shared/Content/*/[[]PAK]_*/*.lsf")),
+            (std::vector<std::string>{
+                "Public/Shared/Content/Assets/Characters/[PAK]_Humans/_merged.lsf",
+            }));
+  EXPECT_EQ(names_of(names, index.glob("Mods/Shared/meta.lsx")),
+            (std::vector<std::string>{"Mods/Shared/meta.lsx"}));
+  EXPECT_TRUE(index.glob("*.lsj").empty());
+}
+
+TEST(PyBg3LspkIndex, SaveLoad) {
+  std::vector<std::string> names = make_names();
+  pybg3_lspk_index index(views(names));
+  std::string path =
+      (std::filesystem::temp_directory_path() / "pybg3_lspk_index_test.idx").string();
+  pybg3_lspk_index::pak_stamp stamp{123456, 7890, names.size()};
+  ASSERT_TRUE(index.save(path, stamp));
+  std::optional<pybg3_lspk_index> loaded =
+      pybg3_lspk_index::load(path, views(names), stamp);
+  ASSERT_TRUE(loaded);
+  EXPECT_EQ(loaded->slots.size(), index.slots.size());
+  EXPECT_EQ(loaded->sorted, index.sorted);
+  for (uint32_t i = 0; i < names.size(); ++i) {
+    EXPECT_EQ(loaded->find(names[i]), i);
+  }
+  EXPECT_EQ(loaded->glob("*.GR2").size(), 3u);
+  pybg3_lspk_index::pak_stamp modified = stamp;
+  modified.mtime++;
+  EXPECT_FALSE(pybg3_lspk_index::load(path, views(names), modified));
+  names.pop_back();
+  EXPECT_FALSE(pybg3_lspk_index::load(path, views(names), stamp));
+  EXPECT_FALSE(pybg3_lspk_index::load(path + ".missing", views(names), stamp));
+  FILE* fp = fopen(path.c_str(), "r+b");
+  ASSERT_TRUE(fp);
+  fputc('X', fp);
+  fclose(fp);
+  EXPECT_FALSE(pybg3_lspk_index::load(path, views(make_names()), stamp));
+  std::filesystem::remove(path);
+}
+
+TEST(PyBg3LspkIndex, LoadRejectsCorruptSlots) {
+  std::vector<std::string> names = make_names();
+  pybg3_lspk_index index(views(names));
+  std::string path =
+      (std::filesystem::temp_directory_path() / "pybg3_lspk_index_slots.idx").string();
+  pybg3_lspk_index::pak_stamp stamp{123456, 7890, names.size()};
+  // The slots follow the magic, the stamp and the slot count.
+  long slots_offset = 8 + sizeof(stamp) + 8;
+  auto save_with_slots = [&](std::vector<pybg3_lspk_index::slot> const& slots) {
+    ASSERT_TRUE(index.save(path, stamp));
+    FILE* fp = fopen(path.c_str(), "r+b");
+    ASSERT_TRUE(fp);
+    fseek(fp, slots_offset, SEEK_SET);
+    fwrite(slots.data(), sizeof(slots[0]), slots.size(), fp);
+    fclose(fp);
+  };
+  std::vector<pybg3_lspk_index::slot> slots = index.slots;
+  auto used = std::find_if(slots.begin(), slots.end(), [](auto s) { return s.entry; });
+  // No empty slot, so a miss would probe forever.
+  save_with_slots(std::vector<pybg3_lspk_index::slot>(slots.size(), *used));
+  EXPECT_FALSE(pybg3_lspk_index::load(path, views(names), stamp));
+  // An entry in two slots.
+  auto empty = std::find_if(slots.begin(), slots.end(), [](auto s) { return !s.entry; });
+  *empty = *used;
+  save_with_slots(slots);
+  EXPECT_FALSE(pybg3_lspk_index::load(path, views(names), stamp));
+  // An entry moved to where its probe can't reach it.
+  slots = index.slots;
+  used = std::find_if(slots.begin(), slots.end(), [](auto s) { return s.entry; });
+  size_t from = used - slots.begin();
+  size_t to = (from + slots.size() / 2) & (slots.size() - 1);
+  while (slots[to].entry || !slots[(to + slots.size() - 1) & (slots.size() - 1)].entry) {
+    to = (to + 1) & (slots.size() - 1);
+  }
+  std::swap(slots[from], slots[to]);
+  save_with_slots(slots);
+  EXPECT_FALSE(pybg3_lspk_index::load(path, views(names), stamp));
+  save_with_slots(index.slots);
+  EXPECT_TRUE(pybg3_lspk_index::load(path, views(names), stamp));
+  std::filesystem::remove(path);
+}
+
+TEST(PyBg3LspkIndex, LoadRejectsBadSizes) {
+  std::vector<std::string> names = make_names();
+  pybg3_lspk_index index(views(names));
+  std::string path =
+      (std::filesystem::temp_directory_path() / "pybg3_lspk_index_sizes.idx").string();
+  pybg3_lspk_index::pak_stamp stamp{123456, 7890, names.size()};
+  // A slot count far bigger than the file must not be allocated.
+  ASSERT_TRUE(index.save(path, stamp));
+  FILE* fp = fopen(path.c_str(), "r+b");
+  ASSERT_TRUE(fp);
+  uint64_t num_slots = uint64_t(1) << 61;
+  fseek(fp, 8 + sizeof(stamp), SEEK_SET);
+  fwrite(&num_slots, sizeof(num_slots), 1, fp);
+  fclose(fp);
+  EXPECT_FALSE(pybg3_lspk_index::load(path, views(names), stamp));
+  // Nor a truncated file.
+  ASSERT_TRUE(index.save(path, stamp));
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 4);
+  EXPECT_FALSE(pybg3_lspk_index::load(path, views(names), stamp));
+  std::filesystem::remove(path);
+}
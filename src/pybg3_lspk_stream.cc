@@ -0,0 +1,267 @@
+#include "pybg3_lspk_stream.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "libbg3.h"
+#include "lz4frame.h"
+#include "miniz.h"
+
+// LZ4 matches reach back at most this far.
+static constexpr size_t pybg3_lz4_window = 64 * 1024;
+static constexpr uint32_t pybg3_lz4_frame_magic = 0x184d2204;
+
+// Decodes a raw LZ4 block into a buffer that holds one output chunk plus the match
+// window. Whenever the buffer fills up, the new output goes to the sink and the last
+// window's worth is moved to the front to serve later matches.
+static bool pybg3_lz4_block_stream(std::string_view stored,
+                                   size_t uncompressed_size,
+                                   pybg3_lspk_stream_sink const& sink) {
+  uint8_t const* ip = (uint8_t const*)stored.data();
+  uint8_t const* iend = ip + stored.size();
+  size_t buffer_size = pybg3_lspk_stream_chunk + pybg3_lz4_window;
+  std::unique_ptr<char[]> buffer(new char[buffer_size]);
+  char* buf = buffer.get();
+  // Output starts after the window, as it does once the buffer has wrapped, so that
+  // every flush is at most a chunk.
+  size_t pos = pybg3_lz4_window, flushed = pybg3_lz4_window;
+  uint64_t total = 0;
+  auto flush = [&] {
+    if (pos > flushed) {
+      sink(std::string_view(buf + flushed, pos - flushed));
+    }
+    flushed = pos;
+  };
+  auto make_room = [&] {
+    if (pos == buffer_size) {
+      flush();
+      memmove(buf, buf + buffer_size - pybg3_lz4_window, pybg3_lz4_window);
+      pos = flushed = pybg3_lz4_window;
+    }
+  };
+  auto read_length = [&](size_t& length) {
+    if (length != 15) {
+      return true;
+    }
+    for (;;) {
+      if (ip == iend) {
+        return false;
+      }
+      uint8_t b = *ip++;
+      length += b;
+      if (b != 255) {
+        return true;
+      }
+    }
+  };
+  while (ip < iend) {
+    uint8_t token = *ip++;
+    size_t literals = token >> 4;
+    if (!read_length(literals) || size_t(iend - ip) < literals ||
+        uncompressed_size - total < literals) {
+      return false;
+    }
+    total += literals;
+    while (literals) {
+      size_t n = std::min(literals, buffer_size - pos);
+      memcpy(buf + pos, ip, n);
+      ip += n;
+      pos += n;
+      literals -= n;
+      make_room();
+    }
+    if (ip == iend) {
+      break;
+    }
+    if (iend - ip < 2) {
+      return false;
+    }
+    size_t offset = ip[0] | ip[1] << 8;
+    ip += 2;
+    size_t match = token & 15;
+    if (!offset || offset > total || !read_length(match)) {
+      return false;
+    }
+    match += 4;
+    if (uncompressed_size - total < match) {
+      return false;
+    }
+    total += match;
+    // Copies no more than offset bytes at a time so that the source and destination
+    // never overlap. Short offsets repeat the same few bytes.
+    while (match) {
+      size_t n = std::min({match, offset, buffer_size - pos});
+      memcpy(buf + pos, buf + pos - offset, n);
+      pos += n;
+      match -= n;
+      make_room();
+    }
+  }
+  flush();
+  return total == uncompressed_size;
+}
+
+static bool pybg3_lz4_frame_stream(std::string_view stored,
+                                   size_t uncompressed_size,
+                                   pybg3_lspk_stream_sink const& sink) {
+  LZ4F_dctx* dctx;
+  if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) {
+    return false;
+  }
+  std::unique_ptr<LZ4F_dctx, decltype(&LZ4F_freeDecompressionContext)> guard(
+      dctx, LZ4F_freeDecompressionContext);
+  std::unique_ptr<char[]> out(new char[pybg3_lspk_stream_chunk]);
+  char const* ip = stored.data();
+  size_t remaining = stored.size();
+  uint64_t total = 0;
+  for (;;) {
+    size_t out_size = pybg3_lspk_stream_chunk;
+    size_t in_size = remaining;
+    size_t hint = LZ4F_decompress(dctx, out.get(), &out_size, ip, &in_size, nullptr);
+    if (LZ4F_isError(hint) || uncompressed_size - total < out_size) {
+      return false;
+    }
+    ip += in_size;
+    remaining -= in_size;
+    total += out_size;
+    if (out_size) {
+      sink(std::string_view(out.get(), out_size));
+    }
+    if (!hint) {
+      break;
+    }
+    if (!in_size && !out_size) {
+      // Truncated: the frame isn't finished but there's nothing left to feed it.
+      return false;
+    }
+  }
+  return total == uncompressed_size;
+}
+
+static bool pybg3_zlib_stream(std::string_view stored,
+                              size_t uncompressed_size,
+                              pybg3_lspk_stream_sink const& sink) {
+  mz_stream stream{};
+  if (mz_inflateInit(&stream) != MZ_OK) {
+    return false;
+  }
+  std::unique_ptr<mz_stream, decltype(&mz_inflateEnd)> guard(&stream, mz_inflateEnd);
+  std::unique_ptr<char[]> out(new char[pybg3_lspk_stream_chunk]);
+  stream.next_in = (unsigned char const*)stored.data();
+  stream.avail_in = stored.size();
+  uint64_t total = 0;
+  for (;;) {
+    stream.next_out = (unsigned char*)out.get();
+    stream.avail_out = pybg3_lspk_stream_chunk;
+    int status = mz_inflate(&stream, MZ_NO_FLUSH);
+    if (status != MZ_OK && status != MZ_STREAM_END) {
+      return false;
+    }
+    size_t n = pybg3_lspk_stream_chunk - stream.avail_out;
+    if (uncompressed_size - total < n) {
+      return false;
+    }
+    total += n;
+    if (n) {
+      sink(std::string_view(out.get(), n));
+    }
+    if (status == MZ_STREAM_END) {
+      break;
+    }
+    if (!n && !stream.avail_in) {
+      return false;
+    }
+  }
+  return total == uncompressed_size;
+}
+
+bool pybg3_lspk_stream_decode(unsigned method,
+                              std::string_view stored,
+                              size_t uncompressed_size,
+                              pybg3_lspk_stream_sink const& sink) {
+  switch (method) {
+    case LIBBG3_LSPK_ENTRY_COMPRESSION_NONE:
+      for (size_t i = 0; i < stored.size(); i += pybg3_lspk_stream_chunk) {
+        sink(stored.substr(i, pybg3_lspk_stream_chunk));
+      }
+      return true;
+    case LIBBG3_LSPK_ENTRY_COMPRESSION_ZLIB:
+      return pybg3_zlib_stream(stored, uncompressed_size, sink);
+    case LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4: {
+      uint32_t magic = 0;
+      if (stored.size() >= sizeof(magic)) {
+        memcpy(&magic, stored.data(), sizeof(magic));
+      }
+      if (magic == pybg3_lz4_frame_magic) {
+        return pybg3_lz4_frame_stream(stored, uncompressed_size, sink);
+      }
+      return pybg3_lz4_block_stream(stored, uncompressed_size, sink);
+    }
+    default:
+      return false;
+  }
+}
+
+pybg3_fd_writer::pybg3_fd_writer(int fd, size_t buffer_size) : fd(fd) {
+  capacity = std::max<size_t>(buffer_size, 4096) & ~size_t(4095);
+  buffer = (char*)std::aligned_alloc(4096, capacity);
+  if (!buffer) {
+    throw std::bad_alloc();
+  }
+}
+
+pybg3_fd_writer::~pybg3_fd_writer() {
+  std::free(buffer);
+}
+
+void pybg3_fd_writer::write(std::string_view data) {
+  while (!failed && !data.empty()) {
+    if (!used && data.size() >= capacity) {
+      // Nothing buffered, so whole buffers' worth can go straight from the source.
+      size_t n = data.size() - data.size() % capacity;
+      failed = !write_fully(data.data(), n);
+      total += n;
+      data.remove_prefix(n);
+      continue;
+    }
+    size_t n = std::min(data.size(), capacity - used);
+    memcpy(buffer + used, data.data(), n);
+    used += n;
+    total += n;
+    data.remove_prefix(n);
+    if (used == capacity) {
+      failed = !write_fully(buffer, used);
+      used = 0;
+    }
+  }
+}
+
+bool pybg3_fd_writer::flush() {
+  if (!failed && used) {
+    failed = !write_fully(buffer, used);
+  }
+  used = 0;
+  return !failed;
+}
+
+bool pybg3_fd_writer::write_fully(char const* data, size_t size) {
+  while (size) {
+    ssize_t n = ::write(fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      write_errno = errno;
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
@@ -0,0 +1,72 @@
+// pybg3
+//
+// Copyright (C) 2024 Mackenzie Straight.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+// Incremental decompression of pak entries, for files too big to comfortably extract
+// into memory. The compressed input is read in place, normally from the mapped pak, and
+// the output is passed to a sink in pieces of at most pybg3_lspk_stream_chunk bytes.
+using pybg3_lspk_stream_sink = std::function<void(std::string_view)>;
+
+inline constexpr size_t pybg3_lspk_stream_chunk = 1 << 20;
+
+// Decodes an entry stored with the given LIBBG3_LSPK_ENTRY_COMPRESSION_* method. LZ4
+// entries may be either a single raw block, as the game writes them, or an LZ4 frame.
+// Returns false if the data is corrupt, doesn't decode to exactly uncompressed_size
+// bytes, or uses a method that can't be streamed, in which case some output may
+// already have gone to the sink.
+bool pybg3_lspk_stream_decode(unsigned method,
+                              std::string_view stored,
+                              size_t uncompressed_size,
+                              pybg3_lspk_stream_sink const& sink);
+
+// Buffered writes to a file descriptor. Output is collected in a page-aligned buffer and
+// written out a full buffer at a time, so the kernel sees a few large aligned writes
+// rather than many small ones. The descriptor isn't closed.
+struct pybg3_fd_writer {
+  explicit pybg3_fd_writer(int fd, size_t buffer_size = 4 * pybg3_lspk_stream_chunk);
+  ~pybg3_fd_writer();
+  pybg3_fd_writer(pybg3_fd_writer const&) = delete;
+  pybg3_fd_writer& operator=(pybg3_fd_writer const&) = delete;
+  // Once a write fails, later writes are dropped and ok() stays false.
+  void write(std::string_view data);
+  bool flush();
+  bool ok() const { return !failed; }
+  // The errno of the write that failed, if one did.
+  int error() const { return write_errno; }
+  uint64_t bytes_written() const { return total; }
+
+ private:
+  bool write_fully(char const* data, size_t size);
+  int fd;
+  char* buffer;
+  size_t capacity;
+  size_t used{0};
+  uint64_t total{0};
+  bool failed{false};
+  int write_errno{0};
+};
@@ -0,0 +1,166 @@
+// pybg3
+//
+// Copyright (C) 2024 Mackenzie Straight.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "pybg3_lspk_stream.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "libbg3.h"
+#include "lz4.h"
+#include "lz4frame.h"
+#include "miniz.h"
+
+// Compressible data several chunks long, with long runs, short repeats and matches
+// reaching back across chunk boundaries.
+static std::string make_data(size_t size) {
+  std::mt19937 rng(1234);
+  std::string data;
+  data.reserve(size);
+  while (data.size() < size) {
+    switch (rng() % 4) {
+      case 0:
+        data.append(rng() % 5000, char(rng()));
+        break;
+      case 1:
+        for (int i = rng() % 200; i; --i) {
+          data.push_back(char(rng()));
+        }
+        break;
+      default:
+        if (data.size() > 70000) {
+          size_t start = data.size() - 1 - rng() % 65000;
+          data.append(data, start, rng() % 3000);
+        }
+        break;
+    }
+  }
+  data.resize(size);
+  return data;
+}
+
+static bool decode(unsigned method,
+                   std::string const& stored,
+                   size_t size,
+                   std::string& out) {
+  out.clear();
+  return pybg3_lspk_stream_decode(method, stored, size, [&](std::string_view chunk) {
+    EXPECT_LE(chunk.size(), pybg3_lspk_stream_chunk);
+    out.append(chunk);
+  });
+}
+
+static std::string lz4_block(std::string const& data) {
+  std::string stored(LZ4_compressBound(data.size()), 0);
+  stored.resize(
+      LZ4_compress_default(data.data(), stored.data(), data.size(), stored.size()));
+  return stored;
+}
+
+TEST(PyBg3LspkStream, Stored) {
+  std::string data = make_data(3 * pybg3_lspk_stream_chunk + 17), out;
+  ASSERT_TRUE(decode(LIBBG3_LSPK_ENTRY_COMPRESSION_NONE, data, data.size(), out));
+  EXPECT_EQ(out, data);
+}
+
+TEST(PyBg3LspkStream, Lz4Block) {
+  std::vector<size_t> sizes = {0, 1, 100000, 5 * pybg3_lspk_stream_chunk};
+  for (size_t size : sizes) {
+    std::string data = make_data(size), out;
+    std::string stored = lz4_block(data);
+    ASSERT_TRUE(decode(LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4, stored, size, out)) << size;
+    EXPECT_TRUE(out == data) << size;
+  }
+}
+
+TEST(PyBg3LspkStream, Lz4BlockCorrupt) {
+  std::string data = make_data(200000), out;
+  std::string stored = lz4_block(data);
+  EXPECT_FALSE(decode(LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4, stored, data.size() - 1, out));
+  EXPECT_FALSE(decode(LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4, stored, data.size() + 1, out));
+  std::string truncated = stored.substr(0, stored.size() / 2);
+  EXPECT_FALSE(decode(LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4, truncated, data.size(), out));
+  // A match reaching back before the start of the output.
+  std::string bad = {char(0x10), 'a', char(0x05), char(0x00)};
+  EXPECT_FALSE(decode(LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4, bad, 6, out));
+  std::string good = {char(0x10), 'a', char(0x01), char(0x00), char(0x10), 'b'};
+  ASSERT_TRUE(decode(LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4, good, 6, out));
+  EXPECT_EQ(out, "aaaaab");
+}
+
+TEST(PyBg3LspkStream, Lz4Frame) {
+  std::string data = make_data(3 * pybg3_lspk_stream_chunk + 5), out;
+  std::string stored(LZ4F_compressFrameBound(data.size(), nullptr), 0);
+  size_t size =
+      LZ4F_compressFrame(stored.data(), stored.size(), data.data(), data.size(), nullptr);
+  ASSERT_FALSE(LZ4F_isError(size));
+  stored.resize(size);
+  ASSERT_TRUE(decode(LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4, stored, data.size(), out));
+  EXPECT_TRUE(out == data);
+  std::string truncated = stored.substr(0, stored.size() - 8);
+  EXPECT_FALSE(decode(LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4, truncated, data.size(), out));
+}
+
+TEST(PyBg3LspkStream, Zlib) {
+  std::string data = make_data(3 * pybg3_lspk_stream_chunk + 5), out;
+  mz_ulong size = mz_compressBound(data.size());
+  std::string stored(size, 0);
+  ASSERT_EQ(mz_compress2((unsigned char*)stored.data(), &size,
+                         (unsigned char const*)data.data(), data.size(), 6),
+            MZ_OK);
+  stored.resize(size);
+  ASSERT_TRUE(decode(LIBBG3_LSPK_ENTRY_COMPRESSION_ZLIB, stored, data.size(), out));
+  EXPECT_TRUE(out == data);
+  EXPECT_FALSE(decode(LIBBG3_LSPK_ENTRY_COMPRESSION_ZLIB, stored.substr(0, size / 2),
+                      data.size(), out));
+  EXPECT_FALSE(decode(LIBBG3_LSPK_ENTRY_COMPRESSION_ZLIB, stored, data.size() - 1, out));
+  EXPECT_FALSE(decode(LIBBG3_LSPK_ENTRY_COMPRESSION_ZSTD, stored, data.size(), out));
+}
+
+TEST(PyBg3LspkStream, FdWriter) {
+  FILE* fp = tmpfile();
+  ASSERT_TRUE(fp);
+  std::string data = make_data(100000);
+  {
+    pybg3_fd_writer writer(fileno(fp), 8192);
+    writer.write(std::string_view(data).substr(0, 10));
+    writer.write(std::string_view(data).substr(10, 50000));
+    writer.write(std::string_view(data).substr(50010));
+    ASSERT_TRUE(writer.flush());
+    EXPECT_EQ(writer.bytes_written(), data.size());
+  }
+  std::string read(data.size() + 1, 0);
+  rewind(fp);
+  EXPECT_EQ(fread(read.data(), 1, read.size(), fp), data.size());
+  read.resize(data.size());
+  EXPECT_TRUE(read == data);
+  fclose(fp);
+  pybg3_fd_writer bad(-1, 4096);
+  bad.write("x");
+  EXPECT_FALSE(bad.flush());
+  EXPECT_FALSE(bad.ok());
+}
@@ -0,0 +1,429 @@
+#include "pybg3_lspk_writer.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include "libbg3.h"
+#include "lz4.h"
+#include "miniz.h"
+#include "pybg3_lspk_stream.h"
+#include "pybg3_parallel.h"
+
+static constexpr uint32_t pybg3_lspk_magic = 0x4b50534c;  // "LSPK"
+static constexpr uint32_t pybg3_lspk_version = 18;
+// The magic, then version, manifest offset and size, flags, priority, md5 and part count.
+static constexpr size_t pybg3_lspk_header_size = 4 + 4 + 8 + 4 + 1 + 1 + 16 + 2;
+static constexpr size_t pybg3_lspk_alignment = 64;
+// The level bits of an entry's compression flags, which readers don't need but which
+// record how hard the compressor tried.
+static constexpr uint8_t pybg3_lspk_level_fast = 0x10;
+static constexpr uint8_t pybg3_lspk_level_default = 0x20;
+static constexpr uint8_t pybg3_lspk_level_max = 0x40;
+
+std::string pybg3_lspk_part_path(std::string const& path, size_t part) {
+  if (!part) {
+    return path;
+  }
+  std::filesystem::path base(path);
+  std::filesystem::path part_path = base;
+  part_path.replace_filename(base.stem().string() + "_" + std::to_string(part) +
+                             base.extension().string());
+  return part_path.string();
+}
+
+namespace {
+
+// One entry's compressed payload, waiting to be written.
+struct pybg3_lspk_job {
+  std::vector<char> input;
+  std::vector<char> output;
+  std::string_view payload;
+  uint8_t compression;
+  uint32_t uncompressed_size;
+  bool reused;
+  bool done;
+  std::exception_ptr error;
+};
+
+void pybg3_lspk_read_file(std::string const& path, std::vector<char>& data) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open " + path);
+  }
+  std::unique_ptr<int, void (*)(int*)> guard(&fd, [](int* fd) { close(*fd); });
+  struct stat st;
+  if (fstat(fd, &st)) {
+    throw std::runtime_error("Failed to stat " + path);
+  }
+  data.resize(st.st_size);
+  for (size_t pos = 0; pos < data.size();) {
+    ssize_t n = read(fd, data.data() + pos, data.size() - pos);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw std::runtime_error("Failed to read " + path);
+    }
+    pos += n;
+  }
+}
+
+// Whether an old entry decodes to exactly the new contents. Entries that can't be
+// streamed, such as zstd ones, count as changed.
+bool pybg3_lspk_unchanged(pybg3_lspk_previous const& previous, std::string_view input) {
+  unsigned method = LIBBG3_LSPK_ENTRY_COMPRESSION_METHOD(previous.compression);
+  size_t size = method == LIBBG3_LSPK_ENTRY_COMPRESSION_NONE
+                    ? previous.stored.size()
+                    : previous.uncompressed_size;
+  if (size != input.size()) {
+    return false;
+  }
+  // The decoder checks that the output is exactly size bytes, which keeps this in
+  // bounds.
+  size_t pos = 0;
+  bool same = true;
+  auto compare = [&](std::string_view chunk) {
+    same = same && !memcmp(input.data() + pos, chunk.data(), chunk.size());
+    pos += chunk.size();
+  };
+  return pybg3_lspk_stream_decode(method, previous.stored, size, compare) && same;
+}
+
+void pybg3_lspk_compress(pybg3_lspk_source const& source,
+                         pybg3_lspk_write_options const& options,
+                         pybg3_lspk_job& job) {
+  std::string_view input = source.data;
+  if (input.empty() && !source.path.empty()) {
+    pybg3_lspk_read_file(source.path, job.input);
+    input = std::string_view(job.input.data(), job.input.size());
+  }
+  if (input.size() > UINT32_MAX) {
+    throw std::runtime_error("File too large: " + source.name);
+  }
+  if (source.previous && pybg3_lspk_unchanged(*source.previous, input)) {
+    job.payload = source.previous->stored;
+    job.compression = source.previous->compression;
+    job.uncompressed_size = source.previous->uncompressed_size;
+    job.reused = true;
+    return;
+  }
+  job.payload = input;
+  job.compression = LIBBG3_LSPK_ENTRY_COMPRESSION_NONE;
+  job.uncompressed_size = 0;
+  job.reused = false;
+  if (input.empty() || options.method == LIBBG3_LSPK_ENTRY_COMPRESSION_NONE) {
+    return;
+  }
+  size_t size;
+  uint8_t level;
+  if (options.method == LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4) {
+    job.output.resize(LZ4_compressBound(input.size()));
+    int n = options.level
+                ? LZ4_compress_HC(input.data(), job.output.data(), input.size(),
+                                  job.output.size(), options.level)
+                : LZ4_compress_default(input.data(), job.output.data(), input.size(),
+                                       job.output.size());
+    if (n <= 0) {
+      throw std::runtime_error("Failed to compress " + source.name);
+    }
+    size = n;
+    level = !options.level         ? pybg3_lspk_level_fast
+            : options.level >= 12 ? pybg3_lspk_level_max
+                                  : pybg3_lspk_level_default;
+  } else if (options.method == LIBBG3_LSPK_ENTRY_COMPRESSION_ZLIB) {
+    int zlib_level = options.level ? options.level : 6;
+    mz_ulong n = mz_compressBound(input.size());
+    job.output.resize(n);
+    if (mz_compress2((unsigned char*)job.output.data(), &n,
+                     (unsigned char const*)input.data(), input.size(),
+                     zlib_level) != MZ_OK) {
+      throw std::runtime_error("Failed to compress " + source.name);
+    }
+    size = n;
+    level = zlib_level <= 1   ? pybg3_lspk_level_fast
+            : zlib_level >= 9 ? pybg3_lspk_level_max
+                              : pybg3_lspk_level_default;
+  } else {
+    throw std::runtime_error("Unsupported compression method");
+  }
+  // Data that doesn't compress is stored as is, which is also cheaper to read back.
+  if (size < input.size()) {
+    job.payload = std::string_view(job.output.data(), size);
+    job.compression = options.method | level;
+    job.uncompressed_size = input.size();
+  }
+}
+
+// The pak's main file and parts, with the position in the current one.
+struct pybg3_lspk_parts {
+  struct part {
+    int fd;
+    std::unique_ptr<pybg3_fd_writer> writer;
+  };
+  pybg3_lspk_parts(std::string const& path, uint64_t part_size)
+      : path(path), part_size(part_size) {
+    open_part();
+    static char const zeros[pybg3_lspk_header_size] = {};
+    write(std::string_view(zeros, sizeof(zeros)));
+  }
+  ~pybg3_lspk_parts() {
+    for (size_t i = 0; i < parts.size(); ++i) {
+      if (parts[i].fd >= 0) {
+        close(parts[i].fd);
+      }
+      if (!committed) {
+        unlink(temp_path(i).c_str());
+      }
+    }
+  }
+  std::string temp_path(size_t part) { return pybg3_lspk_part_path(path, part) + ".tmp"; }
+  void open_part() {
+    std::string part_path = temp_path(parts.size());
+    int fd = open(part_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to create " + part_path);
+    }
+    parts.push_back({fd, std::make_unique<pybg3_fd_writer>(fd)});
+    offset = 0;
+    entry_bytes = 0;
+  }
+  void write(std::string_view data) {
+    pybg3_fd_writer& writer = *parts.back().writer;
+    writer.write(data);
+    if (!writer.ok()) {
+      fail(parts.size() - 1);
+    }
+    offset += data.size();
+  }
+  void flush(size_t part) {
+    if (!parts[part].writer->flush()) {
+      fail(part);
+    }
+  }
+  [[noreturn]] void fail(size_t part) {
+    throw std::runtime_error("Failed to write " + pybg3_lspk_part_path(path, part));
+  }
+  // Closes every part and renames them into place, main file last, since it's the one
+  // that says how many parts there are. Then removes the parts of an old pak that had
+  // more of them, which nothing refers to any more.
+  void commit() {
+    for (size_t part = 0; part < parts.size(); ++part) {
+      if (close(std::exchange(parts[part].fd, -1))) {
+        fail(part);
+      }
+    }
+    for (size_t part = parts.size(); part--;) {
+      if (rename(temp_path(part).c_str(), pybg3_lspk_part_path(path, part).c_str())) {
+        fail(part);
+      }
+    }
+    committed = true;
+    for (size_t part = parts.size();; ++part) {
+      if (unlink(pybg3_lspk_part_path(path, part).c_str()) && errno == ENOENT) {
+        break;
+      }
+    }
+  }
+  // Where an entry of the given size goes, moving on to a new part if it doesn't fit.
+  std::pair<size_t, uint64_t> place(size_t size) {
+    if (part_size && entry_bytes && entry_bytes + size > part_size) {
+      if (parts.size() == 1) {
+        main_size = offset;
+      }
+      flush(parts.size() - 1);
+      open_part();
+    }
+    static char const padding[pybg3_lspk_alignment] = {};
+    write(std::string_view(padding, -offset % pybg3_lspk_alignment));
+    if (offset >> 48) {
+      throw std::runtime_error("Pak part too large");
+    }
+    entry_bytes += size;
+    return {parts.size() - 1, offset};
+  }
+  std::string path;
+  uint64_t part_size;
+  std::vector<part> parts;
+  uint64_t offset;
+  uint64_t entry_bytes;
+  // Where the main file's entries end, once later ones have gone to other parts.
+  uint64_t main_size{0};
+  bool committed{false};
+};
+
+// Compresses entries on worker threads into a ring of job slots, at most a couple per
+// thread ahead of the entry being written.
+struct pybg3_lspk_pipeline {
+  pybg3_lspk_pipeline(std::vector<pybg3_lspk_source> const& sources,
+                      pybg3_lspk_write_options const& options)
+      : sources(sources), options(options) {
+    int num_threads =
+        std::min<size_t>(pybg3_thread_count(options.threads), sources.size());
+    jobs.resize(2 * std::max(num_threads, 1));
+    for (int i = 0; i < num_threads; ++i) {
+      workers.emplace_back([this] { work(); });
+    }
+  }
+  ~pybg3_lspk_pipeline() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    space.notify_all();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+  // Waits for entry i to be compressed. The job stays valid until release.
+  pybg3_lspk_job& acquire(size_t i) {
+    pybg3_lspk_job& job = jobs[i % jobs.size()];
+    std::unique_lock<std::mutex> lock(mutex);
+    ready.wait(lock, [&] { return job.done; });
+    if (job.error) {
+      std::rethrow_exception(job.error);
+    }
+    return job;
+  }
+  void release(size_t i) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs[i % jobs.size()].done = false;
+      released = i + 1;
+    }
+    space.notify_all();
+  }
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      space.wait(lock, [&] {
+        return stopping || (next < sources.size() && next < released + jobs.size());
+      });
+      if (stopping) {
+        return;
+      }
+      size_t i = next++;
+      lock.unlock();
+      pybg3_lspk_job& job = jobs[i % jobs.size()];
+      try {
+        pybg3_lspk_compress(sources[i], options, job);
+      } catch (...) {
+        job.error = std::current_exception();
+      }
+      lock.lock();
+      job.done = true;
+      ready.notify_all();
+    }
+  }
+  std::vector<pybg3_lspk_source> const& sources;
+  pybg3_lspk_write_options const& options;
+  std::vector<pybg3_lspk_job> jobs;
+  std::mutex mutex;
+  std::condition_variable ready, space;
+  size_t next{0};
+  size_t released{0};
+  bool stopping{false};
+  std::vector<std::thread> workers;
+};
+
+template <typename T>
+void pybg3_lspk_put(char*& out, T value) {
+  memcpy(out, &value, sizeof(value));
+  out += sizeof(value);
+}
+
+}  // namespace
+
+pybg3_lspk_write_stats pybg3_lspk_write(std::string const& path,
+                                        std::vector<pybg3_lspk_source> const& sources,
+                                        pybg3_lspk_write_options const& options) {
+  if (sources.size() > UINT32_MAX) {
+    throw std::runtime_error("Too many files");
+  }
+  int max_level = options.method == LIBBG3_LSPK_ENTRY_COMPRESSION_ZLIB  ? 9
+                  : options.method == LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4 ? 12
+                                                                         : INT_MAX;
+  if (options.level < 0 || options.level > max_level) {
+    throw std::runtime_error("Invalid compression level " +
+                             std::to_string(options.level));
+  }
+  std::vector<bg3_lspk_manifest_entry> manifest(sources.size());
+  for (size_t i = 0; i < sources.size(); ++i) {
+    std::string const& name = sources[i].name;
+    if (name.empty() || name.size() >= sizeof(manifest[i].name)) {
+      throw std::runtime_error("Invalid file name: " + name);
+    }
+    memset(&manifest[i], 0, sizeof(manifest[i]));
+    memcpy(manifest[i].name, name.data(), name.size());
+  }
+  pybg3_lspk_parts parts(path, options.part_size);
+  pybg3_lspk_write_stats stats{};
+  {
+    pybg3_lspk_pipeline pipeline(sources, options);
+    for (size_t i = 0; i < sources.size(); ++i) {
+      pybg3_lspk_job& job = pipeline.acquire(i);
+      auto [part, offset] = parts.place(job.payload.size());
+      parts.write(job.payload);
+      bg3_lspk_manifest_entry& entry = manifest[i];
+      entry.offset_lo = uint32_t(offset);
+      entry.offset_hi = uint16_t(offset >> 32);
+      entry.part_num = part;
+      entry.compression = job.compression;
+      entry.compressed_size = job.payload.size();
+      entry.uncompressed_size = job.uncompressed_size;
+      (job.reused ? stats.reused : stats.compressed)++;
+      pipeline.release(i);
+    }
+  }
+  if (parts.parts.size() > UINT16_MAX) {
+    throw std::runtime_error("Too many parts");
+  }
+  // The manifest goes at the end of the main file, as one LZ4 block.
+  for (size_t part = 1; part < parts.parts.size(); ++part) {
+    parts.flush(part);
+  }
+  pybg3_lspk_parts::part& main = parts.parts.front();
+  uint64_t manifest_offset = parts.parts.size() == 1 ? parts.offset : parts.main_size;
+  size_t manifest_size = manifest.size() * sizeof(bg3_lspk_manifest_entry);
+  std::vector<char> compressed(8 + LZ4_compressBound(manifest_size));
+  int n = LZ4_compress_HC((char const*)manifest.data(), compressed.data() + 8,
+                          manifest_size, compressed.size() - 8, LZ4HC_CLEVEL_DEFAULT);
+  if (n <= 0) {
+    throw std::runtime_error("Failed to compress manifest");
+  }
+  char* out = compressed.data();
+  pybg3_lspk_put<uint32_t>(out, manifest.size());
+  pybg3_lspk_put<uint32_t>(out, n);
+  compressed.resize(8 + n);
+  main.writer->write(std::string_view(compressed.data(), compressed.size()));
+  parts.flush(0);
+  char header[pybg3_lspk_header_size] = {};
+  out = header;
+  pybg3_lspk_put<uint32_t>(out, pybg3_lspk_magic);
+  pybg3_lspk_put<uint32_t>(out, pybg3_lspk_version);
+  pybg3_lspk_put<uint64_t>(out, manifest_offset);
+  pybg3_lspk_put<uint32_t>(out, compressed.size());
+  pybg3_lspk_put<uint8_t>(out, 0);
+  pybg3_lspk_put<uint8_t>(out, options.priority);
+  // The MD5 is left zeroed: the game doesn't check it.
+  out += 16;
+  pybg3_lspk_put<uint16_t>(out, parts.parts.size());
+  if (pwrite(main.fd, header, sizeof(header), 0) != ssize_t(sizeof(header))) {
+    parts.fail(0);
+  }
+  parts.commit();
+  return stats;
+}
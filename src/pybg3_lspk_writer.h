@@ -0,0 +1,93 @@
+// pybg3
+//
+// Copyright (C) 2024 Mackenzie Straight.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Writes LSPK v18 paks, the format the game reads, from in-memory buffers or files on
+// disk.
+//
+// Entries are compressed on a pool of threads and written out in order as they finish,
+// with only a few entries per thread in flight, so the pak never has to fit in memory.
+// When a part grows past the part size limit, later entries go to <stem>_<n><ext> part
+// files next to the main one, and the manifest goes at the end of the main file.
+//
+// Everything is written under temporary names and renamed into place at the end, so
+// the old pak at the same path stays readable until then. That's what lets a pak be
+// repacked from itself: each entry can have the previous version of the same file,
+// and if the new contents turn out to be identical, the previous compressed bytes are
+// copied across instead of compressing them again.
+//
+// Each file is replaced atomically, but the pak as a whole isn't: the parts are
+// renamed one at a time, main file last, so a failure part way through can leave new
+// parts next to the old main file. Parts of the old pak beyond the new part count are
+// removed once the main file is in place.
+struct pybg3_lspk_previous {
+  // The entry as stored in the old pak, which must stay mapped until the pak is written.
+  std::string_view stored;
+  // Its compression flags and uncompressed_size, as in bg3_lspk_manifest_entry.
+  uint8_t compression;
+  uint32_t uncompressed_size;
+};
+
+struct pybg3_lspk_source {
+  std::string name;
+  // The entry's contents, which must stay valid until the pak is written, or if empty,
+  // the path to read them from.
+  std::string_view data;
+  std::string path;
+  std::optional<pybg3_lspk_previous> previous;
+};
+
+struct pybg3_lspk_write_options {
+  // A LIBBG3_LSPK_ENTRY_COMPRESSION_* method: none, zlib or LZ4.
+  unsigned method;
+  // For zlib, the usual 1-9, with 0 meaning 6. For LZ4, 0 selects the fast compressor
+  // and 1-12 LZ4HC at that level.
+  int level;
+  int threads;
+  // The most bytes of entry data per part before starting a new one, or 0 for no limit.
+  // Entries are never split, so a single bigger entry still gets a part of its own.
+  uint64_t part_size;
+  uint8_t priority;
+};
+
+struct pybg3_lspk_write_stats {
+  // Entries written from their new contents.
+  size_t compressed;
+  // Entries copied from their previous version.
+  size_t reused;
+};
+
+// Throws std::runtime_error if the level is out of range for the method, an input can't
+// be read or the pak can't be written.
+pybg3_lspk_write_stats pybg3_lspk_write(std::string const& path,
+                                        std::vector<pybg3_lspk_source> const& sources,
+                                        pybg3_lspk_write_options const& options);
+
+// The path of part n of the pak at path: <stem>_<n><ext>, or path itself for part 0.
+std::string pybg3_lspk_part_path(std::string const& path, size_t part);
@@ -0,0 +1,326 @@
+// pybg3
+//
+// Copyright (C) 2024 Mackenzie Straight.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "pybg3_lspk_writer.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+#include "libbg3.h"
+#include "lz4.h"
+#include "miniz.h"
+
+namespace {
+
+struct parsed_pak {
+  uint32_t version;
+  uint8_t priority;
+  uint16_t num_parts;
+  std::vector<bg3_lspk_manifest_entry> manifest;
+  std::vector<std::string> parts;
+};
+
+std::string read_file(std::filesystem::path const& path) {
+  std::ifstream in(path, std::ios::binary);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+template <typename T>
+T get(std::string const& data, size_t offset) {
+  T value;
+  memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+// Reads back a pak following the layout of the format rather than the writer's code.
+parsed_pak parse(std::string const& path) {
+  parsed_pak pak;
+  std::string main = read_file(path);
+  EXPECT_EQ(main.substr(0, 4), "LSPK");
+  pak.version = get<uint32_t>(main, 4);
+  uint64_t manifest_offset = get<uint64_t>(main, 8);
+  uint32_t manifest_size = get<uint32_t>(main, 16);
+  pak.priority = get<uint8_t>(main, 21);
+  pak.num_parts = get<uint16_t>(main, 38);
+  EXPECT_EQ(manifest_offset + manifest_size, main.size());
+  uint32_t num_files = get<uint32_t>(main, manifest_offset);
+  uint32_t compressed_size = get<uint32_t>(main, manifest_offset + 4);
+  EXPECT_EQ(compressed_size + 8, manifest_size);
+  pak.manifest.resize(num_files);
+  size_t manifest_bytes = num_files * sizeof(bg3_lspk_manifest_entry);
+  char const* compressed = main.data() + manifest_offset + 8;
+  int n = LZ4_decompress_safe(compressed, (char*)pak.manifest.data(), compressed_size,
+                              manifest_bytes);
+  EXPECT_EQ(size_t(n), manifest_bytes);
+  pak.parts.push_back(std::move(main));
+  for (size_t i = 1; i < pak.num_parts; ++i) {
+    pak.parts.push_back(read_file(pybg3_lspk_part_path(path, i)));
+  }
+  return pak;
+}
+
+std::string contents(parsed_pak const& pak, bg3_lspk_manifest_entry const& entry) {
+  uint64_t offset = entry.offset_lo | uint64_t(entry.offset_hi) << 32;
+  std::string const& part = pak.parts.at(entry.part_num);
+  EXPECT_LE(offset + entry.compressed_size, part.size());
+  std::string stored = part.substr(offset, entry.compressed_size);
+  std::string out(entry.uncompressed_size, 0);
+  switch (LIBBG3_LSPK_ENTRY_COMPRESSION_METHOD(entry.compression)) {
+    case LIBBG3_LSPK_ENTRY_COMPRESSION_NONE:
+      return stored;
+    case LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4:
+      EXPECT_EQ(LZ4_decompress_safe(stored.data(), out.data(), stored.size(), out.size()),
+                int(out.size()));
+      return out;
+    case LIBBG3_LSPK_ENTRY_COMPRESSION_ZLIB: {
+      mz_ulong size = out.size();
+      EXPECT_EQ(mz_uncompress((unsigned char*)out.data(), &size,
+                              (unsigned char const*)stored.data(), stored.size()),
+                MZ_OK);
+      return out;
+    }
+  }
+  ADD_FAILURE() << "unexpected compression " << int(entry.compression);
+  return "";
+}
+
+std::vector<std::string> make_files(size_t count) {
+  std::mt19937 rng(99);
+  std::vector<std::string> files;
+  for (size_t i = 0; i < count; ++i) {
+    std::string data;
+    size_t size = rng() % 20000;
+    bool random = i % 5 == 0;
+    for (size_t j = 0; j < size; ++j) {
+      data.push_back(random ? char(rng()) : "<node id=\"Test\"/>\n"[j % 18]);
+    }
+    files.push_back(std::move(data));
+  }
+  return files;
+}
+
+struct PyBg3LspkWriterTest : public ::testing::Test {
+  void SetUp() override {
+    dir = std::filesystem::temp_directory_path() / "pybg3_lspk_writer_test";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    path = (dir / "Test.pak").string();
+  }
+  void TearDown() override { std::filesystem::remove_all(dir); }
+  std::filesystem::path dir;
+  std::string path;
+};
+
+}  // namespace
+
+TEST_F(PyBg3LspkWriterTest, RoundTrip) {
+  std::vector<std::string> files = make_files(200);
+  for (unsigned method :
+       {LIBBG3_LSPK_ENTRY_COMPRESSION_NONE, LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4,
+        LIBBG3_LSPK_ENTRY_COMPRESSION_ZLIB}) {
+    for (int level : {0, 9}) {
+      std::vector<pybg3_lspk_source> sources;
+      for (size_t i = 0; i < files.size(); ++i) {
+        sources.push_back({"Mods/Test/File" + std::to_string(i) + ".lsx", files[i], ""});
+      }
+      pybg3_lspk_write(path, sources, {method, level, 4, 0, 7});
+      parsed_pak pak = parse(path);
+      EXPECT_EQ(pak.version, 18u);
+      EXPECT_EQ(pak.priority, 7);
+      EXPECT_EQ(pak.num_parts, 1);
+      ASSERT_EQ(pak.manifest.size(), files.size());
+      for (size_t i = 0; i < files.size(); ++i) {
+        bg3_lspk_manifest_entry const& entry = pak.manifest[i];
+        EXPECT_EQ(std::string(entry.name), sources[i].name);
+        EXPECT_EQ(entry.part_num, 0);
+        unsigned stored_method = LIBBG3_LSPK_ENTRY_COMPRESSION_METHOD(entry.compression);
+        EXPECT_TRUE(stored_method == method ||
+                    stored_method == LIBBG3_LSPK_ENTRY_COMPRESSION_NONE);
+        EXPECT_TRUE(contents(pak, entry) == files[i])
+            << method << " " << level << " " << i;
+      }
+    }
+  }
+}
+
+TEST_F(PyBg3LspkWriterTest, Parts) {
+  std::vector<std::string> files = make_files(50);
+  std::vector<pybg3_lspk_source> sources;
+  for (size_t i = 0; i < files.size(); ++i) {
+    sources.push_back({"Public/Test/" + std::to_string(i), files[i], ""});
+  }
+  sources.push_back({"Public/Test/Big", std::string_view(), ""});
+  std::string big(100000, 'x');
+  sources.back().data = big;
+  pybg3_lspk_write(path, sources,
+                   {LIBBG3_LSPK_ENTRY_COMPRESSION_NONE, 0, 2, 100000, 0});
+  parsed_pak pak = parse(path);
+  EXPECT_GT(pak.num_parts, 3);
+  EXPECT_TRUE(std::filesystem::exists(dir / "Test_1.pak"));
+  for (size_t part = 1; part < pak.num_parts; ++part) {
+    uint64_t entry_bytes = 0;
+    for (bg3_lspk_manifest_entry const& entry : pak.manifest) {
+      entry_bytes += entry.part_num == part ? entry.compressed_size : 0;
+    }
+    EXPECT_LE(entry_bytes, 100000u);
+  }
+  for (size_t i = 0; i < sources.size(); ++i) {
+    EXPECT_TRUE(contents(pak, pak.manifest[i]) == sources[i].data) << i;
+  }
+  EXPECT_EQ(pak.manifest.back().compressed_size, big.size());
+}
+
+TEST_F(PyBg3LspkWriterTest, FewerPartsRemovesOldOnes) {
+  std::vector<std::string> files = make_files(50);
+  std::vector<pybg3_lspk_source> sources;
+  for (size_t i = 0; i < files.size(); ++i) {
+    sources.push_back({"Public/Test/" + std::to_string(i), files[i], ""});
+  }
+  pybg3_lspk_write(path, sources, {LIBBG3_LSPK_ENTRY_COMPRESSION_NONE, 0, 2, 100000, 0});
+  EXPECT_GT(parse(path).num_parts, 2);
+  pybg3_lspk_write(path, sources, {LIBBG3_LSPK_ENTRY_COMPRESSION_NONE, 0, 2, 0, 0});
+  parsed_pak pak = parse(path);
+  EXPECT_EQ(pak.num_parts, 1);
+  EXPECT_FALSE(std::filesystem::exists(dir / "Test_1.pak"));
+  EXPECT_FALSE(std::filesystem::exists(dir / "Test_2.pak"));
+  for (size_t i = 0; i < sources.size(); ++i) {
+    EXPECT_TRUE(contents(pak, pak.manifest[i]) == sources[i].data) << i;
+  }
+}
+
+TEST_F(PyBg3LspkWriterTest, Files) {
+  std::vector<std::string> files = make_files(20);
+  std::vector<pybg3_lspk_source> sources;
+  for (size_t i = 0; i < files.size(); ++i) {
+    std::string file_path = (dir / ("in" + std::to_string(i))).string();
+    std::ofstream(file_path, std::ios::binary) << files[i];
+    sources.push_back({"Mods/Test/" + std::to_string(i), {}, file_path});
+  }
+  pybg3_lspk_write(path, sources, {LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4, 0, 0, 0, 0});
+  parsed_pak pak = parse(path);
+  for (size_t i = 0; i < files.size(); ++i) {
+    EXPECT_TRUE(contents(pak, pak.manifest[i]) == files[i]) << i;
+  }
+  sources.push_back({"Mods/Test/Missing", {}, (dir / "missing").string()});
+  EXPECT_THROW(
+      pybg3_lspk_write(path, sources, {LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4, 0, 4, 0, 0}),
+      std::runtime_error);
+  sources.back() = {std::string(256, 'a'), "data", ""};
+  EXPECT_THROW(
+      pybg3_lspk_write(path, sources, {LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4, 0, 4, 0, 0}),
+      std::runtime_error);
+}
+
+TEST_F(PyBg3LspkWriterTest, Reuse) {
+  std::vector<std::string> files = make_files(100);
+  std::vector<pybg3_lspk_source> sources;
+  for (size_t i = 0; i < files.size(); ++i) {
+    sources.push_back({"Mods/Test/" + std::to_string(i), files[i], ""});
+  }
+  pybg3_lspk_write_options options{LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4, 9, 4, 200000, 0};
+  pybg3_lspk_write_stats stats = pybg3_lspk_write(path, sources, options);
+  EXPECT_EQ(stats.compressed, files.size());
+  EXPECT_EQ(stats.reused, 0u);
+  parsed_pak old = parse(path);
+  std::vector<std::string> old_stored;
+  for (bg3_lspk_manifest_entry const& entry : old.manifest) {
+    uint64_t offset = entry.offset_lo | uint64_t(entry.offset_hi) << 32;
+    old_stored.push_back(old.parts[entry.part_num].substr(offset, entry.compressed_size));
+  }
+  // A few files change, one of them keeping its size, and one is new.
+  std::vector<std::string> changed = files;
+  changed[3] += "more";
+  changed[10][5] ^= 1;
+  changed[42] = "";
+  changed.push_back("new");
+  sources.clear();
+  for (size_t i = 0; i < changed.size(); ++i) {
+    sources.push_back({"Mods/Test/" + std::to_string(i), changed[i], ""});
+    if (i < files.size()) {
+      bg3_lspk_manifest_entry const& old_entry = old.manifest[i];
+      sources.back().previous = {old_stored[i], old_entry.compression,
+                                 old_entry.uncompressed_size};
+    }
+  }
+  options.method = LIBBG3_LSPK_ENTRY_COMPRESSION_ZLIB;
+  stats = pybg3_lspk_write(path, sources, options);
+  EXPECT_EQ(stats.compressed, 4u);
+  EXPECT_EQ(stats.reused, files.size() - 3);
+  parsed_pak pak = parse(path);
+  ASSERT_EQ(pak.manifest.size(), changed.size());
+  for (size_t i = 0; i < changed.size(); ++i) {
+    bg3_lspk_manifest_entry const& entry = pak.manifest[i];
+    EXPECT_TRUE(contents(pak, entry) == changed[i]) << i;
+    unsigned method = LIBBG3_LSPK_ENTRY_COMPRESSION_METHOD(entry.compression);
+    bool reused = i < files.size() && i != 3 && i != 10 && i != 42;
+    if (reused) {
+      EXPECT_EQ(entry.compression, old.manifest[i].compression) << i;
+      EXPECT_EQ(entry.compressed_size, old_stored[i].size()) << i;
+    } else if (!changed[i].empty() && method) {
+      EXPECT_EQ(method, LIBBG3_LSPK_ENTRY_COMPRESSION_ZLIB) << i;
+    }
+  }
+  for (auto const& file : std::filesystem::directory_iterator(dir)) {
+    EXPECT_NE(file.path().extension(), ".tmp");
+  }
+}
+
+TEST_F(PyBg3LspkWriterTest, FailureKeepsOldPak) {
+  std::vector<pybg3_lspk_source> sources = {{"a", "old contents", ""}};
+  pybg3_lspk_write_options options{LIBBG3_LSPK_ENTRY_COMPRESSION_NONE, 0, 1, 0, 0};
+  pybg3_lspk_write(path, sources, options);
+  std::string before = read_file(path);
+  sources.push_back({"b", {}, (dir / "missing").string()});
+  EXPECT_THROW(pybg3_lspk_write(path, sources, options), std::runtime_error);
+  EXPECT_EQ(read_file(path), before);
+  EXPECT_FALSE(std::filesystem::exists(path + ".tmp"));
+}
+
+TEST_F(PyBg3LspkWriterTest, InvalidLevel) {
+  std::vector<pybg3_lspk_source> sources = {{"a", "contents", ""}};
+  for (auto [method, level] :
+       {std::pair(LIBBG3_LSPK_ENTRY_COMPRESSION_ZLIB, 10),
+        std::pair(LIBBG3_LSPK_ENTRY_COMPRESSION_ZLIB, -1),
+        std::pair(LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4, 13),
+        std::pair(LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4, -1)}) {
+    EXPECT_THROW(pybg3_lspk_write(path, sources, {unsigned(method), level, 1, 0, 0}),
+                 std::runtime_error)
+        << method << " " << level;
+  }
+  EXPECT_FALSE(std::filesystem::exists(path));
+  pybg3_lspk_write(path, sources, {LIBBG3_LSPK_ENTRY_COMPRESSION_LZ4, 12, 1, 0, 0});
+  parsed_pak pak = parse(path);
+  EXPECT_TRUE(contents(pak, pak.manifest[0]) == "contents");
+}
+
+TEST_F(PyBg3LspkWriterTest, PartPath) {
+  EXPECT_EQ(pybg3_lspk_part_path("/data/Textures.pak", 0), "/data/Textures.pak");
+  EXPECT_EQ(pybg3_lspk_part_path("/data/Textures.pak", 3), "/data/Textures_3.pak");
+}
@@ -0,0 +1,261 @@
+#include "pybg3_object_index.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include "xxhash.h"
+
+static const char pybg3_object_index_magic[8] = {'P', 'B', 'G', '3', 'O', 'I', 'X', '1'};
+
+// The saved layout is the header, the paks, the hash slots, the records and then the
+// string data, all in native byte order, so that the sections can be used in place. Like
+// pybg3_lspk_index, it's only ever read back on the machine that wrote it.
+struct pybg3_object_index_header {
+  char magic[8];
+  uint64_t num_paks;
+  uint64_t num_slots;
+  uint64_t num_records;
+  uint64_t strings_size;
+};
+
+struct pybg3_object_index_saved_pak {
+  pybg3_lspk_index::pak_stamp stamp;
+  uint64_t path_offset;
+  uint64_t path_size;
+};
+
+struct pybg3_object_index::slot {
+  // The upper half of the name's hash, so that most mismatches skip the name compare.
+  uint32_t tag;
+  // The record index plus one, or 0 for an empty slot.
+  uint32_t record;
+};
+
+struct pybg3_object_index::record {
+  // The table and key, joined by a NUL, are at name_offset in the string data.
+  uint64_t name_offset;
+  uint32_t table_size;
+  uint32_t key_size;
+  pybg3_object_location location;
+  uint32_t padding;
+};
+
+static uint64_t pybg3_object_index_hash(std::string_view name) {
+  return XXH3_64bits(name.data(), name.size());
+}
+
+static std::string pybg3_object_index_name(std::string_view table, std::string_view key) {
+  std::string name;
+  name.reserve(table.size() + 1 + key.size());
+  name.append(table);
+  name.push_back('\0');
+  name.append(key);
+  return name;
+}
+
+void pybg3_object_index_builder::add(std::string_view table,
+                                     std::string_view key,
+                                     pybg3_object_location location) {
+  auto [it, inserted] =
+      objects.try_emplace(pybg3_object_index_name(table, key), location);
+  uint32_t pak = it->second.pak;
+  if (!inserted && std::pair(pak_priority(location.pak), location.pak) >=
+                       std::pair(pak_priority(pak), pak)) {
+    it->second = location;
+  }
+}
+
+bool pybg3_object_index_builder::save(
+    std::string const& path,
+    std::vector<pybg3_object_index_pak> const& paks) const {
+  // Sorted so that the same objects always produce the same file.
+  std::vector<std::pair<std::string_view, pybg3_object_location>> sorted(
+      objects.begin(), objects.end());
+  std::sort(sorted.begin(), sorted.end(),
+            [](auto const& a, auto const& b) { return a.first < b.first; });
+  std::string strings;
+  std::vector<pybg3_object_index_saved_pak> saved_paks;
+  for (pybg3_object_index_pak const& pak : paks) {
+    saved_paks.push_back({pak.stamp, strings.size(), pak.path.size()});
+    strings.append(pak.path);
+  }
+  // At most half full, so probe sequences stay short.
+  using slot = pybg3_object_index::slot;
+  using record = pybg3_object_index::record;
+  std::vector<slot> slots(std::bit_ceil(std::max<size_t>(sorted.size() * 2, 16)));
+  std::vector<record> records;
+  size_t mask = slots.size() - 1;
+  for (auto const& [name, location] : sorted) {
+    uint32_t table_size = name.find('\0');
+    records.push_back({strings.size(), table_size,
+                       uint32_t(name.size() - table_size - 1), location, 0});
+    strings.append(name);
+    uint64_t hash = pybg3_object_index_hash(name);
+    for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+      if (!slots[pos].record) {
+        slots[pos] = {uint32_t(hash >> 32), uint32_t(records.size())};
+        break;
+      }
+    }
+  }
+  pybg3_object_index_header header{};
+  memcpy(header.magic, pybg3_object_index_magic, sizeof(header.magic));
+  header.num_paks = saved_paks.size();
+  header.num_slots = slots.size();
+  header.num_records = records.size();
+  header.strings_size = strings.size();
+  // Written under a temporary name and renamed into place, so that readers never see a
+  // partial index.
+  std::string tmp_path = path + ".tmp";
+  FILE* fp = fopen(tmp_path.c_str(), "wb");
+  if (!fp) {
+    return false;
+  }
+  // Empty sections have no data pointer to hand to fwrite.
+  auto write = [fp](void const* data, size_t item_size, size_t count) {
+    return !count || fwrite(data, item_size, count, fp) == count;
+  };
+  bool ok = write(&header, sizeof(header), 1) &&
+            write(saved_paks.data(), sizeof(pybg3_object_index_saved_pak),
+                  saved_paks.size()) &&
+            write(slots.data(), sizeof(slot), slots.size()) &&
+            write(records.data(), sizeof(record), records.size()) &&
+            write(strings.data(), 1, strings.size());
+  ok = !fclose(fp) && ok;
+  if (!ok || rename(tmp_path.c_str(), path.c_str())) {
+    remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::optional<pybg3_object_index> pybg3_object_index::open(
+    std::string const& path,
+    std::vector<pybg3_object_index_pak> const& paks) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return std::nullopt;
+  }
+  struct stat st;
+  void* data = MAP_FAILED;
+  if (!fstat(fd, &st) && st.st_size >= (off_t)sizeof(pybg3_object_index_header)) {
+    data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    return std::nullopt;
+  }
+  size_t size = st.st_size;
+  pybg3_object_index index;
+  index.mapping.reset(data, [size](void const* data) { munmap((void*)data, size); });
+  char const* bytes = (char const*)data;
+  pybg3_object_index_header header;
+  memcpy(&header, bytes, sizeof(header));
+  // Each count is checked against the file size before it's multiplied, so that the
+  // layout can't overflow.
+  size_t remaining = size - sizeof(header);
+  auto take = [&](uint64_t count, size_t item_size) -> char const* {
+    if (count > remaining / item_size) {
+      return nullptr;
+    }
+    char const* section = bytes + (size - remaining);
+    remaining -= count * item_size;
+    return section;
+  };
+  if (memcmp(header.magic, pybg3_object_index_magic, sizeof(header.magic)) ||
+      header.num_paks != paks.size() || !std::has_single_bit(header.num_slots) ||
+      header.num_slots <= header.num_records) {
+    return std::nullopt;
+  }
+  auto const* saved_paks = (pybg3_object_index_saved_pak const*)take(
+      header.num_paks, sizeof(pybg3_object_index_saved_pak));
+  index.slots = (slot const*)take(header.num_slots, sizeof(slot));
+  index.records = (record const*)take(header.num_records, sizeof(record));
+  index.strings = take(header.strings_size, 1);
+  if (!saved_paks || !index.slots || !index.records || !index.strings || remaining) {
+    return std::nullopt;
+  }
+  index.num_slots = header.num_slots;
+  index.num_records = header.num_records;
+  for (size_t i = 0; i < paks.size(); ++i) {
+    pybg3_object_index_saved_pak const& saved = saved_paks[i];
+    if (!(saved.stamp == paks[i].stamp) || saved.path_offset > header.strings_size ||
+        saved.path_size > header.strings_size - saved.path_offset ||
+        std::string_view(index.strings + saved.path_offset, saved.path_size) !=
+            paks[i].path) {
+      return std::nullopt;
+    }
+  }
+  // The tables are trusted from here on, so make sure they can't index out of bounds.
+  auto record_name = [&](record const& r) {
+    return std::string_view(index.strings + r.name_offset, r.table_size + 1 + r.key_size);
+  };
+  for (size_t i = 0; i < index.num_records; ++i) {
+    record const& r = index.records[i];
+    if (r.name_offset > header.strings_size ||
+        uint64_t(r.table_size) + 1 + r.key_size > header.strings_size - r.name_offset ||
+        r.location.pak >= paks.size()) {
+      return std::nullopt;
+    }
+    ++index.table_sizes[std::string_view(index.strings + r.name_offset, r.table_size)];
+  }
+  // And that every probe ends: there's an empty slot, each record sits in one slot, and
+  // each slot is reachable from its hash without crossing an empty slot. Walking the
+  // table from an empty slot, that means a record's home is within the current run.
+  size_t mask = index.num_slots - 1;
+  size_t start = 0;
+  while (start < index.num_slots && index.slots[start].record) {
+    ++start;
+  }
+  if (start == index.num_slots) {
+    return std::nullopt;
+  }
+  std::vector<bool> seen(index.num_records);
+  size_t run_start = (start + 1) & mask;
+  for (size_t i = 1; i <= mask; ++i) {
+    size_t pos = (start + i) & mask;
+    slot const& s = index.slots[pos];
+    if (!s.record) {
+      run_start = (pos + 1) & mask;
+      continue;
+    }
+    if (s.record > index.num_records || seen[s.record - 1]) {
+      return std::nullopt;
+    }
+    seen[s.record - 1] = true;
+    uint64_t hash = pybg3_object_index_hash(record_name(index.records[s.record - 1]));
+    if (s.tag != uint32_t(hash >> 32) ||
+        ((pos - hash) & mask) > ((pos - run_start) & mask)) {
+      return std::nullopt;
+    }
+  }
+  return index;
+}
+
+std::optional<pybg3_object_location> pybg3_object_index::find(
+    std::string_view table,
+    std::string_view key) const {
+  std::string name = pybg3_object_index_name(table, key);
+  size_t mask = num_slots - 1;
+  uint64_t hash = pybg3_object_index_hash(name);
+  uint32_t tag = hash >> 32;
+  for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+    slot const& s = slots[pos];
+    if (!s.record) {
+      return std::nullopt;
+    }
+    record const& r = records[s.record - 1];
+    if (s.tag == tag && r.table_size + 1 + r.key_size == name.size() &&
+        !memcmp(strings + r.name_offset, name.data(), name.size())) {
+      return r.location;
+    }
+  }
+}
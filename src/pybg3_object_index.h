@@ -0,0 +1,108 @@
+// pybg3
+//
+// Copyright (C) 2024 Mackenzie Straight.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "pybg3_lspk_index.h"
+
+// Where an indexed object lives: a pak in the list the index was built for, an entry in
+// that pak's manifest, and the node in the LSF file the entry holds.
+struct pybg3_object_location {
+  uint32_t pak;
+  uint32_t entry;
+  int32_t node;
+  bool operator==(pybg3_object_location const&) const = default;
+};
+
+// One of the paks an object index describes, as it was when the index was built.
+struct pybg3_object_index_pak {
+  std::string path;
+  pybg3_lspk_index::pak_stamp stamp;
+};
+
+// Collects objects by table and key, and saves them in the layout pybg3_object_index
+// maps. A table groups keys of one kind, such as "Visual/ID".
+//
+// Where several paks have the same key, it resolves to the one a pak set would pick: the
+// pak with the highest header priority, and among equal priorities the last one.
+struct pybg3_object_index_builder {
+  pybg3_object_index_builder() = default;
+  // The header priority of each pak, by the pak numbers locations use. Paks past the end
+  // have priority 0.
+  explicit pybg3_object_index_builder(std::vector<int> pak_priorities)
+      : pak_priorities(std::move(pak_priorities)) {}
+  // Adding a key to a table again from the same pak replaces its location. table can't
+  // contain a NUL.
+  void add(std::string_view table, std::string_view key, pybg3_object_location location);
+  size_t size() const { return objects.size(); }
+  // Returns false if the index couldn't be written.
+  bool save(std::string const& path,
+            std::vector<pybg3_object_index_pak> const& paks) const;
+
+ private:
+  int pak_priority(uint32_t pak) const {
+    return pak < pak_priorities.size() ? pak_priorities[pak] : 0;
+  }
+  std::vector<int> pak_priorities;
+  // Keyed by the table and key joined by a NUL.
+  std::unordered_map<std::string, pybg3_object_location> objects;
+};
+
+// A saved object index, mapped read-only. Opening one costs a stat of each pak and a
+// pass over the tables that checks their bounds and rehashes every key, so it's linear
+// in the number of keys, but it never rescans an LSF file. It's only opened if it was
+// built for the same pak paths, sizes, modification times and entry counts.
+struct pybg3_object_index {
+  // Returns nothing if there's no usable index at path.
+  static std::optional<pybg3_object_index> open(
+      std::string const& path,
+      std::vector<pybg3_object_index_pak> const& paks);
+  std::optional<pybg3_object_location> find(std::string_view table,
+                                            std::string_view key) const;
+  size_t size() const { return num_records; }
+  // Number of keys in each table.
+  std::unordered_map<std::string_view, size_t> const& tables() const {
+    return table_sizes;
+  }
+
+ private:
+  friend struct pybg3_object_index_builder;
+  struct slot;
+  struct record;
+  pybg3_object_index() = default;
+  std::shared_ptr<void const> mapping;
+  slot const* slots{};
+  record const* records{};
+  char const* strings{};
+  size_t num_slots{};
+  size_t num_records{};
+  std::unordered_map<std::string_view, size_t> table_sizes;
+};
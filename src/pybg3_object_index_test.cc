@@ -0,0 +1,208 @@
+// pybg3
+//
+// Copyright (C) 2024 Mackenzie Straight.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "pybg3_object_index.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+static std::string temp_path(char const* name) {
+  return (std::filesystem::temp_directory_path() / name).string();
+}
+
+static std::vector<pybg3_object_index_pak> make_paks() {
+  return {
+      {"Data/Shared.pak", {1000, 1700000000, 12}},
+      {"Data/Gustav.pak", {2000, 1700000001, 34}},
+  };
+}
+
+TEST(PyBg3ObjectIndex, RoundTrip) {
+  std::string path = temp_path("pybg3_object_index_round_trip.idx");
+  pybg3_object_index_builder builder;
+  builder.add("RootTemplate/MapKey", "f05367f6-78f2-4631-996e-7e21912bbb78", {1, 7, 42});
+  builder.add("RootTemplate/Name", "S_AIN_DeathBoi", {1, 7, 42});
+  builder.add("Visual/ID", "f05367f6-78f2-4631-996e-7e21912bbb78", {0, 3, 9});
+  builder.add("Visual/Name", "HUM_M_Body", {0, 3, 9});
+  // Later adds replace earlier ones.
+  builder.add("Visual/Name", "HUM_M_Body", {1, 4, 11});
+  EXPECT_EQ(builder.size(), 4);
+  ASSERT_TRUE(builder.save(path, make_paks()));
+  std::optional<pybg3_object_index> index = pybg3_object_index::open(path, make_paks());
+  ASSERT_TRUE(index);
+  EXPECT_EQ(index->size(), 4);
+  EXPECT_EQ(index->find("RootTemplate/MapKey", "f05367f6-78f2-4631-996e-7e21912bbb78"),
+            (pybg3_object_location{1, 7, 42}));
+  EXPECT_EQ(index->find("Visual/ID", "f05367f6-78f2-4631-996e-7e21912bbb78"),
+            (pybg3_object_location{0, 3, 9}));
+  EXPECT_EQ(index->find("Visual/Name", "HUM_M_Body"), (pybg3_object_location{1, 4, 11}));
+  EXPECT_EQ(index->find("Visual/Name", "HUM_M_Bod"), std::nullopt);
+  EXPECT_EQ(index->find("Visual", "ID"), std::nullopt);
+  EXPECT_EQ(index->find("Material/ID", "f05367f6-78f2-4631-996e-7e21912bbb78"),
+            std::nullopt);
+  EXPECT_EQ(index->tables().size(), 4);
+  EXPECT_EQ(index->tables().at("Visual/Name"), 1);
+  std::filesystem::remove(path);
+}
+
+TEST(PyBg3ObjectIndex, Many) {
+  std::string path = temp_path("pybg3_object_index_many.idx");
+  pybg3_object_index_builder builder;
+  for (int i = 0; i < 100000; ++i) {
+    builder.add("Visual/ID", std::to_string(i), {uint32_t(i % 2), uint32_t(i), i});
+  }
+  ASSERT_TRUE(builder.save(path, make_paks()));
+  std::optional<pybg3_object_index> index = pybg3_object_index::open(path, make_paks());
+  ASSERT_TRUE(index);
+  for (int i = 0; i < 100000; ++i) {
+    ASSERT_EQ(index->find("Visual/ID", std::to_string(i)),
+              (pybg3_object_location{uint32_t(i % 2), uint32_t(i), i}));
+  }
+  EXPECT_EQ(index->find("Visual/ID", "100000"), std::nullopt);
+  EXPECT_EQ(index->tables().at("Visual/ID"), 100000);
+  std::filesystem::remove(path);
+}
+
+TEST(PyBg3ObjectIndex, PakPriority) {
+  std::string path = temp_path("pybg3_object_index_pak_priority.idx");
+  // Like a pak set where the first pak mounted has the higher priority.
+  pybg3_object_index_builder builder({5, 0});
+  builder.add("Visual/Name", "HUM_M_Body", {0, 3, 9});
+  builder.add("Visual/Name", "HUM_M_Body", {1, 4, 11});
+  builder.add("Visual/Name", "HUM_F_Body", {1, 5, 12});
+  builder.add("Visual/Name", "HUM_F_Body", {0, 6, 13});
+  ASSERT_TRUE(builder.save(path, make_paks()));
+  std::optional<pybg3_object_index> index = pybg3_object_index::open(path, make_paks());
+  ASSERT_TRUE(index);
+  EXPECT_EQ(index->find("Visual/Name", "HUM_M_Body"), (pybg3_object_location{0, 3, 9}));
+  EXPECT_EQ(index->find("Visual/Name", "HUM_F_Body"), (pybg3_object_location{0, 6, 13}));
+  // Among equal priorities the later pak wins, whichever order they're added in.
+  pybg3_object_index_builder ties({2, 2});
+  ties.add("Visual/Name", "HUM_M_Body", {1, 4, 11});
+  ties.add("Visual/Name", "HUM_M_Body", {0, 3, 9});
+  ASSERT_TRUE(ties.save(path, make_paks()));
+  index = pybg3_object_index::open(path, make_paks());
+  ASSERT_TRUE(index);
+  EXPECT_EQ(index->find("Visual/Name", "HUM_M_Body"), (pybg3_object_location{1, 4, 11}));
+  std::filesystem::remove(path);
+}
+
+TEST(PyBg3ObjectIndex, Empty) {
+  std::string path = temp_path("pybg3_object_index_empty.idx");
+  ASSERT_TRUE(pybg3_object_index_builder().save(path, {}));
+  std::optional<pybg3_object_index> index = pybg3_object_index::open(path, {});
+  ASSERT_TRUE(index);
+  EXPECT_EQ(index->size(), 0);
+  EXPECT_EQ(index->find("Visual/ID", ""), std::nullopt);
+  std::filesystem::remove(path);
+}
+
+TEST(PyBg3ObjectIndex, RejectsStale) {
+  std::string path = temp_path("pybg3_object_index_stale.idx");
+  pybg3_object_index_builder builder;
+  builder.add("Visual/ID", "a", {0, 1, 2});
+  ASSERT_TRUE(builder.save(path, make_paks()));
+  std::vector<pybg3_object_index_pak> paks = make_paks();
+  paks[1].stamp.mtime += 1;
+  EXPECT_FALSE(pybg3_object_index::open(path, paks));
+  paks = make_paks();
+  paks[0].stamp.size += 1;
+  EXPECT_FALSE(pybg3_object_index::open(path, paks));
+  paks = make_paks();
+  paks[0].path = "Data/Engine.pak";
+  EXPECT_FALSE(pybg3_object_index::open(path, paks));
+  paks = make_paks();
+  paks.pop_back();
+  EXPECT_FALSE(pybg3_object_index::open(path, paks));
+  EXPECT_FALSE(pybg3_object_index::open(temp_path("pybg3_object_index_missing.idx"),
+                                        make_paks()));
+  std::filesystem::remove(path);
+}
+
+TEST(PyBg3ObjectIndex, RejectsCorrupt) {
+  std::string path = temp_path("pybg3_object_index_corrupt.idx");
+  pybg3_object_index_builder builder;
+  builder.add("Visual/ID", "a", {0, 1, 2});
+  ASSERT_TRUE(builder.save(path, make_paks()));
+  uintmax_t size = std::filesystem::file_size(path);
+  std::filesystem::resize_file(path, size - 1);
+  EXPECT_FALSE(pybg3_object_index::open(path, make_paks()));
+  std::filesystem::resize_file(path, 4);
+  EXPECT_FALSE(pybg3_object_index::open(path, make_paks()));
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << std::string(4096, '\xff');
+  }
+  EXPECT_FALSE(pybg3_object_index::open(path, make_paks()));
+  std::filesystem::remove(path);
+}
+
+TEST(PyBg3ObjectIndex, RejectsCorruptSlots) {
+  std::string path = temp_path("pybg3_object_index_slots.idx");
+  pybg3_object_index_builder builder;
+  builder.add("Visual/ID", "a", {0, 1, 2});
+  builder.add("Visual/ID", "b", {0, 1, 3});
+  ASSERT_TRUE(builder.save(path, make_paks()));
+  // The 16 slots of {tag, record} follow the 40 byte header and the two 40 byte paks.
+  std::streamoff slots_offset = 40 + 2 * 40;
+  std::vector<uint32_t> slots(32);
+  {
+    std::ifstream in(path, std::ios::binary);
+    in.seekg(slots_offset);
+    in.read((char*)slots.data(), slots.size() * sizeof(uint32_t));
+  }
+  auto write_slots = [&](std::vector<uint32_t> const& slots) {
+    std::fstream out(path, std::ios::binary | std::ios::in | std::ios::out);
+    out.seekp(slots_offset);
+    out.write((char const*)slots.data(), slots.size() * sizeof(uint32_t));
+  };
+  size_t used = 0;
+  while (!slots[used * 2 + 1]) {
+    ++used;
+  }
+  // Every slot points at record 1, so there's no empty slot to end a probe.
+  std::vector<uint32_t> corrupt(slots.size());
+  for (size_t i = 0; i < corrupt.size(); i += 2) {
+    corrupt[i] = slots[used * 2];
+    corrupt[i + 1] = 1;
+  }
+  write_slots(corrupt);
+  EXPECT_FALSE(pybg3_object_index::open(path, make_paks()));
+  // A record in two slots, with empty slots left.
+  corrupt = slots;
+  size_t empty = 0;
+  while (corrupt[empty * 2 + 1]) {
+    ++empty;
+  }
+  corrupt[empty * 2] = corrupt[used * 2];
+  corrupt[empty * 2 + 1] = corrupt[used * 2 + 1];
+  write_slots(corrupt);
+  EXPECT_FALSE(pybg3_object_index::open(path, make_paks()));
+  write_slots(slots);
+  EXPECT_TRUE(pybg3_object_index::open(path, make_paks()));
+  std::filesystem::remove(path);
+}
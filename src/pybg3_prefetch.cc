@@ -0,0 +1,48 @@
+#include "pybg3_prefetch.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <tuple>
+
+std::vector<pybg3_byte_range> pybg3_coalesce_ranges(std::vector<pybg3_byte_range> ranges,
+                                                    uint64_t max_gap) {
+  std::sort(ranges.begin(), ranges.end(), [](auto const& a, auto const& b) {
+    return std::tie(a.part, a.offset) < std::tie(b.part, b.offset);
+  });
+  std::vector<pybg3_byte_range> merged;
+  for (pybg3_byte_range const& r : ranges) {
+    if (!r.size) {
+      continue;
+    }
+    if (!merged.empty()) {
+      pybg3_byte_range& last = merged.back();
+      uint64_t last_end = last.offset + last.size;
+      if (last.part == r.part && r.offset <= last_end + max_gap) {
+        last.size = std::max(last_end, r.offset + r.size) - last.offset;
+        continue;
+      }
+    }
+    merged.push_back(r);
+  }
+  return merged;
+}
+
+bool pybg3_prefetch_range(char* data, size_t data_len, uint64_t offset, uint64_t size) {
+  if (offset >= data_len || !size) {
+    return true;
+  }
+  size = std::min<uint64_t>(size, data_len - offset);
+  // madvise wants a page-aligned start. The mapping itself always is.
+  uint64_t page = sysconf(_SC_PAGESIZE);
+  uint64_t start = offset & ~(page - 1);
+  return !madvise(data + start, offset + size - start, MADV_WILLNEED);
+}
+
+bool pybg3_advise_sequential(char* data, size_t data_len, bool sequential) {
+  if (!data_len) {
+    return true;
+  }
+  return !madvise(data, data_len, sequential ? MADV_SEQUENTIAL : MADV_NORMAL);
+}
@@ -0,0 +1,48 @@
+// pybg3
+//
+// Copyright (C) 2024 Mackenzie Straight.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Readahead hints for mapped paks. Without them, reading entries from a cold mapping
+// pays for a page fault, and often a storage round trip, every few KB.
+struct pybg3_byte_range {
+  size_t part;
+  uint64_t offset;
+  uint64_t size;
+};
+
+// Sorts ranges by part and offset and merges those less than max_gap bytes apart, so a
+// batch of small neighbouring entries turns into a few large reads.
+std::vector<pybg3_byte_range> pybg3_coalesce_ranges(std::vector<pybg3_byte_range> ranges,
+                                                    uint64_t max_gap);
+
+// Asks the kernel to start reading [offset, offset + size) of a mapping of data_len bytes
+// at data into memory, without waiting for it. Returns false if the hint was rejected.
+bool pybg3_prefetch_range(char* data, size_t data_len, uint64_t offset, uint64_t size);
+
+// Switches a whole mapping between sequential readahead, for scans that go through it
+// in order, and the default.
+bool pybg3_advise_sequential(char* data, size_t data_len, bool sequential);
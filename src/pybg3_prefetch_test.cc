@@ -0,0 +1,158 @@
+// pybg3
+//
+// Copyright (C) 2024 Mackenzie Straight.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "pybg3_prefetch.h"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+TEST(PyBg3Prefetch, CoalesceRanges) {
+  std::vector<pybg3_byte_range> merged = pybg3_coalesce_ranges(
+      {
+          {1, 0, 100},
+          {0, 5000, 100},
+          {0, 0, 1000},
+          {0, 1100, 200},
+          {0, 900, 50},
+          {0, 7000, 0},
+          {1, 150, 10},
+      },
+      100);
+  ASSERT_EQ(merged.size(), 3u);
+  EXPECT_EQ(merged[0].part, 0u);
+  EXPECT_EQ(merged[0].offset, 0u);
+  EXPECT_EQ(merged[0].size, 1300u);
+  EXPECT_EQ(merged[1].offset, 5000u);
+  EXPECT_EQ(merged[1].size, 100u);
+  EXPECT_EQ(merged[2].part, 1u);
+  EXPECT_EQ(merged[2].size, 160u);
+  EXPECT_TRUE(pybg3_coalesce_ranges({}, 0).empty());
+}
+
+namespace {
+
+// A scratch file mapped read-only, with helpers to drop it from the page cache and
+// check how much of it is resident.
+struct mapped_scratch {
+  explicit mapped_scratch(size_t size) : size(size) {
+    path = (std::filesystem::temp_directory_path() / "pybg3_prefetch_test.bin").string();
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    std::vector<char> block(1 << 20);
+    std::mt19937 rng(7);
+    for (size_t written = 0; written < size; written += block.size()) {
+      for (char& c : block) {
+        c = rng();
+      }
+      EXPECT_EQ(write(fd, block.data(), block.size()), ssize_t(block.size()));
+    }
+    fsync(fd);
+    data = (char*)mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  ~mapped_scratch() {
+    munmap(data, size);
+    close(fd);
+    unlink(path.c_str());
+  }
+  void evict() {
+    madvise(data, size, MADV_DONTNEED);
+    posix_fadvise(fd, 0, size, POSIX_FADV_DONTNEED);
+  }
+  double resident() {
+    size_t page = sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> pages((size + page - 1) / page);
+    mincore(data, size, pages.data());
+    size_t count = 0;
+    for (unsigned char p : pages) {
+      count += p & 1;
+    }
+    return double(count) / pages.size();
+  }
+  std::string path;
+  size_t size;
+  int fd;
+  char* data;
+};
+
+}  // namespace
+
+TEST(PyBg3Prefetch, PrefetchRange) {
+  mapped_scratch file(4 << 20);
+  ASSERT_NE(file.data, MAP_FAILED);
+  EXPECT_TRUE(pybg3_prefetch_range(file.data, file.size, 12345, 100000));
+  EXPECT_TRUE(pybg3_prefetch_range(file.data, file.size, file.size - 10, 100));
+  EXPECT_TRUE(pybg3_prefetch_range(file.data, file.size, file.size + 10, 100));
+  EXPECT_TRUE(pybg3_advise_sequential(file.data, file.size, true));
+  EXPECT_TRUE(pybg3_advise_sequential(file.data, file.size, false));
+}
+
+// Reads a batch of scattered "entries" from a file whose pages have been dropped from
+// the cache, with and without prefetching them first. How cold the cache gets depends
+// on the filesystem (tmpfs can't drop anything), so the residency after eviction is
+// printed alongside the timings.
+TEST(PyBg3Prefetch, ColdCacheBenchmark) {
+  mapped_scratch file(64 << 20);
+  ASSERT_NE(file.data, MAP_FAILED);
+  std::mt19937 rng(11);
+  std::vector<pybg3_byte_range> entries;
+  for (uint64_t offset = 0; offset < file.size;) {
+    uint64_t size = 4096 + rng() % (256 << 10);
+    if (rng() % 2) {
+      entries.push_back({0, offset, std::min(size, file.size - offset)});
+    }
+    offset += size;
+  }
+  std::shuffle(entries.begin(), entries.end(), rng);
+  auto read_all = [&] {
+    uint64_t sum = 0;
+    for (pybg3_byte_range const& e : entries) {
+      for (uint64_t i = 0; i < e.size; i += 512) {
+        sum += file.data[e.offset + i];
+      }
+    }
+    return sum;
+  };
+  for (bool prefetch : {false, true}) {
+    file.evict();
+    double resident = file.resident();
+    auto start = std::chrono::steady_clock::now();
+    if (prefetch) {
+      for (pybg3_byte_range const& r : pybg3_coalesce_ranges(entries, 64 << 10)) {
+        pybg3_prefetch_range(file.data, file.size, r.offset, r.size);
+      }
+    }
+    volatile uint64_t sum = read_all();
+    (void)sum;
+    std::chrono::duration<double, std::milli> ms =
+        std::chrono::steady_clock::now() - start;
+    printf("%-12s %zu entries: %8.2f ms (%.0f%% resident before)\n",
+           prefetch ? "prefetch" : "no prefetch", entries.size(), ms.count(),
+           resident * 100);
+  }
+}
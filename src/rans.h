@@ -32,12 +32,16 @@
 // https://fgiesen.wordpress.com/2016/03/07/repeated-match-offsets-in-bitknit/
 // https://github.com/rygorous/ryg_rans
 
+#include <algorithm>
 #include <array>
+#include <bit>
 #include <cassert>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <stdexcept>
+#include <type_traits>
+#include <vector>
 
 #define LIBBG3_BITKNIT2_MAGIC 0x75B1
 
@@ -74,11 +78,26 @@ struct unsigned_t<8> {
 // and no symbol may have a frequency of 0.
 //
 // Additionally, reverse lookups from a FrequencyBits-bit code to a symbol are
-// supported and may be accelerated by a lookup table. The lookup table is
-// indexed by the high bits of the code value, and contains the symbol index at
-// which to start a linear search. If the lookup table isn't used (LookupBits ==
-// 0), reverse lookup is done by binary search.
-template <typename T, size_t VocabSize, size_t FrequencyBits, size_t LookupBits>
+// supported. How they're done is chosen at compile time by the Lookup parameter;
+// see symbol_lookup.
+enum class symbol_lookup {
+  // A lookup table indexed by the high LookupBits bits of the code contains the
+  // symbol index at which to start a linear search. If the lookup table isn't
+  // used (LookupBits == 0), reverse lookup is done by binary search.
+  hint,
+  // A lookup table with an entry for every code. No search at all, but the
+  // table has 2^FrequencyBits entries and all of them are rewritten on update.
+  direct,
+  // Count the sums <= code using vector compares. Branch-free and there's no
+  // table to maintain, but every lookup touches every sum.
+  simd,
+};
+
+template <typename T,
+          size_t VocabSize,
+          size_t FrequencyBits,
+          size_t LookupBits,
+          symbol_lookup Lookup = symbol_lookup::hint>
 struct frequency_table {
   static_assert(FrequencyBits > 0 && FrequencyBits < sizeof(T) * 8);
   static_assert(LookupBits <= FrequencyBits);
@@ -86,16 +105,25 @@ struct frequency_table {
   static constexpr size_t frequency_bits = FrequencyBits;
   static constexpr size_t vocab_size = VocabSize;
   static constexpr size_t lookup_shift = FrequencyBits - LookupBits;
+  static constexpr bool uses_hint_table = Lookup == symbol_lookup::hint && LookupBits;
+  static constexpr size_t lookup_size =
+      Lookup == symbol_lookup::direct ? 1 << FrequencyBits
+      : uses_hint_table               ? 1 << LookupBits
+                                      : 0;
   // Invariants:
   // - sums[VocabSize] == 2^FrequencyBits
   // - sums[i] < sums[i + 1]
   // - you must call finish_update after changing sums to recalculate lookup.
   std::array<T, VocabSize + 1> sums;
-  std::array<T, LookupBits ? 1 << LookupBits : 0> lookup;
+  std::array<T, lookup_size> lookup;
   // Given a code, find the symbol whose cumulative frequency range the code falls within.
   // If code is >= 2^FrequencyBits, the behavior is undefined.
   size_t LIBBG3_FORCEINLINE find_symbol(size_t code) const {
-    if constexpr (LookupBits == 0) {
+    if constexpr (Lookup == symbol_lookup::direct) {
+      return lookup[code];
+    } else if constexpr (Lookup == symbol_lookup::simd) {
+      return find_symbol_simd(code);
+    } else if constexpr (LookupBits == 0) {
       return find_symbol_slow(code);
     } else {
       size_t sym = lookup[code >> lookup_shift];
@@ -122,8 +150,35 @@ struct frequency_table {
     }
     __builtin_unreachable();
   }
+  // sums[0] == 0 is always <= code, so the number of sums[0..VocabSize) <= code is one
+  // more than the symbol. The tail that doesn't fill a vector is counted scalar.
+  size_t LIBBG3_FORCEINLINE find_symbol_simd(size_t code) const {
+    typedef T vec_t __attribute__((vector_size(16)));
+    constexpr size_t lanes = sizeof(vec_t) / sizeof(T);
+    vec_t codes = vec_t{} + T(code);
+    vec_t counts{};
+    size_t i = 0;
+    for (; i + lanes <= VocabSize; i += lanes) {
+      vec_t chunk;
+      memcpy(&chunk, &sums[i], sizeof(chunk));
+      counts -= (vec_t)(chunk <= codes);
+    }
+    size_t count = 0;
+    for (size_t lane = 0; lane < lanes; ++lane) {
+      count += counts[lane];
+    }
+    for (; i < VocabSize; ++i) {
+      count += sums[i] <= code;
+    }
+    return count - 1;
+  }
   void finish_update() {
-    if constexpr (LookupBits == 0) {
+    if constexpr (Lookup == symbol_lookup::direct) {
+      for (size_t sym = 0; sym < VocabSize; ++sym) {
+        std::fill(lookup.begin() + sums[sym], lookup.begin() + sums[sym + 1], T(sym));
+      }
+      return;
+    } else if constexpr (Lookup == symbol_lookup::simd || LookupBits == 0) {
       return;
     }
     size_t code = 0, sym = 0, next = sums[1];
@@ -154,9 +209,10 @@ template <typename T,
           size_t VocabSize,
           size_t NumMinProbableSymbols,
           size_t FrequencyBits,
-          size_t LookupBits>
+          size_t LookupBits,
+          symbol_lookup Lookup = symbol_lookup::hint>
 struct deferred_adaptive_model {
-  using cdf_t = frequency_table<T, VocabSize, FrequencyBits, LookupBits>;
+  using cdf_t = frequency_table<T, VocabSize, FrequencyBits, LookupBits, Lookup>;
   static constexpr size_t num_equiprobable_symbols = VocabSize - NumMinProbableSymbols;
   static constexpr size_t num_min_probable_symbols = NumMinProbableSymbols;
   static constexpr size_t adaptation_interval = AdaptationInterval;
@@ -182,21 +238,45 @@ struct deferred_adaptive_model {
     adaptation_counter = (adaptation_counter + 1) % AdaptationInterval;
     if (adaptation_counter == 0) {
       frequency_accumulator[symbol] += last_frequency_incr;
-      // Sum in the next size up to avoid issues with unsigned division. -1 / 2 == -1 will
-      // not hold if we're averaging uint16_ts.
-      typename unsigned_t<sizeof(T) * 2>::type sum = 0;
-      for (size_t i = 1; i <= VocabSize; ++i) {
-        sum += frequency_accumulator[i - 1];
-        // Trickier than it looks:
-        // https://fgiesen.wordpress.com/2015/02/20/mixing-discrete-probability-distributions/
-        cdf.sums[i] += (sum - cdf.sums[i]) / 2;
-        frequency_accumulator[i - 1] = 1;
-      }
+      mix_accumulated_frequencies();
       cdf.finish_update();
       return true;
     }
     return false;
   }
+  // Averages the current distribution with the prefix sum of the accumulated frequencies.
+  // Trickier than it looks:
+  // https://fgiesen.wordpress.com/2015/02/20/mixing-discrete-probability-distributions/
+  // The difference is halved with an arithmetic shift in a signed type twice as wide as
+  // T, so it rounds towards -infinity. The prefix sum is done 4 lanes at a time with two
+  // shift-and-add steps, carrying the last lane into the next group.
+  void mix_accumulated_frequencies() {
+    using wide_t = std::conditional_t<sizeof(T) <= 2, int32_t, int64_t>;
+    typedef wide_t wide_vec_t __attribute__((vector_size(4 * sizeof(wide_t))));
+    typedef T narrow_vec_t __attribute__((vector_size(4 * sizeof(T))));
+    wide_vec_t const zero{};
+    wide_t carry = 0;
+    size_t i = 0;
+    for (; i + 4 <= VocabSize; i += 4) {
+      narrow_vec_t freqs, old_sums;
+      memcpy(&freqs, &frequency_accumulator[i], sizeof(freqs));
+      memcpy(&old_sums, &cdf.sums[i + 1], sizeof(old_sums));
+      wide_vec_t sum = __builtin_convertvector(freqs, wide_vec_t);
+      sum += __builtin_shufflevector(zero, sum, 0, 4, 5, 6);
+      sum += __builtin_shufflevector(zero, sum, 0, 1, 4, 5);
+      sum += carry;
+      wide_vec_t mixed = __builtin_convertvector(old_sums, wide_vec_t);
+      mixed += (sum - mixed) >> 1;
+      old_sums = __builtin_convertvector(mixed, narrow_vec_t);
+      memcpy(&cdf.sums[i + 1], &old_sums, sizeof(old_sums));
+      carry = sum[3];
+    }
+    for (; i < VocabSize; ++i) {
+      carry += frequency_accumulator[i];
+      cdf.sums[i + 1] += (carry - wide_t(cdf.sums[i + 1])) >> 1;
+    }
+    frequency_accumulator.fill(1);
+  }
   cdf_t cdf;
   std::array<T, VocabSize> frequency_accumulator;
   int adaptation_counter{0};
@@ -254,12 +334,18 @@ struct rans_state {
   void LIBBG3_FORCEINLINE push_cdf(bounded_stack<stream_bits_t>& stream,
                                    Bits sym,
                                    CDF const& cdf) {
-    Bits mask = ~(~Bits(0) >> CDF::frequency_bits);
-    Bits freq = cdf.frequency(sym);
+    push_range<CDF::frequency_bits>(stream, cdf.sum_below(sym), cdf.frequency(sym));
+  }
+  // Like push_cdf, for a symbol whose cumulative frequency range was recorded earlier.
+  template <size_t FrequencyBits>
+  void LIBBG3_FORCEINLINE push_range(bounded_stack<stream_bits_t>& stream,
+                                     Bits sum_below,
+                                     Bits freq) {
+    Bits mask = ~(~Bits(0) >> FrequencyBits);
     if ((bits / freq) & mask) {
       offload(stream);
     }
-    bits = ((bits / freq) << CDF::frequency_bits) + (bits % freq) + cdf.sum_below(sym);
+    bits = ((bits / freq) << FrequencyBits) + (bits % freq) + sum_below;
   }
   template <typename CDF>
   Bits LIBBG3_FORCEINLINE pop_cdf(bounded_stack<stream_bits_t>& stream, CDF const& cdf) {
@@ -283,6 +369,81 @@ struct rans_state {
   Bits bits;
 };
 
+// Expands an LZ match: copies length bytes starting offset bytes before dst. If the
+// ranges overlap (offset < length) the copy repeats the last offset bytes, so this can't
+// be a memmove.
+inline void LIBBG3_FORCEINLINE copy_match_scalar(uint8_t* dst,
+                                                 size_t offset,
+                                                 size_t length) {
+  for (size_t i = 0; i < length; ++i) {
+    dst[i] = dst[i - offset];
+  }
+}
+
+// How far past the end of a match copy_match_wide may write.
+static constexpr size_t copy_match_slack = 32;
+
+template <size_t N>
+inline void LIBBG3_FORCEINLINE copy_match_chunks(uint8_t* dst,
+                                                 uint8_t* dst_end,
+                                                 size_t offset) {
+  do {
+    memcpy(dst, dst - offset, N);
+    dst += N;
+  } while (dst < dst_end);
+}
+
+// copy_match_scalar using 16 and 32 byte unaligned moves. Writes up to copy_match_slack
+// bytes of garbage past dst + length.
+//
+// Short matches with a period under 16 bytes are expanded bytewise until the pattern is
+// at least 16 bytes long (or the match ends), then copied a whole number of periods
+// back. For longer ones
+// with a period under 32 bytes, that would keep loading bytes that were only partially
+// covered by recent stores and stall on store forwarding, so the pattern is built once
+// in a local buffer and stored at the right phase for each chunk instead.
+inline void LIBBG3_FORCEINLINE copy_match_wide(uint8_t* dst,
+                                               size_t offset,
+                                               size_t length) {
+  uint8_t* dst_end = dst + length;
+  if (!length) {
+    return;
+  }
+  if (offset >= 32) {
+    copy_match_chunks<32>(dst, dst_end, offset);
+  } else if (offset == 1) {
+    memset(dst, dst[-1], length);
+  } else if (length <= 16 && offset < 16) {
+    copy_match_scalar(dst, offset, length);
+  } else if (length < 64) {
+    if (offset >= 16) {
+      copy_match_chunks<16>(dst, dst_end, offset);
+      return;
+    }
+    size_t period = offset * ((16 + offset - 1) / offset);
+    size_t prefix = std::min(period, length);
+    copy_match_scalar(dst, offset, prefix);
+    if (prefix < length) {
+      copy_match_chunks<16>(dst + prefix, dst_end, period);
+    }
+  } else {
+    uint8_t pattern[64];
+    memcpy(pattern, dst - offset, offset);
+    for (size_t len = offset; len < sizeof(pattern); len *= 2) {
+      memcpy(pattern + len, pattern, std::min(len, sizeof(pattern) - len));
+    }
+    size_t phase = 0, step = 16 % offset;
+    do {
+      memcpy(dst, pattern + phase, 16);
+      dst += 16;
+      phase += step;
+      if (phase >= offset) {
+        phase -= offset;
+      }
+    } while (dst < dst_end);
+  }
+}
+
 // The idea for this way of managing the offset cache is described here:
 // https://fgiesen.wordpress.com/2016/03/07/repeated-match-offsets-in-bitknit/
 // tldr the items don't move on a cache hit, the indices just have a swizzle
@@ -314,9 +475,42 @@ struct register_lru_cache {
   }
 };
 
-struct bitknit2_state {
-  bitknit2_state(uint8_t* dst, size_t dst_len)
-      : dst(dst), dst_end(dst + dst_len), src(0, 0, 0) {}
+// The symbol lookup strategy used by bitknit2_state. Build with e.g.
+// -DLIBBG3_BITKNIT2_SYMBOL_LOOKUP=direct to pick another one.
+#ifndef LIBBG3_BITKNIT2_SYMBOL_LOOKUP
+#define LIBBG3_BITKNIT2_SYMBOL_LOOKUP hint
+#endif
+static constexpr symbol_lookup bitknit2_symbol_lookup =
+    symbol_lookup::LIBBG3_BITKNIT2_SYMBOL_LOOKUP;
+
+// Command words are literals (< 256) or copies. Both they and the cache references are
+// modeled separately for each output position mod 4.
+template <symbol_lookup Lookup = bitknit2_symbol_lookup>
+using bitknit2_command_word_model =
+    deferred_adaptive_model<uint16_t, 1024, 300, 36, 15, 10, Lookup>;
+template <symbol_lookup Lookup = bitknit2_symbol_lookup>
+using bitknit2_cache_reference_model =
+    deferred_adaptive_model<uint16_t, 1024, 40, 0, 15, 10, Lookup>;
+template <symbol_lookup Lookup = bitknit2_symbol_lookup>
+using bitknit2_copy_offset_model =
+    deferred_adaptive_model<uint16_t, 1024, 21, 0, 15, 10, Lookup>;
+
+// Decodes a BitKnit2 stream into a caller-provided buffer whose size is known up front.
+//
+// decode() takes the whole compressed stream in one call. The incremental API
+// (decode_incremental, finish) instead accepts the compressed stream in arbitrarily
+// sized chunks and can stop at a caller-chosen output limit, so that neither buffer
+// needs to be materialized in full. Don't mix the two on one state object.
+//
+// Use the bitknit2_state alias unless you need a specific symbol lookup strategy.
+template <symbol_lookup Lookup = bitknit2_symbol_lookup>
+struct basic_bitknit2_state {
+  // The most 16-bit words a single decoding step (a quantum header or one command) can
+  // consume. The incremental decoder only starts a step if this many words are available,
+  // unless it has been told that the input is complete.
+  static constexpr size_t max_step_words = 8;
+  basic_bitknit2_state(uint8_t* dst, size_t dst_len)
+      : src(0, 0, 0), dst(dst), dst_end(dst + dst_len), stream_cur(dst) {}
   bool decode(uint16_t* data, size_t data_len_bytes) {
     src = bounded_stack<uint16_t>(data, data, data + data_len_bytes / 2);
     if (src.cur == src.end || *src.cur != LIBBG3_BITKNIT2_MAGIC) {
@@ -332,8 +526,199 @@ struct bitknit2_state {
     }
     return true;
   }
+  // Feeds the next chunk of compressed data. Decoding stops when the output reaches
+  // limit (clamped to the end of the output buffer), the stream ends, or the input runs
+  // out. Returns the number of bytes of data consumed; this is less than data_len only if
+  // decoding stopped before the input ran out, in which case the caller must pass the
+  // remainder again. Input that can't be decoded yet is buffered internally. Throws on
+  // corrupt input, after which the state must not be used again.
+  size_t decode_incremental(uint8_t const* data, size_t data_len, uint8_t* limit) {
+    limit = std::min(limit, dst_end);
+    size_t consumed = 0;
+    if (carry_len) {
+      // Top up the carry buffer and decode from it until we're past the carried bytes,
+      // then continue directly from data.
+      size_t carried = carry_len;
+      size_t take = std::min(data_len, carry.size() - carry_len);
+      memcpy(carry.data() + carry_len, data, take);
+      carry_len += take;
+      size_t used = run_incremental(carry.data(), carry_len, limit, false);
+      if (stopped(limit)) {
+        if (used < carried) {
+          drop_carry(used);
+          carry_len = carried - used;
+          return 0;
+        }
+        carry_len = 0;
+        return used - carried;
+      }
+      if (take == data_len) {
+        drop_carry(used);
+        return data_len;
+      }
+      // The carry buffer is much larger than a step, so running out of input in it means
+      // we got past the carried bytes.
+      assert(used >= carried);
+      consumed = used - carried;
+      carry_len = 0;
+    }
+    consumed += run_incremental(data + consumed, data_len - consumed, limit, false);
+    if (stopped(limit)) {
+      return consumed;
+    }
+    carry_len = data_len - consumed;
+    assert(carry_len < carry.size() / 2);
+    memcpy(carry.data(), data + consumed, carry_len);
+    return data_len;
+  }
+  size_t decode_incremental(uint8_t const* data, size_t data_len) {
+    return decode_incremental(data, data_len, dst_end);
+  }
+  // Decodes any buffered input on the assumption that no more is coming. Returns true if
+  // the output buffer has been filled completely. Throws on corrupt input.
+  bool finish() {
+    size_t used = run_incremental(carry.data(), carry_len, dst_end, true);
+    drop_carry(used);
+    return finished();
+  }
+  // Like finish, but if the buffered input doesn't complete the stream the state is left
+  // as it was, so more input can still be fed. This saves a copy of the whole state,
+  // adaptive models included, so it isn't meant to be called after every chunk.
+  bool try_finish() {
+    basic_bitknit2_state saved = *this;
+    try {
+      if (finish()) {
+        return true;
+      }
+    } catch (std::exception const&) {
+    }
+    *this = saved;
+    return false;
+  }
+  bool finished() const { return phase == stream_phase::done; }
+  uint8_t* output_cursor() const { return stream_cur; }
 
  private:
+  enum class stream_phase : uint8_t { magic, quantum_start, raw, quantum, done };
+  bool stopped(uint8_t* limit) const { return finished() || stream_cur >= limit; }
+  void drop_carry(size_t used) {
+    memmove(carry.data(), carry.data() + used, carry_len - used);
+    carry_len -= used;
+  }
+  // The incremental equivalent of decode/decode_quantum. State that lives in locals there
+  // is kept in members between calls. Returns the number of bytes of data consumed, which
+  // is a whole number of words except at the end of the stream.
+  size_t run_incremental(uint8_t const* data,
+                         size_t data_len,
+                         uint8_t* limit,
+                         bool final) {
+    uint16_t* words = (uint16_t*)data;
+    src = bounded_stack<uint16_t>(words, words, words + data_len / 2);
+    rans_state<uint32_t> state1 = stream_state1, state2 = stream_state2;
+    uint8_t* cur = stream_cur;
+    bool tail_byte = false;
+    // Once the input is complete, commands are always attempted: the last few symbols of
+    // a quantum are usually decoded from the rANS state alone.
+    auto has_input = [&] {
+      return final || size_t(src.end - src.cur) >= max_step_words;
+    };
+    for (;;) {
+      if (copy_remaining) {
+        if (cur >= limit) {
+          break;
+        }
+        size_t copy_len = std::min(copy_remaining, size_t(limit - cur));
+        copy_match(cur, delta_offset, copy_len);
+        copy_remaining -= copy_len;
+        if (copy_remaining) {
+          break;
+        }
+      }
+      if (phase == stream_phase::quantum && cur >= stream_quantum_end) {
+        if (state1.bits != 0x10000 || state2.bits != 0x10000) {
+          throw std::runtime_error("rANS stream corrupted");
+        }
+        phase = stream_phase::quantum_start;
+      } else if (phase == stream_phase::raw && cur >= stream_quantum_end) {
+        // Like decode_quantum, an odd-length raw quantum leaves the word holding its last
+        // byte to be read again, unless it ends the stream.
+        if (raw_half && cur == dst_end) {
+          tail_byte = true;
+        }
+        raw_half = false;
+        phase = stream_phase::quantum_start;
+      }
+      if (phase == stream_phase::quantum_start && cur == dst_end) {
+        phase = stream_phase::done;
+      }
+      if (phase == stream_phase::done || cur >= limit) {
+        break;
+      }
+      if (phase == stream_phase::magic) {
+        if (src.cur == src.end) {
+          break;
+        }
+        if (src.pop() != LIBBG3_BITKNIT2_MAGIC) {
+          throw std::runtime_error("invalid BitKnit2 magic");
+        }
+        phase = stream_phase::quantum_start;
+      } else if (phase == stream_phase::quantum_start) {
+        if (src.cur == src.end || !has_input()) {
+          break;
+        }
+        size_t offset = cur - dst;
+        size_t boundary =
+            std::min(size_t(dst_end - dst), (offset & ~size_t(0xFFFF)) + 0x10000);
+        stream_quantum_end = dst + boundary;
+        if (!*src.cur) {
+          src.cur++;
+          phase = stream_phase::raw;
+          continue;
+        }
+        decode_initial_state(state1, state2);
+        if (cur == dst) {
+          *cur++ = pop_bits(8, state1, state2);
+        }
+        phase = stream_phase::quantum;
+      } else if (phase == stream_phase::raw) {
+        // Raw bytes are consumed a byte at a time, but we only ever report whole words as
+        // consumed. raw_half marks the low byte of the next word as already copied.
+        size_t pos = ((uint8_t const*)src.cur - data) + raw_half;
+        size_t copy_len =
+            std::min({pos < data_len ? data_len - pos : 0,
+                      size_t(stream_quantum_end - cur), size_t(limit - cur)});
+        if (!copy_len) {
+          break;
+        }
+        memcpy(cur, data + pos, copy_len);
+        cur += copy_len;
+        size_t total = raw_half + copy_len;
+        src.cur += total / 2;
+        raw_half = total & 1;
+      } else {
+        while (cur < stream_quantum_end && cur < limit && has_input()) {
+          size_t model_index = size_t(cur - dst) % 4;
+          uint32_t command = pop_model(command_word_models[model_index], state1, state2);
+          if (command >= 256) {
+            uint32_t copy_length = decode_copy_params(command, state1, state2, cur);
+            size_t copy_len = std::min(size_t(copy_length), size_t(limit - cur));
+            copy_match(cur, delta_offset, copy_len);
+            copy_remaining = copy_length - copy_len;
+          } else {
+            *cur = command + *(cur - delta_offset);
+            cur++;
+          }
+        }
+        if (cur < stream_quantum_end && cur < limit) {
+          break;
+        }
+      }
+    }
+    stream_cur = cur;
+    stream_state1 = state1;
+    stream_state2 = state2;
+    return (uint8_t const*)src.cur - data + tail_byte;
+  }
   void LIBBG3_FORCEINLINE decode_quantum(uint8_t*& dst_cur) {
     size_t offset = dst_cur - dst;
     size_t boundary =
@@ -358,7 +743,7 @@ struct bitknit2_state {
     }
     uint8_t* cur_tmp = dst_cur;  // clang does slightly better this way
     while (cur_tmp < quantum_end) {
-      size_t model_index = size_t(cur_tmp) % 4;
+      size_t model_index = size_t(cur_tmp - dst) % 4;
       uint32_t command = pop_model(command_word_models[model_index], state1, state2);
       if (command >= 256) {
         decode_copy(command, state1, state2, cur_tmp);
@@ -376,7 +761,15 @@ struct bitknit2_state {
                                       rans_state<uint32_t>& state1,
                                       rans_state<uint32_t>& state2,
                                       uint8_t*& dst_cur) {
-    size_t model_index = size_t(dst_cur) % 4;
+    uint32_t copy_length = decode_copy_params(command, state1, state2, dst_cur);
+    copy_match(dst_cur, delta_offset, copy_length);
+  }
+  // Decodes the length and offset of a copy command. The offset is left in delta_offset.
+  uint32_t LIBBG3_FORCEINLINE decode_copy_params(uint32_t command,
+                                                 rans_state<uint32_t>& state1,
+                                                 rans_state<uint32_t>& state2,
+                                                 uint8_t* dst_cur) {
+    size_t model_index = size_t(dst_cur - dst) % 4;
     uint32_t copy_length;
     if (command < 288) {
       // Min copy length is 2, giving this variant a max copy length of 33.
@@ -411,10 +804,18 @@ struct bitknit2_state {
       throw std::out_of_range("invalid copy length");
     }
     delta_offset = copy_offset;
-    for (size_t i = 0; i < copy_length; ++i) {
-      *dst_cur = *(dst_cur - copy_offset);
-      dst_cur++;
+    return copy_length;
+  }
+  void LIBBG3_FORCEINLINE copy_match(uint8_t*& dst_cur, size_t offset, size_t length) {
+    // Short matches with a small period are the one case where copy_match_wide is
+    // slower, since it would expand them bytewise anyway after checking for it.
+    bool short_period = offset >= 2 && offset < 16 && length <= 16;
+    if (!short_period && size_t(dst_end - dst_cur) >= length + copy_match_slack) {
+      copy_match_wide(dst_cur, offset, length);
+    } else {
+      copy_match_scalar(dst_cur, offset, length);
     }
+    dst_cur += length;
   }
   uint32_t LIBBG3_FORCEINLINE pop_bits(int nbits,
                                        rans_state<uint32_t>& state1,
@@ -445,18 +846,367 @@ struct bitknit2_state {
     // High bits from merged_state, low bits from stream
     state2.bits = (merged_state.bits << 16) | src.pop();
     // Mask off high bits that went to state1
-    state2.bits = state2.bits & ((1 << (16 + split_point)) - 1);
+    state2.bits = state2.bits & ((1u << (16 + split_point)) - 1);
     // Set high order bit
-    state2.bits |= 1 << (16 + split_point);
+    state2.bits |= 1u << (16 + split_point);
   }
   bounded_stack<uint16_t> src;
   uint8_t *dst, *dst_end;
-  std::array<deferred_adaptive_model<uint16_t, 1024, 300, 36, 15, 10>, 4>
-      command_word_models;
-  std::array<deferred_adaptive_model<uint16_t, 1024, 40, 0, 15, 10>, 4>
-      cache_reference_models;
-  deferred_adaptive_model<uint16_t, 1024, 21, 0, 15, 10> copy_offset_model;
+  // Incremental decoding state.
+  uint8_t *stream_cur, *stream_quantum_end{nullptr};
+  stream_phase phase{stream_phase::magic};
+  bool raw_half{false};
+  size_t copy_remaining{0};
+  rans_state<uint32_t> stream_state1, stream_state2;
+  std::array<uint8_t, max_step_words * 8> carry;
+  size_t carry_len{0};
+  std::array<bitknit2_command_word_model<Lookup>, 4> command_word_models;
+  std::array<bitknit2_cache_reference_model<Lookup>, 4> cache_reference_models;
+  bitknit2_copy_offset_model<Lookup> copy_offset_model;
   register_lru_cache<uint32_t> copy_offset_cache;
   size_t delta_offset{1};
 };
+
+using bitknit2_state = basic_bitknit2_state<>;
+
+// Compresses data into BitKnit2 streams that bitknit2_state can decode.
+//
+// Each 64KiB quantum is parsed with a hash chain match finder, with the offset cache
+// checked first since repeated offsets are much cheaper to code. Symbols are run through
+// the same adaptive models as the decoder in the forward direction, recording the
+// frequency ranges used, and then pushed onto the rANS states in reverse. Quanta that
+// don't shrink are stored raw. Copies never cross a quantum boundary.
+struct bitknit2_encoder {
+  static constexpr int min_level = 1;
+  static constexpr int max_level = 9;
+  static constexpr int default_level = 6;
+  // Copy lengths are 2..33 directly, or up to 12 extra bits past 32.
+  static constexpr size_t min_copy_length = 2;
+  static constexpr size_t max_copy_length = 32 + (1 << 13) - 1;
+  static constexpr size_t window_size = 1 << 20;
+  explicit bitknit2_encoder(int level = default_level)
+      : params(level_params[std::clamp(level, min_level, max_level) - min_level]) {}
+  // The output size for incompressible data: the magic, a NUL word per quantum, the data
+  // and a padding byte.
+  static size_t max_encoded_size(size_t src_len) {
+    return 2 + (src_len + 0xFFFF) / 0x10000 * 2 + src_len + 1;
+  }
+  // Compresses src into dst, returning the number of bytes written. The output is always
+  // a whole number of words. Throws std::out_of_range if dst_capacity is too small;
+  // max_encoded_size(src_len) is always enough.
+  size_t encode(uint8_t const* src, size_t src_len, uint8_t* dst, size_t dst_capacity) {
+    size_t dst_len = 0;
+    auto emit = [&](void const* data, size_t len) {
+      if (len > dst_capacity - dst_len) {
+        throw std::out_of_range("output buffer too small");
+      }
+      memcpy(dst + dst_len, data, len);
+      dst_len += len;
+    };
+    uint16_t magic = LIBBG3_BITKNIT2_MAGIC;
+    emit(&magic, sizeof(magic));
+    models = model_state();
+    size_t window = std::min(window_size, std::bit_ceil(std::max(src_len, size_t(1))));
+    head.assign(size_t(1) << hash_bits, 0);
+    prev.assign(window, 0);
+    window_mask = window - 1;
+    scratch.resize(0x10000 / 2 + 8);
+    for (size_t start = 0; start < src_len; start += 0x10000) {
+      size_t end = std::min(src_len, start + 0x10000);
+      model_state saved = models;
+      parse_quantum(src, src_len, start, end);
+      bounded_stack<uint16_t> stream(scratch.data(), scratch.data() + scratch.size(),
+                                     scratch.data() + scratch.size());
+      bool compressed = true;
+      try {
+        encode_quantum(stream);
+      } catch (std::out_of_range const&) {
+        compressed = false;
+      }
+      size_t compressed_len = (stream.end - stream.cur) * 2;
+      if (compressed && compressed_len < end - start + 2) {
+        emit(stream.cur, compressed_len);
+      } else {
+        // The decoder doesn't touch its models for raw quanta.
+        models = saved;
+        uint16_t raw_marker = 0;
+        emit(&raw_marker, sizeof(raw_marker));
+        emit(src + start, end - start);
+      }
+    }
+    if (dst_len % 2) {
+      uint8_t padding = 0;
+      emit(&padding, 1);
+    }
+    return dst_len;
+  }
+
+ private:
+  struct level_params_t {
+    uint32_t max_chain;
+    uint32_t nice_length;
+    bool lazy;
+  };
+  static constexpr std::array<level_params_t, max_level - min_level + 1> level_params = {{
+      {1, 16, false},
+      {4, 24, false},
+      {8, 32, false},
+      {8, 32, true},
+      {16, 64, true},
+      {32, 128, true},
+      {96, 256, true},
+      {256, 1024, true},
+      {1024, max_copy_length, true},
+  }};
+  static constexpr int hash_bits = 17;
+  // Everything the decoder would also track, so that a quantum can be rolled back.
+  // The encoder never maps codes back to symbols, so it uses the strategy with no lookup
+  // table to rebuild.
+  struct model_state {
+    std::array<bitknit2_command_word_model<symbol_lookup::simd>, 4> command_word_models;
+    std::array<bitknit2_cache_reference_model<symbol_lookup::simd>, 4>
+        cache_reference_models;
+    bitknit2_copy_offset_model<symbol_lookup::simd> copy_offset_model;
+    register_lru_cache<uint32_t> copy_offset_cache;
+    size_t delta_offset{1};
+  };
+  enum class op_kind : uint8_t { cdf, bits, raw };
+  // One operation on the stream, in decoding order. For cdf, value is the sum of the
+  // frequencies below the symbol.
+  struct op {
+    uint16_t value;
+    uint16_t freq;
+    uint8_t nbits;
+    op_kind kind;
+  };
+  struct match {
+    uint32_t length{0};
+    uint32_t offset{0};
+    int32_t score{0};
+  };
+  static uint32_t LIBBG3_FORCEINLINE log2(uint32_t value) {
+    return 31 - __builtin_clz(value);
+  }
+  static size_t LIBBG3_FORCEINLINE match_length(uint8_t const* a,
+                                                uint8_t const* b,
+                                                size_t max_len) {
+    size_t len = 0;
+    while (len + 8 <= max_len) {
+      uint64_t x, y;
+      memcpy(&x, a + len, 8);
+      memcpy(&y, b + len, 8);
+      if (x != y) {
+        return len + (__builtin_ctzll(x ^ y) >> 3);
+      }
+      len += 8;
+    }
+    while (len < max_len && a[len] == b[len]) {
+      len++;
+    }
+    return len;
+  }
+  static uint32_t LIBBG3_FORCEINLINE hash(uint8_t const* data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return (value * 2654435761u) >> (32 - hash_bits);
+  }
+  // Rough number of bits saved by coding a copy instead of literals.
+  static int32_t LIBBG3_FORCEINLINE score(uint32_t length, uint32_t offset, bool cached) {
+    int32_t cost = 6 + (length > 33 ? log2(length - 32) : 0);
+    if (cached) {
+      cost += 3;
+    } else {
+      cost += 9 + log2(((offset - 1) >> 5) + 1);
+    }
+    return int32_t(length * 8) - cost;
+  }
+  void insert(uint8_t const* src, size_t src_len, size_t pos) {
+    if (pos + 4 > src_len) {
+      return;
+    }
+    uint32_t& bucket = head[hash(src + pos)];
+    prev[pos & window_mask] = bucket;
+    bucket = pos + 1;
+  }
+  match find_match(uint8_t const* src, size_t src_len, size_t pos, size_t end) {
+    match best;
+    size_t max_len = std::min(end - pos, max_copy_length);
+    if (max_len < min_copy_length) {
+      return best;
+    }
+    for (uint32_t i = 0; i < 8; ++i) {
+      uint32_t offset = models.copy_offset_cache.entry(i);
+      if (offset > pos) {
+        continue;
+      }
+      size_t len = match_length(src + pos, src + pos - offset, max_len);
+      if (len >= min_copy_length) {
+        int32_t s = score(len, offset, true);
+        if (s > best.score) {
+          best = {uint32_t(len), offset, s};
+        }
+      }
+    }
+    if (pos + 4 > src_len) {
+      return best;
+    }
+    uint32_t next = head[hash(src + pos)];
+    for (uint32_t chain = 0; next && chain < params.max_chain; ++chain) {
+      size_t candidate = next - 1;
+      if (candidate >= pos || pos - candidate > window_mask) {
+        break;
+      }
+      next = prev[candidate & window_mask];
+      if (next && next - 1 >= candidate) {
+        next = 0;  // Overwritten by a newer position.
+      }
+      if (best.length >= max_len ||
+          src[candidate + best.length] != src[pos + best.length]) {
+        continue;
+      }
+      size_t len = match_length(src + pos, src + candidate, max_len);
+      if (len < min_copy_length) {
+        continue;
+      }
+      int32_t s = score(len, pos - candidate, false);
+      if (s > best.score) {
+        best = {uint32_t(len), uint32_t(pos - candidate), s};
+        if (len >= params.nice_length) {
+          break;
+        }
+      }
+    }
+    return best;
+  }
+  template <typename Model>
+  void LIBBG3_FORCEINLINE push_model(Model& model, uint32_t sym) {
+    ops.push_back(
+        {model.cdf.sum_below(sym), model.cdf.frequency(sym), 0, op_kind::cdf});
+    model.observe_symbol(sym);
+  }
+  void LIBBG3_FORCEINLINE push_bits(uint32_t value, uint32_t nbits) {
+    ops.push_back({uint16_t(value), 0, uint8_t(nbits), op_kind::bits});
+  }
+  void emit_literal(uint8_t const* src, size_t pos) {
+    uint8_t literal = src[pos] - src[pos - models.delta_offset];
+    push_model(models.command_word_models[pos % 4], literal);
+  }
+  // The inverse of bitknit2_state::decode_copy_params.
+  void emit_copy(size_t pos, uint32_t length, uint32_t offset) {
+    size_t model_index = pos % 4;
+    if (length <= 33) {
+      push_model(models.command_word_models[model_index], length + 254);
+    } else {
+      uint32_t copy_length_length = log2(length - 32);
+      push_model(models.command_word_models[model_index], copy_length_length + 287);
+      push_bits(length - 32 - (1 << copy_length_length), copy_length_length);
+    }
+    register_lru_cache<uint32_t>& cache = models.copy_offset_cache;
+    uint32_t cache_ref = 0;
+    while (cache_ref < 8 && cache.entry(cache_ref) != offset) {
+      cache_ref++;
+    }
+    if (cache_ref < 8) {
+      push_model(models.cache_reference_models[model_index], cache_ref);
+      cache.hit(cache_ref);
+    } else {
+      uint32_t low_bits = ((offset - 1) & 31) + 1;
+      uint32_t value = ((offset - low_bits) >> 5) + 1;
+      uint32_t copy_offset_length = log2(value);
+      uint32_t copy_offset_bits = value - (1 << copy_offset_length);
+      push_model(models.cache_reference_models[model_index], low_bits + 7);
+      push_model(models.copy_offset_model, copy_offset_length);
+      if (copy_offset_length < 16) {
+        push_bits(copy_offset_bits, copy_offset_length);
+      } else {
+        push_bits(copy_offset_bits >> 16, copy_offset_length - 16);
+        ops.push_back({uint16_t(copy_offset_bits), 0, 0, op_kind::raw});
+      }
+      cache.insert(offset);
+    }
+    models.delta_offset = offset;
+  }
+  void parse_quantum(uint8_t const* src, size_t src_len, size_t start, size_t end) {
+    ops.clear();
+    size_t pos = start;
+    if (pos == 0) {
+      push_bits(src[0], 8);
+      insert(src, src_len, pos++);
+    }
+    match m;
+    bool have_match = false;
+    while (pos < end) {
+      if (!have_match) {
+        m = find_match(src, src_len, pos, end);
+      }
+      have_match = false;
+      insert(src, src_len, pos);
+      if (m.score <= 0) {
+        emit_literal(src, pos++);
+        continue;
+      }
+      if (params.lazy && m.length < params.nice_length && pos + 1 < end) {
+        match next = find_match(src, src_len, pos + 1, end);
+        if (next.score > m.score) {
+          emit_literal(src, pos++);
+          m = next;
+          have_match = true;
+          continue;
+        }
+      }
+      emit_copy(pos, m.length, m.offset);
+      for (size_t i = 1; i < m.length; ++i) {
+        insert(src, src_len, pos + i);
+      }
+      pos += m.length;
+    }
+  }
+  // Pushes the recorded ops in reverse, alternating between the two states like the
+  // decoder does, then the initial state words read by decode_initial_state.
+  void encode_quantum(bounded_stack<uint16_t>& stream) {
+    std::array<rans_state<uint32_t>, 2> states;
+    size_t num_coded = 0;
+    for (op const& o : ops) {
+      num_coded += o.kind != op_kind::raw;
+    }
+    for (size_t i = ops.size(); i > 0; --i) {
+      op const& o = ops[i - 1];
+      if (o.kind == op_kind::raw) {
+        stream.push(o.value);
+        continue;
+      }
+      rans_state<uint32_t>& state = states[--num_coded % 2];
+      if (o.kind == op_kind::cdf) {
+        state.push_range<15>(stream, o.value, o.freq);
+      } else {
+        state.push_bits(stream, o.value, o.nbits);
+      }
+    }
+    uint32_t state1 = states[0].bits, state2 = states[1].bits;
+    // The top bit of state2 is implied by split_point, its next split_point bits are
+    // packed below state1 and its low 16 bits are stored as-is.
+    uint32_t split_point = log2(state2) - 16;
+    stream.push(state2 & 0xFFFF);
+    uint32_t packed_state1 = state1;
+    if (state1 >= (uint64_t(1) << (32 - split_point))) {
+      stream.push(state1 & 0xFFFF);
+      packed_state1 = state1 >> 16;
+    }
+    uint32_t merged =
+        (packed_state1 << split_point) | ((state2 >> 16) & ((1 << split_point) - 1));
+    if (merged >= (1 << 28)) {
+      stream.push(merged & 0xFFFF);
+      merged >>= 16;
+    }
+    merged = (merged << 4) | split_point;
+    stream.push(merged & 0xFFFF);
+    stream.push(merged >> 16);
+  }
+  level_params_t params;
+  model_state models;
+  std::vector<op> ops;
+  std::vector<uint32_t> head, prev;
+  size_t window_mask{0};
+  std::vector<uint16_t> scratch;
+};
 }  // namespace rans
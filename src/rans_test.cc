@@ -22,6 +22,7 @@
 
 #include "rans.h"
 
+#include <cmath>
 #include <random>
 
 #include <gtest/gtest.h>
@@ -214,6 +215,69 @@ TEST(RansTest, RansSymFreqLast) {
                 model_t::frequency_incr * model_t::adaptation_interval);
 }
 
+TEST(RansTest, SymbolLookupStrategies) {
+  bitknit2_command_word_model<symbol_lookup::hint> hint;
+  bitknit2_command_word_model<symbol_lookup::direct> direct;
+  bitknit2_command_word_model<symbol_lookup::simd> simd;
+  std::mt19937 rng(4567);
+  std::geometric_distribution<int> dist(0.02);
+  for (int step = 0; step < 8; ++step) {
+    for (size_t code = 0; code < hint.total_sum; ++code) {
+      size_t expected = hint.cdf.find_symbol_slow(code);
+      ASSERT_EQ(expected, hint.cdf.find_symbol(code)) << "code " << code;
+      ASSERT_EQ(expected, direct.cdf.find_symbol(code)) << "code " << code;
+      ASSERT_EQ(expected, simd.cdf.find_symbol(code)) << "code " << code;
+    }
+    for (size_t i = 0; i < hint.adaptation_interval; ++i) {
+      uint16_t sym = std::min(dist(rng), 299);
+      hint.observe_symbol(sym);
+      direct.observe_symbol(sym);
+      simd.observe_symbol(sym);
+    }
+    EXPECT_EQ(hint.cdf.sums, direct.cdf.sums);
+    EXPECT_EQ(hint.cdf.sums, simd.cdf.sums);
+  }
+}
+
+// Checks mix_accumulated_frequencies against the straightforward scalar update, with
+// the favored symbols moving around so that some sums go down.
+template <typename Model>
+static void check_mix_accumulated_frequencies(uint32_t seed) {
+  using T = std::remove_const_t<decltype(Model::total_sum)>;
+  constexpr size_t vocab_size = Model::cdf_t::vocab_size;
+  Model model;
+  std::mt19937 rng(seed);
+  for (int round = 0; round < 32; ++round) {
+    std::uniform_int_distribution<size_t> center(0, vocab_size - 1), spread(1, 40);
+    size_t lo = center(rng), hi = std::min(vocab_size - 1, lo + spread(rng));
+    std::uniform_int_distribution<size_t> dist(lo, hi);
+    for (size_t i = 0; i + 1 < Model::adaptation_interval; ++i) {
+      model.observe_symbol(dist(rng));
+    }
+    T sym = dist(rng);
+    Model expected = model;
+    expected.frequency_accumulator[sym] +=
+        Model::frequency_incr + Model::last_frequency_incr;
+    typename unsigned_t<sizeof(T) * 2>::type sum = 0;
+    for (size_t i = 1; i <= vocab_size; ++i) {
+      sum += expected.frequency_accumulator[i - 1];
+      expected.cdf.sums[i] += (sum - expected.cdf.sums[i]) / 2;
+    }
+    EXPECT_TRUE(model.observe_symbol(sym));
+    ASSERT_EQ(expected.cdf.sums, model.cdf.sums) << "round " << round;
+    EXPECT_EQ(Model::total_sum, model.cdf.sums[vocab_size]);
+  }
+}
+
+TEST(RansTest, MixAccumulatedFrequencies) {
+  check_mix_accumulated_frequencies<bitknit2_command_word_model<>>(1);
+  check_mix_accumulated_frequencies<bitknit2_copy_offset_model<>>(2);
+  check_mix_accumulated_frequencies<
+      deferred_adaptive_model<uint32_t, 1024, 256, 192, 15, 6>>(3);
+  check_mix_accumulated_frequencies<
+      deferred_adaptive_model<uint32_t, 1024, 257, 0, 28, 0>>(4);
+}
+
 TEST(RansTest, RegisterLruCache) {
   register_lru_cache<uint32_t> cache;
   cache.insert(42);
@@ -224,3 +288,276 @@ TEST(RansTest, RegisterLruCache) {
   EXPECT_EQ(42, cache.entry(0));
   EXPECT_EQ(420, cache.entry(7));
 }
+
+// Builds a BitKnit2 stream made only of raw (stored) quanta.
+static std::vector<uint8_t> bitknit2_raw_stream(std::vector<uint8_t> const& data) {
+  std::vector<uint8_t> stream = {LIBBG3_BITKNIT2_MAGIC & 0xFF,
+                                 LIBBG3_BITKNIT2_MAGIC >> 8};
+  for (size_t i = 0; i < data.size(); i += 0x10000) {
+    size_t quantum_len = std::min(data.size() - i, size_t(0x10000));
+    stream.insert(stream.end(), {0, 0});
+    stream.insert(stream.end(), data.begin() + i, data.begin() + i + quantum_len);
+  }
+  return stream;
+}
+
+static std::vector<uint8_t> random_bytes(size_t len, uint32_t seed) {
+  std::vector<uint8_t> data(len);
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> dist(0, 255);
+  for (auto& value : data) {
+    value = dist(rng);
+  }
+  return data;
+}
+
+TEST(RansTest, BitKnit2IncrementalChunks) {
+  std::vector<uint8_t> data = random_bytes(150001, 12345);
+  std::vector<uint8_t> stream = bitknit2_raw_stream(data);
+  for (size_t chunk_len : {1, 3, 8, 17, 4096, 100000}) {
+    std::vector<uint8_t> output(data.size());
+    bitknit2_state state(output.data(), output.size());
+    for (size_t i = 0; i < stream.size(); i += chunk_len) {
+      size_t len = std::min(chunk_len, stream.size() - i);
+      EXPECT_EQ(len, state.decode_incremental(stream.data() + i, len));
+    }
+    EXPECT_TRUE(state.finish());
+    EXPECT_EQ(data, output);
+  }
+}
+
+TEST(RansTest, BitKnit2IncrementalLimit) {
+  std::vector<uint8_t> data = random_bytes(150000, 23456);
+  std::vector<uint8_t> stream = bitknit2_raw_stream(data);
+  std::vector<uint8_t> output(data.size());
+  bitknit2_state state(output.data(), output.size());
+  size_t consumed = 0;
+  for (size_t limit = 0; !state.finished(); limit += 999) {
+    consumed += state.decode_incremental(stream.data() + consumed,
+                                         stream.size() - consumed, output.data() + limit);
+    EXPECT_EQ(output.data() + std::min(limit, output.size()), state.output_cursor());
+  }
+  EXPECT_EQ(stream.size(), consumed);
+  EXPECT_EQ(data, output);
+}
+
+TEST(RansTest, BitKnit2IncrementalTruncated) {
+  std::vector<uint8_t> data = random_bytes(1000, 34567);
+  std::vector<uint8_t> stream = bitknit2_raw_stream(data);
+  std::vector<uint8_t> output(data.size());
+  bitknit2_state state(output.data(), output.size());
+  state.decode_incremental(stream.data(), stream.size() - 10);
+  EXPECT_FALSE(state.try_finish());
+  state.decode_incremental(stream.data() + stream.size() - 10, 10);
+  EXPECT_TRUE(state.try_finish());
+  EXPECT_EQ(data, output);
+  bitknit2_state truncated(output.data(), output.size());
+  truncated.decode_incremental(stream.data(), stream.size() - 10);
+  EXPECT_FALSE(truncated.finish());
+  std::vector<uint8_t> bad_magic = {0x12, 0x34, 0, 0};
+  bitknit2_state corrupt(output.data(), output.size());
+  EXPECT_THROW(corrupt.decode_incremental(bad_magic.data(), bad_magic.size()),
+               std::runtime_error);
+}
+
+// Text-ish data with plenty of repeats at varying distances, plus some noise.
+static std::vector<uint8_t> compressible_bytes(size_t len, uint32_t seed) {
+  static char const* words[] = {"Gustav", "Shared", "RootTemplates", "_merged.lsf",
+                                "Generated", "Public", "Assets", "HLOD", " ", "/"};
+  std::vector<uint8_t> data;
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> word(0, 9), noise(0, 15), byte(0, 255);
+  while (data.size() < len) {
+    char const* w = words[word(rng)];
+    data.insert(data.end(), w, w + strlen(w));
+    if (!noise(rng)) {
+      data.push_back(byte(rng));
+    }
+  }
+  data.resize(len);
+  return data;
+}
+
+static std::vector<uint8_t> bitknit2_compress(std::vector<uint8_t> const& data,
+                                              int level) {
+  bitknit2_encoder encoder(level);
+  std::vector<uint8_t> stream(bitknit2_encoder::max_encoded_size(data.size()));
+  stream.resize(encoder.encode(data.data(), data.size(), stream.data(), stream.size()));
+  return stream;
+}
+
+static std::vector<uint8_t> bitknit2_decompress(std::vector<uint8_t> stream,
+                                                size_t output_len) {
+  std::vector<uint8_t> output(output_len);
+  bitknit2_state state(output.data(), output.size());
+  EXPECT_TRUE(state.decode((uint16_t*)stream.data(), stream.size()));
+  return output;
+}
+
+TEST(RansTest, BitKnit2RoundTrip) {
+  for (int level = bitknit2_encoder::min_level; level <= bitknit2_encoder::max_level;
+       ++level) {
+    std::vector<uint8_t> data = compressible_bytes(300000, level);
+    std::vector<uint8_t> stream = bitknit2_compress(data, level);
+    EXPECT_LT(stream.size(), data.size() / 3);
+    EXPECT_EQ(0, stream.size() % 2);
+    EXPECT_EQ(data, bitknit2_decompress(stream, data.size()));
+  }
+}
+
+TEST(RansTest, BitKnit2RoundTripEdgeCases) {
+  for (size_t len : {0, 1, 2, 3, 33, 34, 65535, 65536, 65537}) {
+    std::vector<uint8_t> data(len, 'a');
+    EXPECT_EQ(data, bitknit2_decompress(bitknit2_compress(data, 6), len));
+  }
+  // Incompressible data must fall back to raw quanta.
+  std::vector<uint8_t> noise = random_bytes(200001, 45678);
+  std::vector<uint8_t> stream = bitknit2_compress(noise, 9);
+  EXPECT_EQ(bitknit2_encoder::max_encoded_size(noise.size()), stream.size());
+  EXPECT_EQ(noise, bitknit2_decompress(stream, noise.size()));
+  // Long copies, far offsets and repeated offsets.
+  std::vector<uint8_t> mixed = random_bytes(20000, 56789);
+  for (size_t i = 0; i < 40; ++i) {
+    mixed.insert(mixed.end(), mixed.begin() + i * 311, mixed.begin() + i * 311 + i * 97);
+    mixed.insert(mixed.end(), 9000, uint8_t(i));
+    mixed.push_back(i * 7);
+  }
+  EXPECT_EQ(mixed, bitknit2_decompress(bitknit2_compress(mixed, 9), mixed.size()));
+  EXPECT_EQ(mixed, bitknit2_decompress(bitknit2_compress(mixed, 1), mixed.size()));
+}
+
+TEST(RansTest, BitKnit2RoundTripIncremental) {
+  std::vector<uint8_t> data = compressible_bytes(200000, 67890);
+  std::vector<uint8_t> stream = bitknit2_compress(data, 6);
+  for (size_t chunk_len : {1, 5, 16, 1000}) {
+    std::vector<uint8_t> output(data.size());
+    bitknit2_state state(output.data(), output.size());
+    size_t consumed = 0;
+    for (size_t limit = 0; consumed < stream.size(); limit += 777) {
+      size_t len = std::min(chunk_len, stream.size() - consumed);
+      consumed += state.decode_incremental(stream.data() + consumed, len,
+                                           output.data() + limit);
+    }
+    EXPECT_TRUE(state.finish());
+    EXPECT_EQ(data, output);
+  }
+}
+
+TEST(RansTest, CopyMatchWide) {
+  std::vector<uint8_t> seed = random_bytes(64, 78901);
+  for (size_t offset = 1; offset <= 64; ++offset) {
+    for (size_t length = 0; length <= 300; ++length) {
+      std::vector<uint8_t> expected(64 + length + copy_match_slack, 0xAA);
+      std::copy(seed.begin(), seed.end(), expected.begin());
+      std::vector<uint8_t> actual = expected;
+      copy_match_scalar(expected.data() + 64, offset, length);
+      copy_match_wide(actual.data() + 64, offset, length);
+      ASSERT_TRUE(std::equal(expected.begin(), expected.begin() + 64 + length,
+                             actual.begin()))
+          << "offset " << offset << " length " << length;
+    }
+  }
+}
+
+static double elapsed_seconds(struct timespec const& start, struct timespec const& end) {
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+template <typename Fn>
+static double copy_match_throughput(Fn fn, size_t offset, size_t length) {
+  std::vector<uint8_t> buf(1 << 20);
+  std::vector<uint8_t> seed = random_bytes(64, 89012);
+  std::copy(seed.begin(), seed.end(), buf.begin());
+  size_t total = 0;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int rep = 0; rep < 8; ++rep) {
+    for (size_t pos = 64; pos + length + copy_match_slack <= buf.size(); pos += length) {
+      fn(buf.data() + pos, offset, length);
+      total += length;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return total / elapsed_seconds(start, end) / 1e9;
+}
+
+// Not really a test, just prints GB/s for each offset/length class.
+TEST(RansTest, CopyMatchBenchmark) {
+  printf("%8s %8s %10s %10s %8s\n", "offset", "length", "scalar", "wide", "speedup");
+  for (size_t offset : {1, 2, 3, 4, 7, 8, 13, 16, 31, 32, 100}) {
+    for (size_t length : {4, 16, 33, 128, 1024, 8223}) {
+      double scalar = copy_match_throughput(copy_match_scalar, offset, length);
+      double wide = copy_match_throughput(copy_match_wide, offset, length);
+      printf("%8zu %8zu %10.2f %10.2f %7.2fx\n", offset, length, scalar, wide,
+             wide / scalar);
+    }
+  }
+}
+
+// Interleaved position/normal/uv floats for a displaced grid followed by its triangle
+// list, which is roughly what the compressed sections of a GR2 mesh look like.
+static std::vector<uint8_t> mesh_like_bytes(size_t grid) {
+  std::vector<uint8_t> data;
+  auto append = [&](auto const& value) {
+    uint8_t const* bytes = (uint8_t const*)&value;
+    data.insert(data.end(), bytes, bytes + sizeof(value));
+  };
+  for (size_t y = 0; y < grid; ++y) {
+    for (size_t x = 0; x < grid; ++x) {
+      float dzdx = 0.04f * cosf(x * 0.2f) * cosf(y * 0.3f);
+      float dzdy = -0.06f * sinf(x * 0.2f) * sinf(y * 0.3f);
+      float inv_len = 1.0f / sqrtf(dzdx * dzdx + dzdy * dzdy + 1.0f);
+      std::array<float, 8> vertex = {x * 0.1f,
+                                     y * 0.1f,
+                                     0.2f * sinf(x * 0.2f) * cosf(y * 0.3f),
+                                     -dzdx * inv_len,
+                                     -dzdy * inv_len,
+                                     inv_len,
+                                     x / float(grid - 1),
+                                     y / float(grid - 1)};
+      append(vertex);
+    }
+  }
+  for (size_t y = 0; y + 1 < grid; ++y) {
+    for (size_t x = 0; x + 1 < grid; ++x) {
+      uint16_t i = y * grid + x;
+      std::array<uint16_t, 6> indices = {i, uint16_t(i + 1), uint16_t(i + grid),
+                                         uint16_t(i + 1), uint16_t(i + grid + 1),
+                                         uint16_t(i + grid)};
+      append(indices);
+    }
+  }
+  return data;
+}
+
+template <symbol_lookup Lookup>
+static double bitknit2_decode_throughput(std::vector<uint8_t> stream, size_t output_len) {
+  std::vector<uint8_t> output(output_len);
+  double shortest = 1e9;
+  for (int rep = 0; rep < 5; ++rep) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    basic_bitknit2_state<Lookup> state(output.data(), output.size());
+    EXPECT_TRUE(state.decode((uint16_t*)stream.data(), stream.size()));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    shortest = std::min(shortest, elapsed_seconds(start, end));
+  }
+  return output_len / shortest / 1e6;
+}
+
+// Not really a test, just prints decode MB/s for each symbol lookup strategy.
+TEST(RansTest, SymbolLookupBenchmark) {
+  printf("%8s %8s %10s %10s %10s\n", "input", "ratio", "hint", "direct", "simd");
+  std::pair<char const*, std::vector<uint8_t>> inputs[] = {
+      {"mesh", mesh_like_bytes(256)},
+      {"text", compressible_bytes(1 << 21, 34567)},
+      {"random", random_bytes(1 << 21, 45678)},
+  };
+  for (auto const& [name, data] : inputs) {
+    std::vector<uint8_t> stream = bitknit2_compress(data, 6);
+    printf("%8s %8.3f %10.1f %10.1f %10.1f\n", name, double(stream.size()) / data.size(),
+           bitknit2_decode_throughput<symbol_lookup::hint>(stream, data.size()),
+           bitknit2_decode_throughput<symbol_lookup::direct>(stream, data.size()),
+           bitknit2_decode_throughput<symbol_lookup::simd>(stream, data.size()));
+  }
+}
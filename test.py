@@ -2,10 +2,9 @@ import os
 import re
 import time
 import numpy as np
-from numpy.lib import recfunctions as rfn
 from dataclasses import dataclass
 from pathlib import Path
-from pybg3 import pak, lsf, _pybg3
+from pybg3 import pak, lsf, objects, _pybg3
 from pxr import Usd, UsdGeom, Vt, Gf
 
 
@@ -46,24 +45,28 @@ class LevelSet:
         return self.levels[name]
 
     def load_pak(self, pak):
+        matches = {}
         for name in pak.files():
             match = LEVEL_OBJECT_FILE_RE.match(name)
             if match:
-                mod_name = match.group("mod_name")
-                level_name = match.group("level_name")
-                type = match.group("type")
-                file_name = match.group("file_name")
-                level = self.get_or_create(level_name)
-                level.sources.append(
-                    LevelObjectSource(
-                        mod_name,
-                        level_name,
-                        type,
-                        file_name,
-                        pak,
-                        lsf.loads(pak.file_data(name)),
-                    )
+                matches[name] = match
+        for name, data in pak.extract_many(matches.keys(), threads=0):
+            match = matches[name]
+            mod_name = match.group("mod_name")
+            level_name = match.group("level_name")
+            type = match.group("type")
+            file_name = match.group("file_name")
+            level = self.get_or_create(level_name)
+            level.sources.append(
+                LevelObjectSource(
+                    mod_name,
+                    level_name,
+                    type,
+                    file_name,
+                    pak,
+                    lsf.loads(data),
                 )
+            )
 
 
 class Asset:
@@ -79,64 +82,90 @@ class Asset:
         return self._node
 
 
-class AssetSet:
-    def __init__(self):
-        self.by_uuid = {}
-        self.by_name = {}
+# The objects of one table of an objects.ObjectIndex, each only wrapped by
+# factory(key, file, node_idx) when it is first looked up.
+class ObjectMap:
+    def __init__(self, index, table, factory):
+        self._index = index
+        self._table = table
+        self._factory = factory
+        self._objects = {}
+
+    def get(self, key, default=None):
+        obj = self._objects.get(key)
+        if obj is None:
+            found = self._index.lookup(self._table, key)
+            if found is None:
+                return default
+            obj = self._objects[key] = self._factory(key, *found)
+        return obj
+
+    def __getitem__(self, key):
+        obj = self.get(key)
+        if obj is None:
+            raise KeyError(key)
+        return obj
+
+    def __contains__(self, key):
+        return self._index.find(self._table, key) is not None
 
+    def __len__(self):
+        return self._index.tables().get(self._table, 0)
 
-class AssetTypeSet:
-    def __init__(self):
-        self._types = {}
 
-    def _index_asset_banks(self, asset_banks):
-        asset_banks.ensure_sibling_pointers()
-        n = asset_banks.num_nodes()
-        if n == 0:
-            return
-        node_idx = 0
-        while node_idx != -1:
-            name, _, next, _ = asset_banks.node(node_idx)
-            asset_type = name.replace("Bank", "")
-            if node_idx + 1 < n:
-                _, next_parent, _, _ = asset_banks.node(node_idx + 1)
-                if next_parent == node_idx:
-                    self._index_bank_native(
-                        self.get_or_create(asset_type), asset_banks, node_idx + 1
-                    )
-            node_idx = next
+class AssetSet:
+    def __init__(self, index, asset_type):
+        self.by_uuid = ObjectMap(index, f"{asset_type}/ID", self._asset)
+        self.by_name = ObjectMap(index, f"{asset_type}/Name", self._asset)
 
-    def _index_bank_native(self, asset_set, asset_banks, node_idx):
-        by_uuid = asset_set.by_uuid
-        by_name = asset_set.by_name
+    @staticmethod
+    def _asset(key, asset_banks, node_idx):
+        return Asset(asset_banks, node_idx)
 
-        def handle(idx, name, uuid):
-            asset = Asset(asset_banks, idx)
-            by_uuid[uuid] = asset
-            by_name[name] = asset
 
-        asset_banks.scan_unique_objects(handle, "Name", "ID", node_idx)
+class AssetTypeSet:
+    def __init__(self, index):
+        self._index = index
+        self._types = {}
+        for table in index.tables():
+            asset_type, _ = table.split("/", 1)
+            if asset_type != "RootTemplate":
+                self.get_or_create(asset_type)
 
     def get_or_create(self, name):
         if name not in self._types:
-            self._types[name] = AssetSet()
+            self._types[name] = AssetSet(self._index, name)
         return self._types[name]
 
-    def load_pak(self, pak):
-        for name in pak.files():
-            if "[PAK]" in name and name.endswith(".lsf"):
-                asset_banks = lsf.loads(pak.file_data(name))
-                self._index_asset_banks(asset_banks)
-
 
 class RootTemplate:
+    # Templates are looked up by either uuid or name, so the other one is only read
+    # from the node's attributes when it's asked for.
     def __init__(self, uuid, name, file, node_idx):
-        self.name = name
-        self.uuid = uuid
+        self._uuid = uuid
+        self._name = name
         self._file = file
         self._node_idx = node_idx
         self._node = None
 
+    def _attr(self, key):
+        for name, _, _, _, value in self._file.attrs(self._node_idx):
+            if name == key:
+                return value
+        return None
+
+    @property
+    def name(self):
+        if self._name is None:
+            self._name = self._attr("Name")
+        return self._name
+
+    @property
+    def uuid(self):
+        if self._uuid is None:
+            self._uuid = self._attr("MapKey")
+        return self._uuid
+
     @property
     def node(self):
         if self._node is None:
@@ -156,26 +185,17 @@ class RootTemplate:
 
 
 class RootTemplateSet:
-    def __init__(self):
-        self.by_name = {}
-        self.by_uuid = {}
-
-    def _index_root_templates(self, root_templates):
-        by_uuid = self.by_uuid
-        by_name = self.by_name
-
-        def handle(idx, name_value, uuid_value):
-            template = RootTemplate(uuid_value, name_value, root_templates, idx)
-            by_uuid[uuid_value] = template
-            by_name[name_value] = template
-
-        root_templates.scan_unique_objects(handle, "Name", "MapKey", 1)
-
-    def load_mod(self, pak, mod_name):
-        root_templates = lsf.loads(
-            pak.file_data(f"Public/{mod_name}/RootTemplates/_merged.lsf")
+    def __init__(self, index):
+        self.by_name = ObjectMap(
+            index,
+            "RootTemplate/Name",
+            lambda name, file, node_idx: RootTemplate(None, name, file, node_idx),
+        )
+        self.by_uuid = ObjectMap(
+            index,
+            "RootTemplate/MapKey",
+            lambda uuid, file, node_idx: RootTemplate(uuid, None, file, node_idx),
         )
-        self._index_root_templates(root_templates)
 
 
 def checktime(msg, cb):
@@ -186,33 +206,27 @@ def checktime(msg, cb):
     return rv
 
 
-def index_all_root_templates():
-    checktime("shared root templates", lambda: ROOT_TEMPLATES.load_mod(SHARED, "Shared"))
-    checktime(
-        "shareddev root templates", lambda: ROOT_TEMPLATES.load_mod(SHARED, "SharedDev")
-    )
-    checktime("gustav root templates", lambda: ROOT_TEMPLATES.load_mod(GUSTAV, "Gustav"))
-    checktime(
-        "gustavdev root templates", lambda: ROOT_TEMPLATES.load_mod(GUSTAV, "GustavDev")
-    )
-
-
 BG3_ROOT = Path(os.environ.get("BG3_DATA", os.path.expanduser("~/l/bg3/Data")))
 GUSTAV = checktime("Gustav.pak", lambda: pak.PakFile(BG3_ROOT / "Gustav.pak"))
 SHARED = checktime("Shared.pak", lambda: pak.PakFile(BG3_ROOT / "Shared.pak"))
 ENGINE = checktime("Engine.pak", lambda: pak.PakFile(BG3_ROOT / "Engine.pak"))
 MODELS = checktime("Models.pak", lambda: pak.PakFile(BG3_ROOT / "Models.pak"))
-ROOT_TEMPLATES = RootTemplateSet()
-ASSETS = AssetTypeSet()
+pak.configure_cache(int(os.environ.get("PYBG3_CACHE_BYTES", 0)))
+DATA = pak.PakSet()
+for pak_file in (ENGINE, SHARED, GUSTAV, MODELS):
+    DATA.add(pak_file)
+os.makedirs("out", exist_ok=True)
+OBJECTS = checktime(
+    "object index",
+    lambda: objects.ObjectIndex(Path("out/objects.idx"), [ENGINE, SHARED, GUSTAV]),
+)
+ROOT_TEMPLATES = RootTemplateSet(OBJECTS)
+ASSETS = AssetTypeSet(OBJECTS)
 BANKS = {}
 LEVEL_OBJECT_FILE_RE = re.compile(
     r"Mods/(?P<mod_name>[^/]+)/Levels/(?P<level_name>[^/]+)/(?P<type>LevelTemplates|Characters|Decals|Items|FogVolumes|TileConstructions|Terrains|Triggers|Lights|LightProbes|CombinedLights|Scenery|Splines)/(?P<file_name>[^/]+).lsf"
 )
 LEVELS = LevelSet()
-checktime("engine assets", lambda: ASSETS.load_pak(ENGINE))
-checktime("shared assets", lambda: ASSETS.load_pak(SHARED))
-checktime("gustav assets", lambda: ASSETS.load_pak(GUSTAV))
-checktime("root templates", index_all_root_templates)
 index = checktime(
     "load index",
     lambda: _pybg3._IndexReader(os.path.expanduser("~/code/libbg3/tmp/bg3.idx")),
@@ -273,45 +287,50 @@ def dump_granny(root, indent=0):
 class MeshConverter:
     def __init__(self):
         self._converted = {}
+        # extract_meshes decodes every mesh in a file at once, so the ones that haven't
+        # been converted yet are kept for later lookups of the same file.
+        self._pending = {}
 
     def convert(self, path, name):
         if path not in self._converted:
             self._converted[path] = {}
+            self._pending[path] = self._extract(path)
         path_meshes = self._converted[path]
         if name in path_meshes:
             return path_meshes[name]
         path_meshes[name] = None  # only try to convert once.
+        mesh = self._pending[path].pop(name, None)
+        if mesh is None:
+            print(f"failed to convert {path}: mesh not found: {name}")
+        elif mesh["positions"] is None:
+            print(f"skipped {path}: mesh has no positions: {name}")
+        else:
+            try:
+                path_meshes[name] = self._do_convert(path, name, mesh)
+            except Exception as e:
+                print(f"failed to convert {path}: {repr(e)}")
+        return path_meshes[name]
+
+    def _extract(self, path):
         try:
-            granny = _pybg3._GrannyReader.from_data(MODELS.file_data(path))
-            for mesh in granny.root.Meshes:
-                if mesh.Name == name:
-                    path_meshes[name] = self._do_convert(path, name, mesh)
-                    return path_meshes[name]
-            raise ValueError(f"mesh not found: {name}")
+            granny = _pybg3._GrannyReader.from_data(DATA.file_data(path))
+            return {mesh["name"]: mesh for mesh in granny.extract_meshes()}
         except Exception as e:
             print(f"failed to convert {path}: {repr(e)}")
-            return None
+            return {}
 
     def _do_convert(self, path, name, mesh):
-        g_vertices = np.array(mesh.PrimaryVertexData.Vertices, copy=False)
-        if len(mesh.PrimaryTopology.Indices16) > 0:
-            g_indices = np.array(
-                mesh.PrimaryTopology.Indices16, copy=False, dtype=np.uint16
-            )
-        else:
-            g_indices = np.array(mesh.PrimaryTopology.Indices, copy=False)
         stage_path = f"out/Meshes/{path}/{name}.usdc"
         os.makedirs(f"out/Meshes/{path}", exist_ok=True)
         u_stage = Usd.Stage.CreateNew(stage_path)
         u_mesh = UsdGeom.Mesh.Define(u_stage, "/mesh")
         u_points = u_mesh.CreatePointsAttr()
-        g_positions = rfn.structured_to_unstructured(
-            g_vertices[["f0", "f1", "f2"]], copy=False
+        vt_vertices = Vt.Vec3fArray.FromNumpy(np.array(mesh["positions"], copy=False))
+        vt_indices = Vt.IntArray.FromNumpy(
+            np.array(mesh["face_vertex_indices"], copy=False)
         )
-        vt_vertices = Vt.Vec3fArray.FromNumpy(g_positions)
-        vt_indices = Vt.IntArray.FromNumpy(g_indices)
         vt_face_counts = Vt.IntArray.FromNumpy(
-            np.full(g_indices.shape[0] // 3, 3, dtype=np.int32)
+            np.array(mesh["face_vertex_counts"], copy=False)
         )
         u_points.Set(vt_vertices)
         u_vertex_face_counts = u_mesh.CreateFaceVertexCountsAttr()
@@ -332,7 +351,7 @@ class PatchConverter:
             return self._converted[path]
         self._converted[path] = None
         try:
-            patch = _pybg3._PatchFile.from_data(GUSTAV.file_data(path))
+            patch = _pybg3._PatchFile.from_data(DATA.file_data(path))
             self._converted[path] = self._do_convert(path, patch)
             return self._converted[path]
         except Exception as e: